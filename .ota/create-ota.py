@@ -1,5 +1,5 @@
 #!/usr/bin/env python
-# create-ota - Create zlib-compressed Zigbee OTA file
+# create-ota - Create compressed Zigbee OTA file
 # Copyright 2023  Simon Arlott
 #
 # This program is free software: you can redistribute it and/or modify
@@ -16,21 +16,114 @@
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #pipenv run python create-ota.py -m 4353 -i 4113 -v 2 Heater_2.bin Heater_2.ota
+#
+# zlib images use the standard upgrade image tag, the window bits set the
+# inflate window the device allocates. heatshrink images (pip install
+# heatshrink2) use a manufacturer specific tag and need the least RAM.
+# With --base the image is a delta patch (pip install bsdiff4) against that
+# firmware, devices running anything else reject it. Publish it for devices
+# on the base version only and the full image for everyone else.
+# With --chunk_size the image is compressed in independent chunks, a device
+# that loses its parent or restarts continues after the last chunk it wrote
+# instead of downloading the whole image again.
+# Every image carries the SHA-256 of its compressed data in a second
+# sub-element, devices reject images without it or with a mismatch.
+# Firmware from before the digest only accepts an image with a single zlib
+# sub-element, so the first upgrade from it uses --no_digest. Publish that
+# image for those versions only, later upgrades carry the digest again.
 
 import argparse
 import functools
+import hashlib
+import struct
 import zlib
 
 import zigpy.ota
 
+# Must match the OTA_TAG_* values in main/ota_decoder.hpp
+HEATSHRINK_IMAGE_TAG = 0xF000
+ZLIB_PATCH_TAG = 0xF001
+HEATSHRINK_PATCH_TAG = 0xF002
+ZLIB_CHUNKS_TAG = 0xF003
+HEATSHRINK_CHUNKS_TAG = 0xF004
+# Must match OTA_TAG_IMAGE_DIGEST in main/esp_ota.h
+IMAGE_DIGEST_TAG = 0xF100
+# Must match OTA_PATCH_MAGIC in main/ota_patch.hpp
+PATCH_MAGIC = b"ZBDP"
+# Must match OTA_CHUNK_MAGIC in main/esp_ota.h
+CHUNK_MAGIC = b"ZBCK"
+# Flash sector of the device, chunks decode to whole sectors
+SECTOR_SIZE = 4096
 
-def create(filename, manufacturer_id, image_type, file_version, header_string):
-	with open(filename, "rb") as f:
-		data = f.read()
 
-	zobj = zlib.compressobj(level=zlib. Z_BEST_COMPRESSION)
+def delta(base, data):
+	import bsdiff4.core
+
+	control, diff, extra = bsdiff4.core.diff(base, data)
+	# The records of OtaPatch, each followed by its diff and extra bytes
+	patch = bytearray(struct.pack("<4sIII", PATCH_MAGIC, len(base), zlib.crc32(base), len(data)))
+	diff_pos = extra_pos = 0
+	for diff_len, extra_len, seek in control:
+		patch += struct.pack("<IIi", diff_len, extra_len, seek)
+		patch += diff[diff_pos:diff_pos + diff_len]
+		patch += extra[extra_pos:extra_pos + extra_len]
+		diff_pos += diff_len
+		extra_pos += extra_len
+	return bytes(patch)
+
+
+def compress(data, codec, window_bits, lookahead_bits, patch):
+	if codec == "heatshrink":
+		import heatshrink2
+
+		if window_bits is None:
+			window_bits = 12
+		# One byte of parameters in front of the stream
+		params = bytes([window_bits << 4 | lookahead_bits])
+		return HEATSHRINK_PATCH_TAG if patch else HEATSHRINK_IMAGE_TAG, params + heatshrink2.compress(data,
+			window_sz2=window_bits, lookahead_sz2=lookahead_bits)
+
+	if window_bits is None:
+		window_bits = 15
+	zobj = zlib.compressobj(level=zlib. Z_BEST_COMPRESSION, wbits=window_bits)
 	zdata = zobj.compress(data)
 	zdata += zobj.flush()
+	return ZLIB_PATCH_TAG if patch else zigpy.ota.image.ElementTagId.UPGRADE_IMAGE, zdata
+
+
+def compress_chunks(data, codec, window_bits, lookahead_bits, chunk_size):
+	# A header of magic, index and compressed length in front of each chunk
+	chunks = bytearray()
+	for index, offset in enumerate(range(0, len(data), chunk_size)):
+		_, cdata = compress(data[offset:offset + chunk_size], codec, window_bits, lookahead_bits, False)
+		chunks += struct.pack("<4sII", CHUNK_MAGIC, index, len(cdata))
+		chunks += cdata
+	return HEATSHRINK_CHUNKS_TAG if codec == "heatshrink" else ZLIB_CHUNKS_TAG, bytes(chunks)
+
+
+def create(filename, manufacturer_id, image_type, file_version, header_string,
+		codec, window_bits, lookahead_bits, base, chunk_size, no_digest):
+	with open(filename, "rb") as f:
+		data = f.read()
+
+	if base is not None:
+		with open(base, "rb") as f:
+			data = delta(f.read(), data)
+
+	if chunk_size is not None:
+		tag_id, zdata = compress_chunks(data, codec, window_bits, lookahead_bits, chunk_size)
+	else:
+		tag_id, zdata = compress(data, codec, window_bits, lookahead_bits, base is not None)
+
+	subelements = [
+		zigpy.ota.image.SubElement(
+			tag_id=zigpy.ota.image.ElementTagId(tag_id), data=zdata,
+		),
+	]
+	if not no_digest:
+		subelements.append(zigpy.ota.image.SubElement(
+			tag_id=zigpy.ota.image.ElementTagId(IMAGE_DIGEST_TAG), data=hashlib.sha256(zdata).digest(),
+		))
 
 	image = zigpy.ota.image.OTAImage(
 		header=zigpy.ota.image.OTAImageHeader(
@@ -47,11 +140,7 @@ def create(filename, manufacturer_id, image_type, file_version, header_string):
 			header_string=header_string[0:32],
 			image_size=0,
 		),
-		subelements=[
-			zigpy.ota.image.SubElement(
-				tag_id=zigpy.ota.image.ElementTagId.UPGRADE_IMAGE, data=zdata,
-			)
-		],
+		subelements=subelements,
 	)
 
 	image.header.header_length = len(image.header.serialize())
@@ -60,7 +149,7 @@ def create(filename, manufacturer_id, image_type, file_version, header_string):
 
 if __name__ == "__main__":
 	any_int = functools.wraps(int)(functools.partial(int, base=0))
-	parser = argparse.ArgumentParser(description="Create zlib-compressed Zigbee OTA file",
+	parser = argparse.ArgumentParser(description="Create compressed Zigbee OTA file",
 		epilog="Reads a firmware image file and outputs an OTA file on standard output")
 	parser.add_argument("filename", metavar="INPUT", type=str, help="Firmware image filename")
 	parser.add_argument("output", metavar="OUTPUT", type=str, help="OTA filename")
@@ -68,8 +157,24 @@ if __name__ == "__main__":
 	parser.add_argument("-i", "--image_type", metavar="IMAGE_ID", type=any_int, required=True, help="Image ID")
 	parser.add_argument("-v", "--file_version", metavar="VERSION", type=any_int, required=True, help="File version")
 	parser.add_argument("-s", "--header_string", metavar="HEADER_STRING", type=str, default="", help="Header String")
+	parser.add_argument("-c", "--codec", choices=["zlib", "heatshrink"], default="zlib", help="Compression of the image")
+	parser.add_argument("-w", "--window_bits", metavar="BITS", type=int, choices=range(4, 16), help="log2 of the window, the RAM the device needs to decompress (zlib 9-15, default 15; heatshrink 4-15, default 12)")
+	parser.add_argument("-b", "--base", metavar="BASE", type=str, help="Firmware image the devices run, creates a delta patch against it")
+	parser.add_argument("-k", "--chunk_size", metavar="BYTES", type=any_int, help="Compress the image in independent chunks of this many bytes, a multiple of 4096, so interrupted downloads resume")
+	parser.add_argument("-n", "--no_digest", "--no-digest", action="store_true", help="Leave out the SHA-256 sub-element, only for the first upgrade from firmware that predates it")
+	parser.add_argument("-l", "--lookahead_bits", metavar="BITS", type=int, choices=range(3, 15), default=4, help="log2 of the longest heatshrink match, below the window bits (default 4)")
 
 	args = parser.parse_args()
+	if args.codec == "zlib" and args.window_bits is not None and args.window_bits < 9:
+		parser.error("zlib needs at least 9 window bits")
+	if args.codec == "heatshrink" and args.lookahead_bits >= (args.window_bits or 12):
+		parser.error("the lookahead bits must be below the window bits")
+	if args.chunk_size is not None and (args.chunk_size <= 0 or args.chunk_size % SECTOR_SIZE):
+		parser.error("the chunk size must be a multiple of {}".format(SECTOR_SIZE))
+	if args.chunk_size is not None and args.base is not None:
+		parser.error("delta patches cannot be chunked")
+	if args.no_digest and (args.codec != "zlib" or args.base is not None or args.chunk_size is not None):
+		parser.error("firmware without the digest only reads plain zlib images")
 	output = args.output
 	del args.output
 
@@ -56,6 +56,39 @@ const fzLocal = {
             return result;
         },
     } ,
+    next_transition: {
+        cluster: 'customThermostat',
+        type: ['attributeReport', 'readResponse'],
+        convert: (model, msg, publish, options, meta) => {
+            const data = msg.data;
+            const result = {};
+
+            if(data.nextTransition !== undefined){
+                // Seconds since 1970 UTC, 0 when no schedule is set
+                const next = data['nextTransition'];
+                result.next_transition = next === 0 ? 'none' : new Date(next * 1000).toISOString();
+            }
+
+            return result;
+        },
+    } ,
+};
+
+const tzLocal = {
+    report_policy: {
+        key: ['report_policy'],
+        convertSet: async (entity, key, value, meta) => {
+            // Only attributes with a built-in policy on the device are accepted
+            await entity.command('customThermostat', 'setReportPolicy', {
+                cluster: value.cluster,
+                attribute: value.attribute,
+                min_interval: value.min_interval,
+                max_interval: value.max_interval,
+                reportable_change: value.reportable_change,
+            });
+            return {state: {report_policy: value}};
+        },
+    },
 };
 
 const definition = {
@@ -69,7 +102,8 @@ const definition = {
             attributes: {
                 runtimeSeconds: {ID: 0x0000, type: Zcl.DataType.UINT32},
                 usedTemperatureSource: {ID: 0x0001, type: Zcl.DataType.ENUM8},
-                currentTarget: {ID: 0x0002, type: Zcl.DataType.UINT32}
+                currentTarget: {ID: 0x0002, type: Zcl.DataType.UINT32},
+                nextTransition: {ID: 0x0003, type: Zcl.DataType.UINT32}
             },
             commands: {
                 setpointRaiseLower: {
@@ -94,6 +128,16 @@ const definition = {
                     ID: 0x3,
                     parameters: [],
                 },
+                setReportPolicy: {
+                    ID: 0x4,
+                    parameters: [
+                        {name: 'cluster', type: Zcl.DataType.UINT16},
+                        {name: 'attribute', type: Zcl.DataType.UINT16},
+                        {name: 'min_interval', type: Zcl.DataType.UINT16},
+                        {name: 'max_interval', type: Zcl.DataType.UINT16},
+                        {name: 'reportable_change', type: Zcl.DataType.UINT32},
+                    ],
+                },
                 setCustomWeeklySchedule: {
                     ID: 0xff,
                     parameters: _getCustomScheduleParameter(),
@@ -174,9 +218,18 @@ const definition = {
 
     ],
     ota: ota.zigbeeOTA,
-    fromZigbee: [fzLocal.current_target],
+    fromZigbee: [fzLocal.current_target, fzLocal.next_transition],
+    toZigbee: [tzLocal.report_policy],
     exposes: [
-        e.text('current_target', ea.STATE).withDescription('Current found schedule target'),],
+        e.text('current_target', ea.STATE).withDescription('Current found schedule target'),
+        e.text('next_transition', ea.STATE).withDescription('Time of the next schedule transition'),
+        e.composite('report_policy', 'report_policy', ea.SET)
+            .withFeature(e.numeric('cluster', ea.SET).withDescription('Cluster ID of the attribute'))
+            .withFeature(e.numeric('attribute', ea.SET).withDescription('Attribute ID'))
+            .withFeature(e.numeric('min_interval', ea.SET).withUnit('s'))
+            .withFeature(e.numeric('max_interval', ea.SET).withUnit('s'))
+            .withFeature(e.numeric('reportable_change', ea.SET).withDescription('Change in attribute units that triggers a report'))
+            .withDescription('Reporting interval and threshold of one attribute'),],
 
 };
 
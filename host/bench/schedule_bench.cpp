@@ -0,0 +1,364 @@
+// Micro-benchmarks of the schedule evaluation on the host build.
+//
+// Covers building the weekly lookup table, the per-minute lookups and the
+// Heater entry points, for schedules from a few to 1000 transitions spread
+// over one, five or seven days. Schedules beyond the capacity of the index
+// are skipped. The lookups are measured over the whole week
+// and over the minutes that wrap around the end of the week. The legacy
+// benchmarks replay the sorted insert and reverse find_if that every heat
+// check did before ScheduleIndex, as a baseline.
+//
+//   schedule_bench [--min-time MS] [--filter SUBSTRING]
+//
+// Prints one JSON object with ns/op, heap allocations/op and the peak heap
+// growth of every case.
+
+#include "custom_cluster.hpp"
+#include "esp_timer.h"
+#include "heater.hpp"
+#include "host_stubs.h"
+#include "schedule_index.hpp"
+#include "zcl/esp_zigbee_zcl_thermostat.h"
+
+#include <algorithm>
+#include <chrono>
+#include <malloc.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Heap accounting through the global allocation functions of this binary
+static struct {
+  uint64_t allocations;
+  uint64_t bytes;
+  int64_t current;
+  int64_t peak;
+} heap;
+
+void *operator new(size_t size) {
+  auto pointer = malloc(size ? size : 1);
+  if (pointer == nullptr)
+    throw std::bad_alloc();
+  heap.allocations++;
+  heap.bytes += size;
+  heap.current += malloc_usable_size(pointer);
+  if (heap.current > heap.peak)
+    heap.peak = heap.current;
+  return pointer;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *pointer) noexcept {
+  if (pointer == nullptr)
+    return;
+  heap.current -= malloc_usable_size(pointer);
+  free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept { operator delete(pointer); }
+void operator delete(void *pointer, size_t) noexcept { operator delete(pointer); }
+void operator delete[](void *pointer, size_t) noexcept {
+  operator delete(pointer);
+}
+
+struct BenchOptions {
+  double minTimeMs = 50;
+  const char *filter = nullptr;
+};
+
+struct BenchCase {
+  const char *maskName;
+  uint8_t mask; // esp_zb_day_of_week_t bits
+  uint8_t days;
+  uint16_t perDay;
+  uint16_t transitions; // perDay * days
+};
+
+static const struct {
+  const char *name;
+  uint8_t mask;
+} DAY_MASKS[] = {
+    {"sunday", SUNDAY},
+    {"weekdays", MONDAY | TUESDAY | WEDNESDAY | THURSDAY | FRIDAY},
+    {"daily", 0x7f},
+};
+
+static const uint16_t SIZES[] = {4, 10, 50, 100, 250, 500, 1000};
+
+// Keeps the compiler from dropping the measured work
+static volatile uint64_t sink;
+static void consume(uint64_t value) { sink = value; }
+
+static bool first = true;
+
+static void emit(const BenchCase &c, const char *name, uint64_t iterations,
+                 double nanos, uint64_t allocations, uint64_t bytes,
+                 int64_t peak) {
+  printf("%s\n    {\"name\":\"%s\",\"transitions\":%u,\"days\":\"%s\","
+         "\"iterations\":%llu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,"
+         "\"bytes_per_op\":%.1f,\"peak_heap_bytes\":%lld}",
+         first ? "" : ",", name, c.transitions, c.maskName,
+         (unsigned long long)iterations, nanos / iterations,
+         (double)allocations / iterations, (double)bytes / iterations,
+         (long long)peak);
+  first = false;
+}
+
+/// @brief Runs op in growing batches until the minimum time is reached
+template <typename Op>
+static void run(const BenchOptions &options, const BenchCase &c,
+                const char *name, Op op) {
+  if (options.filter && strstr(name, options.filter) == nullptr)
+    return;
+
+  op(); // Warm up, also lets lazily built state settle
+  auto allocations = heap.allocations;
+  auto bytes = heap.bytes;
+  auto baseline = heap.current;
+  heap.peak = heap.current;
+
+  using namespace std::chrono;
+  uint64_t iterations = 0;
+  uint64_t batch = 1;
+  auto start = steady_clock::now();
+  double elapsed = 0;
+  while (elapsed < options.minTimeMs * 1e6) {
+    for (uint64_t i = 0; i < batch; i++)
+      op();
+    iterations += batch;
+    batch *= 2;
+    elapsed = duration<double, std::nano>(steady_clock::now() - start).count();
+  }
+  emit(c, name, iterations, elapsed, heap.allocations - allocations,
+       heap.bytes - bytes, heap.peak - baseline);
+}
+
+// Transition times spread evenly over the day, starting after midnight so the
+// first minutes of the week wrap around to the previous Saturday
+static std::vector<esp_zb_custom_weekly_schedule_t>
+makeSchedule(const BenchCase &c) {
+  std::vector<esp_zb_custom_weekly_schedule_t> schedule;
+  for (uint16_t i = 0; i < c.perDay; i++) {
+    schedule.push_back(
+        {.dayOfWeekForSequence = (esp_zb_day_of_week_t)c.mask,
+         .transition_time = (uint16_t)(30 + i * (MINUTES_PER_DAY - 30) / c.perDay),
+         .tempSetPoint = (int16_t)(1600 + i % 8 * 50)});
+  }
+  return schedule;
+}
+
+static std::vector<ScheduleTransition>
+expand(const std::vector<esp_zb_custom_weekly_schedule_t> &schedule) {
+  std::vector<ScheduleTransition> transitions;
+  for (auto &&entry : schedule) {
+    for (uint8_t day = 0; day < 7; day++) {
+      if (entry.dayOfWeekForSequence & 1 << day)
+        transitions.push_back(
+            {.weekMinute =
+                 ScheduleIndex::toWeekMinute(day, entry.transition_time),
+             .temp = entry.tempSetPoint});
+    }
+  }
+  return transitions;
+}
+
+static void build(ScheduleIndex &index,
+                  const std::vector<ScheduleTransition> &transitions) {
+  index.clear();
+  for (auto &&t : transitions)
+    index.add(t);
+}
+
+// Minutes whose active transition lies in the previous week
+static std::vector<uint16_t> wrapMinutes(const ScheduleIndex &index) {
+  std::vector<uint16_t> minutes;
+  auto firstTransition = index.nextAfter(MINUTES_PER_WEEK - 1)->weekMinute;
+  auto lastTransition = index.activeAt(MINUTES_PER_WEEK - 1)->weekMinute;
+  for (uint16_t m = 0; m < firstTransition; m++)
+    minutes.push_back(m);
+  for (uint16_t m = lastTransition; m < MINUTES_PER_WEEK; m++)
+    minutes.push_back(m);
+  return minutes;
+}
+
+// What runHeatCheck did before ScheduleIndex, on every call
+namespace legacy {
+struct TimeTempMessage {
+  DayOfWeekW DayOfWeek;
+  uint16_t Time;
+  int16_t Temp;
+};
+
+static void insert(std::vector<TimeTempMessage> &cont, TimeTempMessage value) {
+  auto it = std::lower_bound(
+      cont.begin(), cont.end(), value,
+      [](TimeTempMessage b, TimeTempMessage a) {
+        return (a.DayOfWeek == b.DayOfWeek && a.Time > b.Time) ||
+               a.DayOfWeek > b.DayOfWeek;
+      });
+  cont.insert(it, value);
+}
+
+static int16_t lookup(
+    const std::unordered_map<DayOfWeekW,
+                             std::vector<esp_zb_weekly_schedule_single_s>>
+        &config,
+    uint16_t weekMinute) {
+  std::vector<TimeTempMessage> schedules;
+  for (auto &&c : config) {
+    for (auto &&i : c.second)
+      insert(schedules, {.DayOfWeek = c.first,
+                         .Time = i.transition_time,
+                         .Temp = i.tempSetPoint});
+  }
+  int minutes = weekMinute % MINUTES_PER_DAY;
+  int wday = weekMinute / MINUTES_PER_DAY;
+  auto res = std::find_if(schedules.rbegin(), schedules.rend(),
+                          [minutes, wday](TimeTempMessage ttm) {
+                            return (wday == (int)ttm.DayOfWeek &&
+                                    minutes >= ttm.Time) ||
+                                   wday > (int)ttm.DayOfWeek;
+                          });
+  return (res == schedules.rend()) ? schedules.back().Temp : res->Temp;
+}
+} // namespace legacy
+
+static void benchIndex(const BenchOptions &options, const BenchCase &c) {
+  if (c.transitions > SCHEDULE_INDEX_MAX_TRANSITIONS)
+    return;
+  auto schedule = makeSchedule(c);
+  auto transitions = expand(schedule);
+
+  ScheduleIndex index;
+  run(options, c, "index_build", [&] {
+    build(index, transitions);
+    consume(index.size());
+  });
+
+  build(index, transitions);
+  uint16_t minute = 0;
+  run(options, c, "index_active_at_sweep", [&] {
+    consume(index.activeAt(minute)->temp);
+    minute = (minute + 7) % MINUTES_PER_WEEK;
+  });
+  minute = 0;
+  run(options, c, "index_next_after_sweep", [&] {
+    consume(index.nextAfter(minute)->weekMinute);
+    minute = (minute + 7) % MINUTES_PER_WEEK;
+  });
+
+  auto wrap = wrapMinutes(index);
+  size_t position = 0;
+  run(options, c, "index_active_at_wrap", [&] {
+    consume(index.activeAt(wrap[position])->temp);
+    position = (position + 1) % wrap.size();
+  });
+  position = 0;
+  run(options, c, "index_next_after_wrap", [&] {
+    consume(index.nextAfter(wrap[position])->weekMinute);
+    position = (position + 1) % wrap.size();
+  });
+
+  std::unordered_map<DayOfWeekW, std::vector<esp_zb_weekly_schedule_single_s>>
+      config;
+  for (auto &&t : transitions)
+    config[(DayOfWeekW)(t.weekMinute / MINUTES_PER_DAY)].push_back(
+        {.transition_time = (uint16_t)(t.weekMinute % MINUTES_PER_DAY),
+         .tempSetPoint = t.temp});
+  minute = 0;
+  run(options, c, "legacy_insert_find_if_sweep", [&] {
+    consume(legacy::lookup(config, minute));
+    minute = (minute + 7) % MINUTES_PER_WEEK;
+  });
+  position = 0;
+  run(options, c, "legacy_insert_find_if_wrap", [&] {
+    consume(legacy::lookup(config, wrap[position]));
+    position = (position + 1) % wrap.size();
+  });
+}
+
+// Through the Heater itself, only for schedules that fit the state store
+static void benchHeater(const BenchOptions &options, BenchCase c) {
+  // An update only replaces the days it names, the others keep one
+  // transition each so the size of the merged schedule is known
+  uint8_t otherDays = ~c.mask & 0x7f;
+  c.transitions += 7 - c.days;
+  if (c.perDay > UINT8_MAX ||
+      c.transitions > STATE_STORE_MAX_SCHEDULE_ENTRIES)
+    return;
+  auto heater = Heater::GetInstance();
+  if (otherDays != 0) {
+    esp_zb_custom_weekly_schedule_header_t header = {.numberOfTransitions = 1,
+                                                     .mode = HEAT};
+    esp_zb_custom_weekly_schedule_t single = {
+        .dayOfWeekForSequence = (esp_zb_day_of_week_t)otherDays,
+        .transition_time = 0,
+        .tempSetPoint = 1600};
+    heater->updateCustomSchedule(header, &single);
+  }
+  auto schedule = makeSchedule(c);
+  esp_zb_custom_weekly_schedule_header_t header = {
+      .numberOfTransitions = (uint8_t)c.perDay, .mode = HEAT};
+
+  run(options, c, "heater_update_schedule", [&] {
+    heater->updateCustomSchedule(header, schedule.data());
+  });
+
+  // One simulated minute per check, so every minute of the week is visited
+  run(options, c, "heater_run_heat_check", [&] {
+    heater->updateLocalTemp(1900, esp_timer_get_time());
+    heater->runHeatCheck();
+    hostAdvanceTime(60 * 1000000LL);
+  });
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+      options.minTimeMs = atof(argv[++i]);
+    else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+      options.filter = argv[++i];
+    else {
+      fprintf(stderr,
+              "usage: schedule_bench [--min-time MS] [--filter SUBSTRING]\n");
+      return 2;
+    }
+  }
+
+  setenv("TZ", "UTC", 1);
+  tzset();
+  hostSetTime(1704067200LL * 1000000); // 2024-01-01 00:00 UTC
+  hostOnewireAddSensor(0x0102030405060728ULL, 1900);
+  Clock::GetInstance()->init();
+  auto heater = Heater::GetInstance();
+  heater->init();
+  heater->updateSystemMode(ESP_ZB_ZCL_THERMOSTAT_SYSTEM_MODE_HEAT);
+
+  printf("{\n  \"benchmarks\": [");
+  for (auto &&mask : DAY_MASKS) {
+    uint8_t days = __builtin_popcount(mask.mask);
+    uint16_t previous = 0;
+    for (auto size : SIZES) {
+      uint16_t perDay = std::max<uint16_t>(1, size / days);
+      // Small sizes round to the same schedule for the denser masks
+      if (perDay == previous)
+        continue;
+      previous = perDay;
+      BenchCase c = {.maskName = mask.name,
+                     .mask = mask.mask,
+                     .days = days,
+                     .perDay = perDay,
+                     .transitions = (uint16_t)(perDay * days)};
+      benchIndex(options, c);
+      benchHeater(options, c);
+    }
+  }
+  printf("\n  ]\n}\n");
+  return 0;
+}
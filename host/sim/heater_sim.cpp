@@ -0,0 +1,474 @@
+// Time-warp simulation of the heater control loop on the host build.
+//
+// Steps a virtual clock through days or months of scripted Zigbee input and
+// runs the real executor jobs against a simple room model. The summary counts
+// what matters on the device: heat checks per CPU second, relay toggles, NVS
+// writes and attribute updates per simulated day.
+//
+//   heater_sim [--days N] [--start UNIX] [--step SECONDS] [--nvs FILE]
+//              [--json] [SCENARIO]
+//
+// A scenario has one event per line, '#' starts a comment:
+//   <day|*> <HH|*>:<MM|*> <command> [argument]
+// The day counts from the start of the simulation, '*' matches every value.
+//   schedule <file>     SET_WEEKLY_SCHEDULE in the demo_payload_mqtt.json
+//                       format, relative to the scenario file
+//   manual <centi>      Write of the unoccupied heating setpoint
+//   remote <centi|room> Report of an external sensor, 'room' reports the
+//                       simulated room temperature
+//   sync                Time read response from the coordinator
+//   timezone <seconds>  Changes the local offset and syncs the time
+//   mode <n>            Write of the thermostat system mode
+
+#include "attribute_transaction.hpp"
+#include "custom_cluster.hpp"
+#include "custom_zigbee_types/schedule.hpp"
+#include "executor.hpp"
+#include "heater.hpp"
+#include "host_stubs.h"
+#include "temperature_sensor.hpp"
+#include "zigbee_device.hpp"
+#include "zigbee_worker.hpp"
+#include "zcl/esp_zigbee_zcl_thermostat.h"
+#include "zcl/esp_zigbee_zcl_time.h"
+
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Counts operator new outside of the stubs, the firmware must not allocate
+// once initialized
+static uint64_t heapAllocations = 0;
+
+void *operator new(size_t size) {
+  auto pointer = malloc(size ? size : 1);
+  if (pointer == nullptr)
+    throw std::bad_alloc();
+  if (hostStubDepth == 0)
+    heapAllocations++;
+  return pointer;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *pointer) noexcept { free(pointer); }
+void operator delete[](void *pointer) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { free(pointer); }
+
+#define SIM_DEFAULT_START 1704067200 // 2024-01-01 00:00 UTC
+#define SIM_SENSOR_ADDRESS 0x0102030405060728ULL
+#define SIM_WILDCARD -1
+
+struct SimEvent {
+  int day; // Since the start, SIM_WILDCARD for every day
+  int hour;
+  int minute;
+  std::string command;
+  std::string argument;
+  std::vector<uint8_t> payload; // Prepared schedule command
+  int line;
+};
+
+struct SimOptions {
+  int days = 365;
+  int64_t start = SIM_DEFAULT_START;
+  int step = 60;
+  const char *nvsPath = nullptr;
+  bool json = false;
+  const char *scenario = HEATER_SIM_DEFAULT_SCENARIO;
+};
+
+// Lumped room model, losing heat towards a seasonal outside temperature
+struct Room {
+  double temperature = 18.0;
+  double lossPerMinute = 1.0 / 600; // Time constant of ten hours
+  double heatPerMinute = 0.035;     // About 2 °C per hour with the relay on
+
+  static double outside(int64_t unixSeconds) {
+    // Coldest around the 20th of January
+    double day = fmod(unixSeconds / 86400.0, 365.25);
+    return 8.0 - 9.0 * cos(2 * M_PI * (day - 20) / 365.25);
+  }
+
+  void step(int64_t unixSeconds, double minutes, bool heating) {
+    temperature += minutes * lossPerMinute *
+                   (outside(unixSeconds) - temperature);
+    if (heating)
+      temperature += minutes * heatPerMinute;
+  }
+
+  int16_t centi() const { return (int16_t)lround(temperature * 100); }
+};
+
+static std::string directoryOf(const std::string &path) {
+  auto slash = path.find_last_of('/');
+  return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+// The payload files are flat enough to pick the numbers by key
+static bool jsonNumber(const std::string &json, const std::string &key,
+                       long &value) {
+  auto found = json.find("\"" + key + "\"");
+  if (found == std::string::npos)
+    return false;
+  auto colon = json.find(':', found + key.size() + 2);
+  if (colon == std::string::npos)
+    return false;
+  char *end;
+  value = strtol(json.c_str() + colon + 1, &end, 10);
+  return end != json.c_str() + colon + 1;
+}
+
+static bool loadSchedule(const std::string &path,
+                         std::vector<uint8_t> &payload) {
+  std::ifstream file(path);
+  if (!file)
+    return false;
+  std::stringstream content;
+  content << file.rdbuf();
+  auto json = content.str();
+
+  long transitions, dayOfWeek, mode;
+  if (!jsonNumber(json, "transitions", transitions) ||
+      !jsonNumber(json, "day_of_week", dayOfWeek) ||
+      !jsonNumber(json, "mode", mode) || transitions < 0 || transitions > 10)
+    return false;
+
+  esp_zb_weekly_schedule_header_t header = {
+      .numberOfTransitions = (uint8_t)transitions,
+      .dayOfWeekForSequence = (esp_zb_day_of_week_t)dayOfWeek,
+      .mode = (thermostat_weekly_schedule_mode_for_seq_t)mode};
+  payload.assign((uint8_t *)&header, (uint8_t *)&header + sizeof(header));
+  for (long i = 1; i <= transitions; i++) {
+    long time, setPoint;
+    if (!jsonNumber(json, "transition_time_" + std::to_string(i), time) ||
+        !jsonNumber(json, "set_point_" + std::to_string(i), setPoint))
+      return false;
+    esp_zb_weekly_schedule_single_s single = {
+        .transition_time = (uint16_t)time, .tempSetPoint = (int16_t)setPoint};
+    payload.insert(payload.end(), (uint8_t *)&single,
+                   (uint8_t *)&single + sizeof(single));
+  }
+  return true;
+}
+
+static bool parseField(const std::string &text, int &value) {
+  if (text == "*") {
+    value = SIM_WILDCARD;
+    return true;
+  }
+  char *end;
+  value = strtol(text.c_str(), &end, 10);
+  return !text.empty() && *end == '\0' && value >= 0;
+}
+
+static bool loadScenario(const char *path, std::vector<SimEvent> &events) {
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "Cannot open scenario %s\n", path);
+    return false;
+  }
+  std::string line;
+  for (int number = 1; std::getline(file, line); number++) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string day, time;
+    SimEvent event = {.line = number};
+    if (!(fields >> day))
+      continue;
+    fields >> time >> event.command >> event.argument;
+    auto colon = time.find(':');
+    if (colon == std::string::npos || !parseField(day, event.day) ||
+        !parseField(time.substr(0, colon), event.hour) ||
+        !parseField(time.substr(colon + 1), event.minute) ||
+        event.command.empty()) {
+      fprintf(stderr, "%s:%d: expected <day> <HH:MM> <command> [argument]\n",
+              path, number);
+      return false;
+    }
+    if (event.command == "schedule" &&
+        !loadSchedule(directoryOf(path) + "/" + event.argument,
+                      event.payload)) {
+      fprintf(stderr, "%s:%d: cannot read schedule %s\n", path, number,
+              event.argument.c_str());
+      return false;
+    }
+    events.push_back(event);
+  }
+  return true;
+}
+
+class Simulation {
+public:
+  explicit Simulation(const SimOptions &options) : options(options) {}
+
+  void apply(const SimEvent &event, int64_t now) {
+    auto worker = ZigbeeWorker::GetInstance();
+    auto value = atol(event.argument.c_str());
+    if (event.command == "schedule") {
+      worker->postCommand(ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
+                          SET_WEEKLY_SCHEDULE_COMMAND_ID, event.payload.data(),
+                          event.payload.size());
+    } else if (event.command == "manual") {
+      post(ZigbeeWorkKind::AttributeSet, ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
+           ESP_ZB_ZCL_ATTR_THERMOSTAT_UNOCCUPIED_HEATING_SETPOINT_ID,
+           ESP_ZB_ZCL_ATTR_TYPE_S16, (int16_t)value);
+    } else if (event.command == "remote") {
+      int16_t temp = event.argument == "room" ? room.centi() : (int16_t)value;
+      post(ZigbeeWorkKind::AttributeReport,
+           ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT,
+           ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, ESP_ZB_ZCL_ATTR_TYPE_S16,
+           temp);
+    } else if (event.command == "sync") {
+      sync(now);
+    } else if (event.command == "timezone") {
+      timeZoneOffset = value;
+      sync(now);
+    } else if (event.command == "mode") {
+      post(ZigbeeWorkKind::AttributeSet, ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
+           ESP_ZB_ZCL_ATTR_THERMOSTAT_SYSTEM_MODE_ID,
+           ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM, (uint8_t)value);
+    } else {
+      fprintf(stderr, "Scenario line %d: unknown command %s\n", event.line,
+              event.command.c_str());
+      return;
+    }
+    events++;
+  }
+
+  int run(const std::vector<SimEvent> &scenario) {
+    auto end = options.start + (int64_t)options.days * 86400;
+    auto cpuStart = clock();
+
+    for (int64_t now = options.start; now < end; now += options.step) {
+      // Events are scheduled in simulated UTC
+      auto sinceStart = now - options.start;
+      int day = sinceStart / 86400;
+      int hour = sinceStart % 86400 / 3600;
+      int minute = sinceStart % 3600 / 60;
+      bool newMinute = sinceStart % 60 < options.step;
+      for (auto &event : scenario) {
+        if (newMinute && matches(event.day, day) &&
+            matches(event.hour, hour) && matches(event.minute, minute))
+          apply(event, now);
+      }
+
+      bool relay = hostGpioLevel(HEATER_GPIO_PIN);
+      room.step(now, options.step / 60.0, relay);
+      if (relay)
+        heatingSeconds += options.step;
+      // Sampled by the sensor job like the real DS18B20, in 1/16 degree
+      // steps, and published as the measured value on every sample
+      hostOnewireSetTemperature(SIM_SENSOR_ADDRESS, room.centi());
+
+      auto jobsStart = clock();
+      runJobs((int64_t)options.step * 1000000);
+      jobsCpu += clock() - jobsStart;
+    }
+
+    totalCpu = clock() - cpuStart;
+    return 0;
+  }
+
+  void report() {
+    auto stats = ZigbeeWorker::GetInstance()->getStats();
+    auto memo = Heater::GetInstance()->getHeatCheckStats();
+    auto latency = Heater::GetInstance()->getLatency();
+    auto executor = Executor::GetInstance();
+    uint64_t checks = memo.hits + memo.misses;
+    double days = options.days;
+    double jobsSeconds = (double)jobsCpu / CLOCKS_PER_SEC;
+    double totalSeconds = (double)totalCpu / CLOCKS_PER_SEC;
+    double checksPerSecond = jobsSeconds > 0 ? checks / jobsSeconds : 0;
+
+    if (options.json) {
+      printf("{\"days\":%d,\"step_seconds\":%d,\"events\":%u,"
+             "\"heat_checks\":%llu,\"heat_check_hits\":%u,"
+             "\"heat_check_misses\":%u,\"checks_per_cpu_second\":%.0f,"
+             "\"cpu_seconds\":%.3f,\"relay_toggles\":%u,"
+             "\"heating_hours\":%.1f,\"nvs_sets\":%u,\"nvs_commits\":%u,"
+             "\"nvs_sets_per_day\":%.2f,\"nvs_commits_per_day\":%.2f,"
+             "\"nvs_bytes\":%zu,\"attribute_sets_per_day\":%.2f,"
+             "\"lock_acquires_per_day\":%.2f,\"worker_dropped\":%u,"
+             "\"heap_allocations\":%llu,\"latency_max_ms\":%u,"
+             "\"latency_buckets\":[",
+             options.days, options.step, events,
+             (unsigned long long)checks, memo.hits, memo.misses,
+             checksPerSecond, totalSeconds,
+             hostCounters.gpioToggles, heatingSeconds / 3600.0,
+             hostCounters.nvsSets, hostCounters.nvsCommits,
+             hostCounters.nvsSets / days, hostCounters.nvsCommits / days,
+             hostNvsBytes(), hostCounters.attributeSets / days,
+             hostCounters.lockAcquires / days, stats.dropped,
+             (unsigned long long)heapAllocations, latency.maxMs);
+      for (uint8_t i = 0; i < HEATER_LATENCY_BUCKETS; i++)
+        printf("%s%u", i > 0 ? "," : "", latency.buckets[i]);
+      printf("],\"jobs\":{");
+      for (uint8_t i = 0; i < executor->getJobCount(); i++) {
+        auto job = executor->getStats(i);
+        printf("%s\"%s\":%.2f", i > 0 ? "," : "", job.name, job.runs / days);
+      }
+      printf("}}\n");
+      return;
+    }
+
+    printf("Simulated %d days in %.3f s CPU, %u scenario events\n",
+           options.days, totalSeconds, events);
+    printf("  heat checks          %llu (%.0f per CPU second), %u unchanged\n",
+           (unsigned long long)checks, checksPerSecond, memo.hits);
+    printf("  relay toggles        %u (%.1f per day), heating %.1f h\n",
+           hostCounters.gpioToggles, hostCounters.gpioToggles / days,
+           heatingSeconds / 3600.0);
+    printf("  NVS writes           %u sets, %u commits (%.2f / %.2f per day)\n",
+           hostCounters.nvsSets, hostCounters.nvsCommits,
+           hostCounters.nvsSets / days, hostCounters.nvsCommits / days);
+    printf("  NVS content          %zu bytes\n", hostNvsBytes());
+    printf("  attribute updates    %u (%.2f per day)\n",
+           hostCounters.attributeSets, hostCounters.attributeSets / days);
+    printf("  Zigbee lock acquires %u (%.2f per day)\n",
+           hostCounters.lockAcquires, hostCounters.lockAcquires / days);
+    printf("  worker               %u processed, %u coalesced, %u dropped\n",
+           stats.processed, stats.coalesced, stats.dropped);
+    printf("  heap allocations     %llu after init\n",
+           (unsigned long long)heapAllocations);
+    printf("  sample to decision   max %u ms,", latency.maxMs);
+    for (uint8_t i = 0; i < HEATER_LATENCY_BUCKETS; i++) {
+      if (latency.buckets[i] == 0)
+        continue;
+      if (i < HEATER_LATENCY_BUCKETS - 1)
+        printf(" <%ums: %u", 1u << i, latency.buckets[i]);
+      else
+        printf(" more: %u", latency.buckets[i]);
+    }
+    printf("\n");
+    for (uint8_t i = 0; i < executor->getJobCount(); i++) {
+      auto job = executor->getStats(i);
+      printf("  job %-16s %u runs (%.2f per day)\n", job.name, job.runs,
+             job.runs / days);
+    }
+  }
+
+private:
+  // Plays the executor task through one step, sleeping to each deadline
+  static void runJobs(int64_t stepMicros) {
+    auto executor = Executor::GetInstance();
+    int64_t elapsed = 0;
+    for (;;) {
+      auto waitMs = executor->runDue();
+      if (waitMs == 0)
+        continue;
+      if (waitMs == EXECUTOR_IDLE ||
+          elapsed + (int64_t)waitMs * 1000 >= stepMicros)
+        break;
+      hostAdvanceTime((int64_t)waitMs * 1000);
+      hostRunTimers();
+      elapsed += (int64_t)waitMs * 1000;
+    }
+    hostAdvanceTime(stepMicros - elapsed);
+    hostRunTimers();
+  }
+
+  static bool matches(int field, int value) {
+    return field == SIM_WILDCARD || field == value;
+  }
+
+  template <typename T>
+  static void post(ZigbeeWorkKind kind, uint16_t clusterId, uint16_t id,
+                   esp_zb_zcl_attr_type_t type, T value) {
+    esp_zb_zcl_attribute_t attribute = {
+        .id = id, .data = {.type = type, .size = sizeof(T), .value = &value}};
+    // Like ZigbeeDevice::zb_attribute_set_handler
+    if (kind == ZigbeeWorkKind::AttributeSet)
+      AttributeTransaction::invalidate();
+    ZigbeeWorker::GetInstance()->postAttribute(kind, clusterId, &attribute);
+  }
+
+  // Same attributes as the read response to Clock::syncTimeRequest
+  void sync(int64_t now) {
+    post(ZigbeeWorkKind::AttributeReport, ESP_ZB_ZCL_CLUSTER_ID_TIME,
+         ESP_ZB_ZCL_ATTR_TIME_TIME_ID, ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME,
+         (uint32_t)now);
+    post(ZigbeeWorkKind::AttributeReport, ESP_ZB_ZCL_CLUSTER_ID_TIME,
+         ESP_ZB_ZCL_ATTR_TIME_LOCAL_TIME_ID, ESP_ZB_ZCL_ATTR_TYPE_U32,
+         (uint32_t)(now + timeZoneOffset));
+  }
+
+  const SimOptions &options;
+  Room room;
+  int32_t timeZoneOffset = 0;
+  uint32_t events = 0;
+  uint64_t heatingSeconds = 0;
+  clock_t jobsCpu = 0;
+  clock_t totalCpu = 0;
+};
+
+static void usage() {
+  fprintf(stderr, "usage: heater_sim [--days N] [--start UNIX] [--step "
+                  "SECONDS] [--nvs FILE] [--json] [SCENARIO]\n");
+}
+
+int main(int argc, char **argv) {
+  SimOptions options;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--days") == 0 && hasValue)
+      options.days = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--start") == 0 && hasValue)
+      options.start = atoll(argv[++i]);
+    else if (strcmp(argv[i], "--step") == 0 && hasValue)
+      options.step = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--nvs") == 0 && hasValue)
+      options.nvsPath = argv[++i];
+    else if (strcmp(argv[i], "--json") == 0)
+      options.json = true;
+    else if (argv[i][0] != '-')
+      options.scenario = argv[i];
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (options.days <= 0 || options.step <= 0 || options.step > 3600) {
+    usage();
+    return 2;
+  }
+
+  std::vector<SimEvent> scenario;
+  if (!loadScenario(options.scenario, scenario))
+    return 1;
+
+  // The heater works in local time through the Zigbee offset, not TZ
+  setenv("TZ", "UTC", 1);
+  tzset();
+  hostSetTime(options.start * 1000000);
+  if (options.nvsPath)
+    hostNvsLoad(options.nvsPath);
+
+  hostOnewireAddSensor(SIM_SENSOR_ADDRESS, 1800);
+  // Same order as app_main
+  Clock::GetInstance()->init();
+  ZigbeeDevice::GetInstance()->init();
+  // Counts only what the control loop does, not the boot
+  hostCounters = {};
+  heapAllocations = 0;
+
+  Simulation simulation(options);
+  simulation.run(scenario);
+  simulation.report();
+
+  if (options.nvsPath)
+    hostNvsSave(options.nvsPath);
+  if (heapAllocations > 0) {
+    fprintf(stderr, "The firmware allocated %llu times after init\n",
+            (unsigned long long)heapAllocations);
+    return 1;
+  }
+  return 0;
+}
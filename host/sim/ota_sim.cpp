@@ -0,0 +1,689 @@
+// Replays a Zigbee OTA download into CompressedOTA on the host build.
+//
+// Compresses a firmware image like .ota/create-ota.py, wraps it in the
+// upgrade image sub-element and hands it to the OTA callback block by block.
+// Between two blocks the radio round trip passes on the virtual clock while
+// the executor runs the writer, and the host flash model charges erases and
+// page programs. The summary shows how long the stack waited in the callback
+// per block and the end-to-end download time, then compares the written
+// partition with the input.
+//
+// With --base the download is a delta patch against that image, which the
+// tool puts into the running partition first.
+// With --chunk-size the image is compressed in independent chunks, and
+// --interrupt aborts the download at that percentage and starts it again.
+// The second attempt asks for the blocks from the offset the device put
+// into the FileOffset attribute, or from the start with --ignore-offset.
+// --bad-digest sends a wrong digest sub-element, the device has to reject
+// the image and keep the boot partition.
+// Every run also applies the CHECK of the firmware before the digest, which
+// only passes an image without it, as built with --no-digest. This firmware
+// rejects such an image at CHECK.
+//
+//   ota_sim [--codec zlib|heatshrink] [--window-bits N] [--lookahead-bits N]
+//           [--base IMAGE] [--chunk-size BYTES] [--interrupt PERCENT]
+//           [--ignore-offset] [--bad-digest] [--no-digest] [--block BYTES]
+//           [--rtt MS] [--dir DIR] [--json] FIRMWARE
+
+#include "esp_ota.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "executor.hpp"
+#include "host_stubs.h"
+#include "mbedtls/sha256.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <zlib.h>
+
+struct OtaSimOptions {
+  OtaCodec codec = OtaCodec::Zlib;
+  // Defaults of create-ota.py
+  int windowBits = -1;
+  int lookaheadBits = 4;
+  const char *base = nullptr;
+  size_t chunkSize = 0;
+  int interruptPercent = 0;
+  bool ignoreOffset = false;
+  bool badDigest = false;
+  bool noDigest = false;
+  size_t block = OTA_UPGRADE_MAX_DATA_SIZE;
+  // Image block request to response, one hop with the default polling
+  uint32_t rttMs = 40;
+  const char *dir = ".";
+  bool json = false;
+  const char *firmware = nullptr;
+};
+
+// What the restart hook reports, FINISH restarts and never returns
+struct OtaSimRun {
+  OtaSimOptions options;
+  std::vector<uint8_t> firmware;
+  size_t patchSize = 0;
+  size_t imageSize = 0;
+  uint32_t blocks = 0;
+  // Where the second attempt started and what it sent again
+  size_t resumedAt = 0;
+  size_t resent = 0;
+  bool baselineCheck = false;
+  int64_t start = 0;
+  int64_t finishStart = 0;
+  int64_t stackWait = 0;
+  int64_t maxStackWait = 0;
+};
+
+// Endpoint of the OTA client cluster
+#define OTA_SIM_ENDPOINT 1
+
+static OtaSimRun run;
+static CompressedOTA ota;
+
+static const char *codecName(OtaCodec codec) {
+  return codec == OtaCodec::Zlib ? "zlib" : "heatshrink";
+}
+
+static bool readFile(const std::string &path, std::vector<uint8_t> &content) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  content.assign(std::istreambuf_iterator<char>(file),
+                 std::istreambuf_iterator<char>());
+  return true;
+}
+
+static std::vector<uint8_t> zlibCompress(const std::vector<uint8_t> &data,
+                                         int windowBits) {
+  z_stream stream = {};
+  deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, windowBits, 8,
+               Z_DEFAULT_STRATEGY);
+  std::vector<uint8_t> compressed(deflateBound(&stream, data.size()));
+  stream.next_in = (Bytef *)data.data();
+  stream.avail_in = data.size();
+  stream.next_out = compressed.data();
+  stream.avail_out = compressed.size();
+  deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+  return compressed;
+}
+
+// Greedy heatshrink encoder with hash chains over 3 byte prefixes. Tokens
+// are a 1 bit and a literal byte, or a 0 bit, the distance - 1 in window
+// bits and the length - 1 in lookahead bits, MSB first.
+static std::vector<uint8_t> heatshrinkCompress(const std::vector<uint8_t> &data,
+                                               int windowBits,
+                                               int lookaheadBits) {
+  std::vector<uint8_t> compressed = {
+      (uint8_t)(windowBits << 4 | lookaheadBits)};
+  uint8_t current = 0;
+  uint8_t count = 0;
+  auto put = [&](uint32_t value, int bits) {
+    for (int i = bits - 1; i >= 0; i--) {
+      current = current << 1 | ((value >> i) & 1);
+      if (++count == 8) {
+        compressed.push_back(current);
+        current = 0;
+        count = 0;
+      }
+    }
+  };
+
+  size_t window = 1u << windowBits;
+  size_t maxLength = 1u << lookaheadBits;
+  // Shortest match that takes fewer bits than its literals
+  size_t minLength = (1 + windowBits + lookaheadBits) / 9 + 1;
+  std::vector<int32_t> heads(1 << 16, -1);
+  std::vector<int32_t> previous(data.size(), -1);
+  auto hash = [&](size_t i) {
+    return (data[i] << 8 ^ data[i + 1] << 4 ^ data[i + 2]) & 0xffff;
+  };
+  auto insert = [&](size_t i) {
+    if (i + 3 > data.size())
+      return;
+    auto h = hash(i);
+    previous[i] = heads[h];
+    heads[h] = i;
+  };
+
+  for (size_t i = 0; i < data.size();) {
+    size_t best = 0;
+    size_t bestDistance = 0;
+    if (i + 3 <= data.size()) {
+      auto limit = std::min(maxLength, data.size() - i);
+      int chain = 0;
+      for (auto j = heads[hash(i)];
+           j >= 0 && i - j <= window && chain < 256 && best < limit;
+           j = previous[j], chain++) {
+        size_t length = 0;
+        while (length < limit && data[j + length] == data[i + length])
+          length++;
+        if (length > best) {
+          best = length;
+          bestDistance = i - j;
+        }
+      }
+    }
+    if (best >= minLength) {
+      put(0, 1);
+      put(bestDistance - 1, windowBits);
+      put(best - 1, lookaheadBits);
+    } else {
+      best = 1;
+      put(1, 1);
+      put(data[i], 8);
+    }
+    for (size_t k = 0; k < best; k++)
+      insert(i + k);
+    i += best;
+  }
+  if (count > 0)
+    compressed.push_back(current << (8 - count));
+  return compressed;
+}
+
+// Suffixes of data by prefix doubling, the empty suffix first like bsdiff
+static std::vector<int32_t> suffixArray(const std::vector<uint8_t> &data) {
+  int32_t n = data.size();
+  std::vector<int32_t> suffixes(n + 1);
+  std::vector<int32_t> rank(n + 1);
+  std::vector<int32_t> next(n + 1);
+  for (int32_t i = 0; i <= n; i++) {
+    suffixes[i] = i;
+    rank[i] = i < n ? data[i] + 1 : 0;
+  }
+  for (int32_t step = 1;; step <<= 1) {
+    auto key = [&](int32_t i) {
+      return std::make_pair(rank[i], i + step <= n ? rank[i + step] : -1);
+    };
+    std::sort(suffixes.begin(), suffixes.end(),
+              [&](int32_t a, int32_t b) { return key(a) < key(b); });
+    next[suffixes[0]] = 0;
+    for (int32_t i = 1; i <= n; i++)
+      next[suffixes[i]] =
+          next[suffixes[i - 1]] + (key(suffixes[i - 1]) < key(suffixes[i]));
+    rank.swap(next);
+    if (rank[suffixes[n]] == n)
+      return suffixes;
+  }
+}
+
+static size_t matchLength(const uint8_t *a, size_t aSize, const uint8_t *b,
+                          size_t bSize) {
+  size_t i = 0;
+  while (i < aSize && i < bSize && a[i] == b[i])
+    i++;
+  return i;
+}
+
+// Longest match of target in base by binary search over the suffixes
+static size_t searchBase(const std::vector<int32_t> &suffixes,
+                         const std::vector<uint8_t> &base,
+                         const uint8_t *target, size_t targetSize, size_t start,
+                         size_t end, size_t *position) {
+  while (end - start >= 2) {
+    auto middle = start + (end - start) / 2;
+    auto offset = suffixes[middle];
+    if (memcmp(base.data() + offset, target,
+               std::min(base.size() - offset, targetSize)) < 0)
+      start = middle;
+    else
+      end = middle;
+  }
+  auto x = matchLength(base.data() + suffixes[start],
+                       base.size() - suffixes[start], target, targetSize);
+  auto y = matchLength(base.data() + suffixes[end],
+                       base.size() - suffixes[end], target, targetSize);
+  *position = x > y ? suffixes[start] : suffixes[end];
+  return std::max(x, y);
+}
+
+static void putLE32(std::vector<uint8_t> &out, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    out.push_back(value >> (8 * i));
+}
+
+// The bsdiff algorithm, serialized as OtaPatch reads it: the records are
+// interleaved with their diff and extra bytes instead of three blocks
+static std::vector<uint8_t> deltaPatch(const std::vector<uint8_t> &base,
+                                       const std::vector<uint8_t> &target) {
+  std::vector<uint8_t> patch;
+  putLE32(patch, OTA_PATCH_MAGIC);
+  putLE32(patch, base.size());
+  putLE32(patch, esp_rom_crc32_le(0, base.data(), base.size()));
+  putLE32(patch, target.size());
+
+  auto suffixes = suffixArray(base);
+  int64_t baseSize = base.size();
+  int64_t targetSize = target.size();
+  int64_t scan = 0, length = 0, position = 0;
+  int64_t lastScan = 0, lastPosition = 0, lastOffset = 0;
+  while (scan < targetSize) {
+    int64_t oldScore = 0;
+    int64_t scoreScan = scan += length;
+    for (; scan < targetSize; scan++) {
+      size_t found;
+      length = searchBase(suffixes, base, target.data() + scan,
+                          targetSize - scan, 0, baseSize, &found);
+      position = found;
+      for (; scoreScan < scan + length; scoreScan++)
+        if (scoreScan + lastOffset < baseSize &&
+            base[scoreScan + lastOffset] == target[scoreScan])
+          oldScore++;
+      if ((length == oldScore && length != 0) || length > oldScore + 8)
+        break;
+      if (scan + lastOffset < baseSize &&
+          base[scan + lastOffset] == target[scan])
+        oldScore--;
+    }
+    if (length == oldScore && scan != targetSize)
+      continue;
+
+    // Extend the last match forwards and this one backwards
+    int64_t score = 0, bestScore = 0, forward = 0;
+    for (int64_t i = 0; lastScan + i < scan && lastPosition + i < baseSize;) {
+      if (base[lastPosition + i] == target[lastScan + i])
+        score++;
+      i++;
+      if (score * 2 - i > bestScore * 2 - forward) {
+        bestScore = score;
+        forward = i;
+      }
+    }
+    int64_t backward = 0;
+    if (scan < targetSize) {
+      score = 0;
+      bestScore = 0;
+      for (int64_t i = 1; scan >= lastScan + i && position >= i; i++) {
+        if (base[position - i] == target[scan - i])
+          score++;
+        if (score * 2 - i > bestScore * 2 - backward) {
+          bestScore = score;
+          backward = i;
+        }
+      }
+    }
+    if (lastScan + forward > scan - backward) {
+      int64_t overlap = lastScan + forward - (scan - backward);
+      score = 0;
+      bestScore = 0;
+      int64_t split = 0;
+      for (int64_t i = 0; i < overlap; i++) {
+        if (target[lastScan + forward - overlap + i] ==
+            base[lastPosition + forward - overlap + i])
+          score++;
+        if (target[scan - backward + i] == base[position - backward + i])
+          score--;
+        if (score > bestScore) {
+          bestScore = score;
+          split = i + 1;
+        }
+      }
+      forward += split - overlap;
+      backward -= split;
+    }
+
+    int64_t extra = scan - backward - (lastScan + forward);
+    putLE32(patch, forward);
+    putLE32(patch, extra);
+    putLE32(patch, (position - backward) - (lastPosition + forward));
+    for (int64_t i = 0; i < forward; i++)
+      patch.push_back(target[lastScan + i] - base[lastPosition + i]);
+    patch.insert(patch.end(), target.begin() + lastScan + forward,
+                 target.begin() + lastScan + forward + extra);
+
+    lastScan = scan - backward;
+    lastPosition = position - backward;
+    lastOffset = position - scan;
+  }
+  return patch;
+}
+
+static std::vector<uint8_t> compress(const std::vector<uint8_t> &data,
+                                     const OtaSimOptions &options) {
+  if (options.codec == OtaCodec::Zlib)
+    return zlibCompress(data, options.windowBits);
+  return heatshrinkCompress(data, options.windowBits, options.lookaheadBits);
+}
+
+// Same as create-ota.py: the compressed data behind the tag of the codec
+// and a LE32 length, then the SHA-256 of that data in its own sub-element
+// unless --no-digest
+static std::vector<uint8_t> buildImage(const std::vector<uint8_t> &firmware,
+                                       const std::vector<uint8_t> *base,
+                                       const OtaSimOptions &options) {
+  bool zlib = options.codec == OtaCodec::Zlib;
+  uint16_t tag;
+  std::vector<uint8_t> data;
+  const auto &payload =
+      base != nullptr ? deltaPatch(*base, firmware) : firmware;
+  run.patchSize = base != nullptr ? payload.size() : 0;
+  if (base != nullptr) {
+    tag = zlib ? OTA_TAG_ZLIB_PATCH : OTA_TAG_HEATSHRINK_PATCH;
+    data = compress(payload, options);
+  } else if (options.chunkSize > 0) {
+    tag = zlib ? OTA_TAG_ZLIB_CHUNKS : OTA_TAG_HEATSHRINK_CHUNKS;
+    for (size_t offset = 0, index = 0; offset < payload.size();
+         offset += options.chunkSize, index++) {
+      auto end = std::min(offset + options.chunkSize, payload.size());
+      auto chunk = compress(std::vector<uint8_t>(payload.begin() + offset,
+                                                 payload.begin() + end),
+                            options);
+      putLE32(data, OTA_CHUNK_MAGIC);
+      putLE32(data, index);
+      putLE32(data, chunk.size());
+      data.insert(data.end(), chunk.begin(), chunk.end());
+    }
+  } else {
+    tag = zlib ? OTA_TAG_UPGRADE_IMAGE : OTA_TAG_HEATSHRINK_IMAGE;
+    data = compress(payload, options);
+  }
+  std::vector<uint8_t> image = {(uint8_t)tag, (uint8_t)(tag >> 8)};
+  for (int i = 0; i < 4; i++)
+    image.push_back(data.size() >> (8 * i));
+  image.insert(image.end(), data.begin(), data.end());
+  if (options.noDigest)
+    return image;
+
+  uint8_t digest[OTA_DIGEST_SIZE];
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  mbedtls_sha256_update(&sha, data.data(), data.size());
+  mbedtls_sha256_finish(&sha, digest);
+  if (options.badDigest)
+    digest[0] ^= 1;
+  image.push_back((uint8_t)OTA_TAG_IMAGE_DIGEST);
+  image.push_back(OTA_TAG_IMAGE_DIGEST >> 8);
+  putLE32(image, sizeof(digest));
+  image.insert(image.end(), digest, digest + sizeof(digest));
+  return image;
+}
+
+// CHECK of the firmware before the digest: it only reads an upgrade image
+// sub-element and expects it to end the image, so offset == image_size - 6
+static bool baselineCheck(const std::vector<uint8_t> &image) {
+  if (image.size() < 6 || image[0] != 0 || image[1] != 0)
+    return false;
+  uint32_t length = image[2] | image[3] << 8 | image[4] << 16 |
+                    (uint32_t)image[5] << 24;
+  return length == image.size() - 6;
+}
+
+static esp_err_t deliver(esp_zb_zcl_ota_upgrade_status_t status,
+                         uint32_t imageSize, uint8_t *payload, size_t size) {
+  esp_zb_zcl_ota_upgrade_value_message_t message = {};
+  message.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+  message.info.dst_endpoint = OTA_SIM_ENDPOINT;
+  message.upgrade_status = status;
+  message.ota_header.manufacturer_code = OTA_UPGRADE_MANUFACTURER;
+  message.ota_header.image_type = OTA_UPGRADE_IMAGE_TYPE;
+  message.ota_header.image_size = imageSize;
+  message.payload_size = size;
+  message.payload = payload;
+  return ota.zbOTAUpgradeStatusHandler(&message);
+}
+
+// Plays the executor task until the next block arrives. A writer run that
+// overlaps the arrival delays it, the Zigbee task would preempt it on the
+// device, so this errs on the slow side.
+static void waitForBlock(int64_t arrival) {
+  auto executor = Executor::GetInstance();
+  while (esp_timer_get_time() < arrival) {
+    auto waitMs = executor->runDue();
+    if (waitMs == 0)
+      continue;
+    auto remaining = arrival - esp_timer_get_time();
+    if (remaining <= 0)
+      break;
+    if (waitMs != EXECUTOR_IDLE && (int64_t)waitMs * 1000 < remaining)
+      remaining = (int64_t)waitMs * 1000;
+    hostAdvanceTime(remaining);
+    hostRunTimers();
+  }
+}
+
+static void report() {
+  auto end = esp_timer_get_time();
+  std::vector<uint8_t> written;
+  auto path = std::string(run.options.dir) + "/" +
+              esp_ota_get_next_update_partition(nullptr)->label + ".bin";
+  // The partition may hold an older, longer image behind the new one
+  bool match = readFile(path, written) &&
+               written.size() >= run.firmware.size() &&
+               std::equal(run.firmware.begin(), run.firmware.end(),
+                          written.begin());
+  auto stats = ota.getStats();
+
+  if (run.options.json) {
+    printf("{\"codec\": \"%s\", \"window_bits\": %d, "
+           "\"firmware_bytes\": %zu, \"image_bytes\": %zu, \"blocks\": %u, "
+           "\"total_ms\": %lld, \"stack_wait_ms\": %lld, "
+           "\"max_stack_wait_us\": %lld, \"finish_ms\": %lld, "
+           "\"flash_writes\": %u, \"flash_erases\": %u, \"ring_full\": %u, "
+           "\"ring_peak\": %u, \"decoder_heap\": %zu, \"patch_bytes\": %zu, "
+           "\"chunk_size\": %zu, \"resumed_at\": %zu, \"resent_bytes\": %zu, "
+           "\"baseline_check\": %s, \"match\": %s}\n",
+           codecName(run.options.codec), run.options.windowBits,
+           run.firmware.size(), run.imageSize, run.blocks,
+           (long long)(end - run.start) / 1000,
+           (long long)run.stackWait / 1000, (long long)run.maxStackWait,
+           (long long)(end - run.finishStart) / 1000,
+           hostCounters.otaWrites, hostCounters.otaErases, stats.stackDrains,
+           stats.maxRingBytes, stats.decoderHeap, run.patchSize,
+           run.options.chunkSize, run.resumedAt, run.resent,
+           run.baselineCheck ? "true" : "false", match ? "true" : "false");
+  } else {
+    printf("Downloaded %zu bytes in %u blocks of %zu, %u ms round trip\n",
+           run.imageSize, run.blocks, run.options.block, run.options.rttMs);
+    printf("  firmware             %zu bytes, %s with %d window bits to "
+           "%.1f%%\n",
+           run.firmware.size(), codecName(run.options.codec),
+           run.options.windowBits, 100.0 * run.imageSize / run.firmware.size());
+    if (run.options.base != nullptr)
+      printf("  delta patch          %zu bytes against %s\n", run.patchSize,
+             run.options.base);
+    if (run.options.chunkSize > 0)
+      printf("  chunks               %zu bytes of firmware each\n",
+             run.options.chunkSize);
+    if (run.options.interruptPercent > 0)
+      printf("  interrupted          at %d%%, resumed at %zu, sent %zu bytes "
+             "again\n",
+             run.options.interruptPercent, run.resumedAt, run.resent);
+    printf("  decoder heap         %zu bytes at the peak\n", stats.decoderHeap);
+    printf("  end to end           %.1f s\n", (end - run.start) / 1e6);
+    printf("  stack waited         %.1f s in total, max %lld us per block\n",
+           run.stackWait / 1e6, (long long)run.maxStackWait);
+    printf("  finish               %lld ms\n",
+           (long long)(end - run.finishStart) / 1000);
+    printf("  flash                %u writes, %u bytes, %u sector erases\n",
+           hostCounters.otaWrites, hostCounters.otaBytes,
+           hostCounters.otaErases);
+    printf("  ring                 peak %u bytes, full %u times\n",
+           stats.maxRingBytes, stats.stackDrains);
+    printf("  baseline check       %s\n",
+           run.baselineCheck ? "passes"
+                             : "fails, upgrade from it with --no-digest first");
+    printf("  partition            %s\n",
+           match ? "matches the firmware" : "DIFFERS from the firmware");
+  }
+  exit(match ? 0 : 1);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: ota_sim [--codec zlib|heatshrink] [--window-bits N] "
+          "[--lookahead-bits N] [--base IMAGE] [--chunk-size BYTES] "
+          "[--interrupt PERCENT] [--ignore-offset] [--bad-digest] "
+          "[--no-digest] [--block BYTES] [--rtt MS] [--dir DIR] [--json] "
+          "FIRMWARE\n");
+}
+
+int main(int argc, char **argv) {
+  auto &options = run.options;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--codec") == 0 && hasValue) {
+      i++;
+      if (strcmp(argv[i], "zlib") == 0)
+        options.codec = OtaCodec::Zlib;
+      else if (strcmp(argv[i], "heatshrink") == 0)
+        options.codec = OtaCodec::Heatshrink;
+      else {
+        usage();
+        return 2;
+      }
+    } else if (strcmp(argv[i], "--window-bits") == 0 && hasValue)
+      options.windowBits = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--lookahead-bits") == 0 && hasValue)
+      options.lookaheadBits = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--base") == 0 && hasValue)
+      options.base = argv[++i];
+    else if (strcmp(argv[i], "--chunk-size") == 0 && hasValue)
+      options.chunkSize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--interrupt") == 0 && hasValue)
+      options.interruptPercent = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--ignore-offset") == 0)
+      options.ignoreOffset = true;
+    else if (strcmp(argv[i], "--bad-digest") == 0)
+      options.badDigest = true;
+    else if (strcmp(argv[i], "--no-digest") == 0)
+      options.noDigest = true;
+    else if (strcmp(argv[i], "--block") == 0 && hasValue)
+      options.block = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--rtt") == 0 && hasValue)
+      options.rttMs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--dir") == 0 && hasValue)
+      options.dir = argv[++i];
+    else if (strcmp(argv[i], "--json") == 0)
+      options.json = true;
+    else if (argv[i][0] != '-')
+      options.firmware = argv[i];
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (options.windowBits < 0)
+    options.windowBits = options.codec == OtaCodec::Zlib ? 15 : 12;
+  bool validCodec =
+      options.codec == OtaCodec::Zlib
+          ? options.windowBits >= 9 && options.windowBits <= 15
+          : options.windowBits >= 4 && options.windowBits <= 15 &&
+                options.lookaheadBits >= 3 &&
+                options.lookaheadBits < options.windowBits;
+  bool validChunks =
+      options.chunkSize % OTA_SECTOR_SIZE == 0 &&
+      (options.chunkSize == 0 || options.base == nullptr) &&
+      options.interruptPercent >= 0 && options.interruptPercent < 100;
+  // Like create-ota.py, only plain zlib images go without the digest
+  bool validDigest =
+      !options.noDigest ||
+      (options.codec == OtaCodec::Zlib && options.base == nullptr &&
+       options.chunkSize == 0 && !options.badDigest);
+  if (options.firmware == nullptr || options.block == 0 ||
+      options.block > 0xffff || !validCodec || !validChunks || !validDigest) {
+    usage();
+    return 2;
+  }
+
+  if (!readFile(options.firmware, run.firmware)) {
+    fprintf(stderr, "Cannot read %s\n", options.firmware);
+    return 1;
+  }
+  setenv("HOST_OTA_DIR", options.dir, 1);
+  std::vector<uint8_t> base;
+  if (options.base != nullptr) {
+    if (!readFile(options.base, base)) {
+      fprintf(stderr, "Cannot read %s\n", options.base);
+      return 1;
+    }
+    auto path = std::string(options.dir) + "/" +
+                esp_ota_get_running_partition()->label + ".bin";
+    std::ofstream running(path, std::ios::binary);
+    running.write((const char *)base.data(), base.size());
+    if (!running) {
+      fprintf(stderr, "Cannot write %s\n", path.c_str());
+      return 1;
+    }
+  }
+  auto image =
+      buildImage(run.firmware, options.base ? &base : nullptr, options);
+  run.imageSize = image.size();
+  run.baselineCheck = baselineCheck(image);
+  hostRestartHook = report;
+
+  ota.init();
+  hostCounters = {};
+
+  run.start = esp_timer_get_time();
+  if (deliver(ESP_ZB_ZCL_OTA_UPGRADE_STATUS_START, image.size(), nullptr, 0) !=
+      ESP_OK) {
+    fprintf(stderr, "OTA start failed\n");
+    return 1;
+  }
+
+  size_t interruptAt = image.size() * options.interruptPercent / 100;
+  size_t sent = 0;
+  bool interrupted = false;
+  for (size_t offset = 0; offset < image.size(); offset += options.block) {
+    if (options.interruptPercent > 0 && offset >= interruptAt &&
+        !interrupted) {
+      interrupted = true;
+      // The parent is lost, the stack gives up and starts over later
+      deliver(ESP_ZB_ZCL_OTA_UPGRADE_STATUS_ABORT, image.size(), nullptr, 0);
+      if (deliver(ESP_ZB_ZCL_OTA_UPGRADE_STATUS_START, image.size(), nullptr,
+                  0) != ESP_OK) {
+        fprintf(stderr, "OTA restart failed\n");
+        return 1;
+      }
+      auto fileOffset = esp_zb_zcl_get_attribute(
+          OTA_SIM_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE,
+          ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE,
+          ESP_ZB_ZCL_ATTR_OTA_UPGRADE_FILE_OFFSET_ID);
+      offset = 0;
+      if (fileOffset != nullptr && !options.ignoreOffset)
+        offset = *(uint32_t *)fileOffset->data_p - OTA_FILE_HEADER_SIZE;
+      run.resumedAt = offset;
+      run.resent = sent - offset;
+    }
+    auto size = std::min(options.block, image.size() - offset);
+    sent = offset + size;
+    auto received = esp_timer_get_time();
+    if (deliver(ESP_ZB_ZCL_OTA_UPGRADE_STATUS_RECEIVE, image.size(),
+                image.data() + offset, size) != ESP_OK) {
+      fprintf(stderr, "OTA block at %zu failed\n", offset);
+      return 1;
+    }
+    auto wait = esp_timer_get_time() - received;
+    run.stackWait += wait;
+    run.maxStackWait = std::max(run.maxStackWait, wait);
+    run.blocks++;
+    waitForBlock(esp_timer_get_time() + options.rttMs * 1000LL);
+  }
+
+  run.finishStart = esp_timer_get_time();
+  if (deliver(ESP_ZB_ZCL_OTA_UPGRADE_STATUS_CHECK, image.size(), nullptr, 0) !=
+      ESP_OK) {
+    if (options.noDigest && run.baselineCheck) {
+      printf("Image without a digest passes the baseline check, this "
+             "firmware rejects it\n");
+      return 0;
+    }
+    fprintf(stderr, "OTA check failed\n");
+    return 1;
+  }
+  // Restarts into report() once the image is complete
+  deliver(ESP_ZB_ZCL_OTA_UPGRADE_STATUS_FINISH, image.size(), nullptr, 0);
+  if (options.badDigest &&
+      esp_ota_get_boot_partition() == esp_ota_get_running_partition()) {
+    printf("Image with a wrong digest rejected, boot partition kept\n");
+    return 0;
+  }
+  fprintf(stderr, "OTA finish did not restart\n");
+  return 1;
+}
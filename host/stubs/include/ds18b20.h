@@ -0,0 +1,27 @@
+#pragma once
+
+#include "ds18b20_types.h"
+#include "esp_err.h"
+#include "onewire_bus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+} ds18b20_config_t;
+
+esp_err_t ds18b20_new_device(onewire_device_t *device,
+                             const ds18b20_config_t *config,
+                             ds18b20_device_handle_t *ret_ds18b20);
+esp_err_t ds18b20_del_device(ds18b20_device_handle_t ds18b20);
+esp_err_t ds18b20_set_resolution(ds18b20_device_handle_t ds18b20,
+                                 ds18b20_resolution_t resolution);
+esp_err_t
+ds18b20_trigger_temperature_conversion(ds18b20_device_handle_t ds18b20);
+esp_err_t ds18b20_get_temperature(ds18b20_device_handle_t ds18b20,
+                                  float *temperature);
+
+#ifdef __cplusplus
+}
+#endif
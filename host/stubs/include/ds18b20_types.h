@@ -0,0 +1,18 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ds18b20_device_t *ds18b20_device_handle_t;
+
+typedef enum {
+  DS18B20_RESOLUTION_9B,
+  DS18B20_RESOLUTION_10B,
+  DS18B20_RESOLUTION_11B,
+  DS18B20_RESOLUTION_12B,
+} ds18b20_resolution_t;
+
+#ifdef __cplusplus
+}
+#endif
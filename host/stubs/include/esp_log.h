@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Host builds log to stderr; HOST_LOG_LEVEL (0-5) filters at compile time */
+#ifndef HOST_LOG_LEVEL
+#define HOST_LOG_LEVEL 2
+#endif
+
+void esp_log_host(int level, const char *tag, const char *format, ...);
+void esp_log_buffer_hex_host(const char *tag, const void *buffer,
+                             uint16_t length);
+
+#define ESP_LOGE(tag, format, ...) esp_log_host(1, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esp_log_host(2, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) esp_log_host(3, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) esp_log_host(4, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) esp_log_host(5, tag, format, ##__VA_ARGS__)
+#define ESP_EARLY_LOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+
+#define ESP_LOG_BUFFER_HEX(tag, buffer, len)                                   \
+  esp_log_buffer_hex_host(tag, buffer, len)
+#define ESP_LOG_BUFFER_CHAR(tag, buffer, len)                                  \
+  esp_log_buffer_hex_host(tag, buffer, len)
+
+#ifdef __cplusplus
+}
+#endif
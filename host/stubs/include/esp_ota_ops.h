@@ -0,0 +1,26 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_ERR_OTA_BASE 0x1500
+#define ESP_ERR_OTA_VALIDATE_FAILED (ESP_ERR_OTA_BASE + 0x03)
+
+/* The host implementation backs every OTA partition with a file in the
+ * directory named by HOST_OTA_DIR (defaults to the working directory). */
+const esp_partition_t *
+esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_boot_partition(void);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_zigbee_attribute.h"
+#include "esp_zigbee_type.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "zcl/esp_zigbee_zcl_command.h"
+#include "zcl/esp_zigbee_zcl_common.h"
+#include "zcl/esp_zigbee_zcl_ota.h"
+#include "zcl/esp_zigbee_zcl_temperature_meas.h"
+#include "zcl/esp_zigbee_zcl_thermostat.h"
+#include "zcl/esp_zigbee_zcl_time.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID = 0x0000,
+  ESP_ZB_CORE_OTA_UPGRADE_VALUE_CB_ID = 0x0004,
+  ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID = 0x1000,
+  ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID = 0x1002,
+  ESP_ZB_CORE_REPORT_ATTR_CB_ID = 0x2000,
+  ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID = 0x100c,
+  ESP_ZB_CORE_CMD_GREEN_POWER_RECV_CB_ID = 0x1100,
+} esp_zb_core_action_callback_id_t;
+
+/* Host stubs keep the attributes the firmware publishes in an in-memory
+ * table, so unchanged values can be detected like on the device. */
+esp_zb_zcl_status_t esp_zb_zcl_set_attribute_val(uint8_t endpoint,
+                                                 uint16_t cluster_id,
+                                                 uint8_t cluster_role,
+                                                 uint16_t attr_id,
+                                                 void *value_p, bool check);
+esp_zb_zcl_attr_t *esp_zb_zcl_get_attribute(uint8_t endpoint,
+                                            uint16_t cluster_id,
+                                            uint8_t cluster_role,
+                                            uint16_t attr_id);
+esp_err_t esp_zb_zcl_update_reporting_info(
+    esp_zb_zcl_reporting_info_t *config);
+bool esp_zb_lock_acquire(TickType_t block_ticks);
+void esp_zb_lock_release(void);
+
+#ifdef __cplusplus
+}
+#endif
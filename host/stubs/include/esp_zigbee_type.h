@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_ZB_PACKED_STRUCT __attribute__((packed))
+
+typedef uint8_t esp_zb_ieee_addr_t[8];
+
+typedef enum {
+  ESP_ZB_ZCL_STATUS_SUCCESS = 0x00,
+  ESP_ZB_ZCL_STATUS_FAIL = 0x01,
+  ESP_ZB_ZCL_STATUS_INVALID_VALUE = 0x87,
+  ESP_ZB_ZCL_STATUS_UNSUP_ATTRIB = 0x86,
+} esp_zb_zcl_status_t;
+
+typedef enum {
+  ESP_ZB_ZCL_CLUSTER_SERVER_ROLE = 0x01,
+  ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE = 0x02,
+} esp_zb_zcl_cluster_role_t;
+
+typedef enum {
+  ESP_ZB_ZCL_ATTR_TYPE_NULL = 0x00,
+  ESP_ZB_ZCL_ATTR_TYPE_8BIT = 0x08,
+  ESP_ZB_ZCL_ATTR_TYPE_8BITMAP = 0x18,
+  ESP_ZB_ZCL_ATTR_TYPE_U8 = 0x20,
+  ESP_ZB_ZCL_ATTR_TYPE_U16 = 0x21,
+  ESP_ZB_ZCL_ATTR_TYPE_U32 = 0x23,
+  ESP_ZB_ZCL_ATTR_TYPE_S8 = 0x28,
+  ESP_ZB_ZCL_ATTR_TYPE_S16 = 0x29,
+  ESP_ZB_ZCL_ATTR_TYPE_S32 = 0x2b,
+  ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM = 0x30,
+  ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING = 0x41,
+  ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING = 0x42,
+  ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME = 0xe2,
+  ESP_ZB_ZCL_ATTR_TYPE_INVALID = 0xff,
+} esp_zb_zcl_attr_type_t;
+
+typedef enum {
+  ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY = 0x01,
+  ESP_ZB_ZCL_ATTR_ACCESS_WRITE_ONLY = 0x02,
+  ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE = 0x03,
+  ESP_ZB_ZCL_ATTR_ACCESS_REPORTING = 0x04,
+  ESP_ZB_ZCL_ATTR_ACCESS_SCENE = 0x10,
+} esp_zb_zcl_attr_access_t;
+
+typedef enum {
+  ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT = 0x00,
+  ESP_ZB_APS_ADDR_MODE_16_GROUP_ENDP_NOT_PRESENT = 0x01,
+  ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT = 0x02,
+  ESP_ZB_APS_ADDR_MODE_64_ENDP_PRESENT = 0x03,
+} esp_zb_aps_address_mode_t;
+typedef esp_zb_aps_address_mode_t esp_zb_zcl_address_mode_t;
+
+typedef enum {
+  ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV = 0x00,
+  ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI = 0x01,
+} esp_zb_zcl_cmd_direction_t;
+
+#define ESP_ZB_AF_HA_PROFILE_ID 0x0104
+#define ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC 0xffff
+
+typedef union {
+  uint16_t addr_short;
+  esp_zb_ieee_addr_t addr_long;
+} esp_zb_addr_u;
+
+typedef struct {
+  uint8_t addr_type;
+  union {
+    uint16_t short_addr;
+    uint32_t src_id;
+    esp_zb_ieee_addr_t ieee_addr;
+  } u;
+} esp_zb_zcl_addr_t;
+
+typedef struct {
+  esp_zb_zcl_attr_type_t type;
+  uint16_t size;
+  void *value;
+} esp_zb_zcl_attribute_data_t;
+
+typedef struct {
+  uint16_t id;
+  esp_zb_zcl_attribute_data_t data;
+} esp_zb_zcl_attribute_t;
+
+typedef struct {
+  uint16_t id;
+  uint8_t type;
+  uint8_t access;
+  uint16_t manuf_code;
+  void *data_p;
+} esp_zb_zcl_attr_t;
+
+typedef struct esp_zb_attribute_list_s esp_zb_attribute_list_t;
+typedef struct esp_zb_cluster_list_s esp_zb_cluster_list_t;
+typedef struct esp_zb_ep_list_s esp_zb_ep_list_t;
+
+typedef struct esp_zb_thermostat_cluster_cfg_s {
+  int16_t local_temperature;
+  int16_t occupied_cooling_setpoint;
+  int16_t occupied_heating_setpoint;
+  uint8_t control_sequence_of_operation;
+  uint8_t system_mode;
+} esp_zb_thermostat_cluster_cfg_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define portTICK_PERIOD_MS ((TickType_t)1)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(xTimeInMs))
+#define pdTICKS_TO_MS(xTicks) ((uint32_t)(xTicks))
+#define pdTRUE ((BaseType_t)1)
+#define pdFALSE ((BaseType_t)0)
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#ifdef __cplusplus
+}
+#endif
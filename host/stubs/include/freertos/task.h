@@ -0,0 +1,42 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*TaskFunction_t)(void *);
+typedef struct tskTaskControlBlock *TaskHandle_t;
+
+typedef enum {
+  eNoAction = 0,
+  eSetBits,
+  eIncrement,
+  eSetValueWithOverwrite,
+  eSetValueWithoutOverwrite
+} eNotifyAction;
+
+/* Tasks are recorded but never scheduled on the host, drivers call the task
+ * bodies' building blocks directly. */
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char *pcName,
+                       uint32_t usStackDepth, void *pvParameters,
+                       UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask);
+void vTaskDelay(TickType_t xTicksToDelay);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue,
+                       eNotifyAction eAction);
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry,
+                           uint32_t ulBitsToClearOnExit,
+                           uint32_t *pulNotificationValue,
+                           TickType_t xTicksToWait);
+#define xTaskNotifyGive(xTaskToNotify)                                         \
+  xTaskNotify((xTaskToNotify), 0, eIncrement)
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit,
+                          TickType_t xTicksToWait);
+
+#ifdef __cplusplus
+}
+#endif
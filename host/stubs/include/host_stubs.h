@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hooks that only exist in the host build, used by tools to drive and
+ * observe the firmware code. */
+
+struct HostCounters {
+  uint32_t nvsSets;       // nvs_set_* calls that changed the stored value
+  uint32_t nvsCommits;    // nvs_commit calls
+  uint32_t nvsOpens;      // nvs_open calls
+  uint32_t attributeSets; // esp_zb_zcl_set_attribute_val calls
+  uint32_t lockAcquires;  // esp_zb_lock_acquire calls
+  uint32_t gpioToggles;   // gpio_set_level calls that changed the level
+  uint32_t otaBytes;      // bytes passed to esp_partition_write
+  uint32_t otaWrites;     // esp_partition_write calls
+  uint32_t otaErases;     // sectors erased by esp_partition_erase_range
+};
+
+extern HostCounters hostCounters;
+
+/// @brief Nonzero while a stub uses the heap for its own bookkeeping, so
+/// tools can tell those allocations from the ones of the firmware code
+extern int hostStubDepth;
+
+struct HostStubScope {
+  HostStubScope() { hostStubDepth++; }
+  ~HostStubScope() { hostStubDepth--; }
+};
+
+/// @brief Runs in esp_restart() before the process exits, tools report
+/// from it what happened up to the restart
+extern void (*hostRestartHook)();
+
+/// @brief Virtual wall clock in microseconds since 1970, backs time(),
+/// gettimeofday() and settimeofday(). esp_partition_write and
+/// esp_partition_erase_range advance it by the modelled flash time.
+void hostSetTime(int64_t unixMicros);
+int64_t hostGetTime();
+void hostAdvanceTime(int64_t micros);
+
+/// @brief Runs all esp_timer callbacks that became due up to now
+void hostRunTimers();
+
+/// @brief Loads or saves the in-memory NVS content, empty path keeps it in
+/// memory only
+bool hostNvsLoad(const char *path);
+bool hostNvsSave(const char *path);
+void hostNvsClear();
+size_t hostNvsBytes();
+
+int hostGpioLevel(int gpio);
+
+/// @brief Adds a simulated DS18B20 to the 1-Wire bus, the family code 0x28
+/// is forced into the lowest address byte
+void hostOnewireAddSensor(uint64_t address, int16_t centiDegrees);
+void hostOnewireSetTemperature(uint64_t address, int16_t centiDegrees);
+void hostOnewireRemoveAll();
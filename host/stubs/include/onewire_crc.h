@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint8_t onewire_crc8(uint8_t init_crc, uint8_t *input, size_t input_size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct onewire_bus_t *onewire_bus_handle_t;
+typedef struct onewire_device_iter_t *onewire_device_iter_handle_t;
+typedef uint64_t onewire_device_address_t;
+
+typedef struct {
+  onewire_bus_handle_t bus;
+  onewire_device_address_t address;
+} onewire_device_t;
+
+#ifdef __cplusplus
+}
+#endif
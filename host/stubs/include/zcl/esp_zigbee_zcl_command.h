@@ -0,0 +1,160 @@
+#pragma once
+
+#include "esp_zigbee_type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  uint8_t id;
+  uint8_t direction;
+  uint8_t is_common;
+} esp_zb_zcl_command_t;
+
+typedef struct {
+  esp_zb_zcl_status_t status;
+  esp_zb_zcl_addr_t src_address;
+  uint16_t dst_address;
+  uint8_t src_endpoint;
+  uint8_t dst_endpoint;
+  uint16_t cluster;
+  uint16_t profile;
+  esp_zb_zcl_command_t command;
+} esp_zb_zcl_cmd_info_t;
+
+typedef struct {
+  esp_zb_zcl_status_t status;
+  uint8_t dst_endpoint;
+  uint16_t cluster;
+} esp_zb_device_cb_common_info_t;
+
+typedef struct {
+  esp_zb_addr_u dst_addr_u;
+  uint8_t dst_endpoint;
+  uint8_t src_endpoint;
+} esp_zb_zcl_basic_cmd_t;
+
+typedef struct {
+  esp_zb_zcl_basic_cmd_t zcl_basic_cmd;
+  esp_zb_zcl_address_mode_t address_mode;
+  uint16_t clusterID;
+  uint8_t attr_number;
+  uint16_t *attr_field;
+} esp_zb_zcl_read_attr_cmd_t;
+
+typedef struct {
+  esp_zb_device_cb_common_info_t info;
+  esp_zb_zcl_attribute_t attribute;
+} esp_zb_zcl_set_attr_value_message_t;
+
+typedef struct {
+  esp_zb_zcl_status_t status;
+  esp_zb_zcl_addr_t src_address;
+  uint8_t src_endpoint;
+  uint8_t dst_endpoint;
+  uint16_t cluster;
+  esp_zb_zcl_attribute_t attribute;
+} esp_zb_zcl_report_attr_message_t;
+
+typedef struct esp_zb_zcl_read_attr_resp_variable_s {
+  esp_zb_zcl_status_t status;
+  esp_zb_zcl_attribute_t attribute;
+  struct esp_zb_zcl_read_attr_resp_variable_s *next;
+} esp_zb_zcl_read_attr_resp_variable_t;
+
+typedef struct {
+  esp_zb_zcl_cmd_info_t info;
+  esp_zb_zcl_read_attr_resp_variable_t *variables;
+} esp_zb_zcl_cmd_read_attr_resp_message_t;
+
+typedef struct esp_zb_zcl_config_report_resp_variable_s {
+  esp_zb_zcl_status_t status;
+  uint8_t direction;
+  uint16_t attribute_id;
+  struct esp_zb_zcl_config_report_resp_variable_s *next;
+} esp_zb_zcl_config_report_resp_variable_t;
+
+typedef struct {
+  esp_zb_zcl_cmd_info_t info;
+  esp_zb_zcl_config_report_resp_variable_t *variables;
+} esp_zb_zcl_cmd_config_report_resp_message_t;
+
+typedef struct {
+  esp_zb_zcl_cmd_info_t info;
+  struct {
+    uint16_t size;
+    void *value;
+  } data;
+} esp_zb_zcl_custom_cluster_command_message_t;
+
+typedef enum {
+  ESP_ZB_ZCL_OTA_UPGRADE_STATUS_START = 0x0000,
+  ESP_ZB_ZCL_OTA_UPGRADE_STATUS_APPLY = 0x0001,
+  ESP_ZB_ZCL_OTA_UPGRADE_STATUS_RECEIVE = 0x0002,
+  ESP_ZB_ZCL_OTA_UPGRADE_STATUS_FINISH = 0x0003,
+  ESP_ZB_ZCL_OTA_UPGRADE_STATUS_ABORT = 0x0004,
+  ESP_ZB_ZCL_OTA_UPGRADE_STATUS_CHECK = 0x0005,
+  ESP_ZB_ZCL_OTA_UPGRADE_STATUS_OK = 0x0006,
+  ESP_ZB_ZCL_OTA_UPGRADE_STATUS_ERROR = 0x0007,
+} esp_zb_zcl_ota_upgrade_status_t;
+
+typedef struct {
+  uint16_t manufacturer_code;
+  uint16_t image_type;
+  uint32_t file_version;
+  uint32_t image_size;
+} esp_zb_zcl_ota_upgrade_file_header_t;
+
+typedef struct {
+  esp_zb_device_cb_common_info_t info;
+  esp_zb_zcl_ota_upgrade_status_t upgrade_status;
+  esp_zb_zcl_ota_upgrade_file_header_t ota_header;
+  uint16_t payload_size;
+  uint8_t *payload;
+} esp_zb_zcl_ota_upgrade_value_message_t;
+
+typedef union {
+  uint8_t u8;
+  int8_t s8;
+  uint16_t u16;
+  int16_t s16;
+  uint32_t u32;
+  int32_t s32;
+  uint8_t data_buf[4];
+} esp_zb_zcl_attr_var_t;
+
+typedef struct {
+  uint8_t direction;
+  uint8_t ep;
+  uint16_t cluster_id;
+  uint8_t cluster_role;
+  uint16_t attr_id;
+  uint8_t flags;
+  uint32_t run_time;
+  union {
+    struct {
+      uint16_t min_interval;
+      uint16_t max_interval;
+      esp_zb_zcl_attr_var_t delta;
+      esp_zb_zcl_attr_var_t reported_value;
+      uint16_t def_min_interval;
+      uint16_t def_max_interval;
+    } send_info;
+    struct {
+      uint16_t timeout;
+    } recv_info;
+  } u;
+  struct {
+    uint16_t short_addr;
+    uint8_t endpoint;
+    uint16_t profile_id;
+  } dst;
+  uint16_t manuf_code;
+} esp_zb_zcl_reporting_info_t;
+
+uint8_t esp_zb_zcl_read_attr_cmd_req(esp_zb_zcl_read_attr_cmd_t *cmd_req);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "esp_zigbee_type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  ESP_ZB_ZCL_CLUSTER_ID_BASIC = 0x0000,
+  ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY = 0x0003,
+  ESP_ZB_ZCL_CLUSTER_ID_TIME = 0x000a,
+  ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE = 0x0019,
+  ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT = 0x0201,
+  ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT = 0x0402,
+  ESP_ZB_ZCL_CLUSTER_ID_METER_IDENTIFICATION = 0x0b01,
+} esp_zb_zcl_cluster_id_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "esp_zigbee_type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  ESP_ZB_ZCL_ATTR_OTA_UPGRADE_SERVER_ID = 0x0000,
+  ESP_ZB_ZCL_ATTR_OTA_UPGRADE_FILE_OFFSET_ID = 0x0001,
+} esp_zb_zcl_ota_upgrade_attr_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "esp_zigbee_type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID = 0x0000,
+} esp_zb_zcl_temp_measurement_attr_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "esp_zigbee_type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  ESP_ZB_ZCL_ATTR_THERMOSTAT_LOCAL_TEMPERATURE_ID = 0x0000,
+  ESP_ZB_ZCL_ATTR_THERMOSTAT_OCCUPIED_HEATING_SETPOINT_ID = 0x0012,
+  ESP_ZB_ZCL_ATTR_THERMOSTAT_UNOCCUPIED_HEATING_SETPOINT_ID = 0x0014,
+  ESP_ZB_ZCL_ATTR_THERMOSTAT_SYSTEM_MODE_ID = 0x001c,
+  ESP_ZB_ZCL_ATTR_THERMOSTAT_RUNNING_MODE_ID = 0x001e,
+  ESP_ZB_ZCL_ATTR_THERMOSTAT_SETPOINT_CHANGE_SOURCE_ID = 0x0030,
+} esp_zb_zcl_thermostat_attr_t;
+
+typedef enum {
+  ESP_ZB_ZCL_THERMOSTAT_SYSTEM_MODE_OFF = 0x00,
+  ESP_ZB_ZCL_THERMOSTAT_SYSTEM_MODE_AUTO = 0x01,
+  ESP_ZB_ZCL_THERMOSTAT_SYSTEM_MODE_COOL = 0x03,
+  ESP_ZB_ZCL_THERMOSTAT_SYSTEM_MODE_HEAT = 0x04,
+} esp_zb_zcl_thermostat_system_mode_t;
+
+#define ESP_ZB_ZCL_THERMOSTAT_CONTROL_SEQ_OF_OPERATION_HEATING_ONLY 0x02
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "esp_zigbee_type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  ESP_ZB_ZCL_ATTR_TIME_TIME_ID = 0x0000,
+  ESP_ZB_ZCL_ATTR_TIME_TIME_STATUS_ID = 0x0001,
+  ESP_ZB_ZCL_ATTR_TIME_TIME_ZONE_ID = 0x0002,
+  ESP_ZB_ZCL_ATTR_TIME_LOCAL_TIME_ID = 0x0007,
+} esp_zb_zcl_time_attr_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+#include "esp_rom_crc.h"
+#include "onewire_crc.h"
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+uint8_t onewire_crc8(uint8_t init_crc, uint8_t *input, size_t input_size) {
+  uint8_t crc = init_crc;
+  for (size_t i = 0; i < input_size; i++) {
+    uint8_t byte = input[i];
+    for (int bit = 0; bit < 8; bit++) {
+      uint8_t mix = (crc ^ byte) & 0x01;
+      crc >>= 1;
+      if (mix)
+        crc ^= 0x8c;
+      byte >>= 1;
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,116 @@
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "host_stubs.h"
+#include <deque>
+#include <string.h>
+#include <vector>
+
+struct tskTaskControlBlock {
+  TaskFunction_t function;
+  void *parameters;
+  const char *name;
+  uint32_t notification;
+};
+
+static tskTaskControlBlock mainTask = {nullptr, nullptr, "main", 0};
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char *pcName,
+                       uint32_t, void *pvParameters, UBaseType_t,
+                       TaskHandle_t *pxCreatedTask) {
+  auto task = new tskTaskControlBlock{pxTaskCode, pvParameters, pcName, 0};
+  if (pxCreatedTask)
+    *pxCreatedTask = task;
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t xTicksToDelay) {
+  hostAdvanceTime((int64_t)xTicksToDelay * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void) {
+  return (TickType_t)(esp_timer_get_time() / 1000 / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return &mainTask; }
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue,
+                       eNotifyAction eAction) {
+  switch (eAction) {
+  case eSetBits:
+    xTaskToNotify->notification |= ulValue;
+    break;
+  case eIncrement:
+    xTaskToNotify->notification++;
+    break;
+  case eSetValueWithOverwrite:
+  case eSetValueWithoutOverwrite:
+    xTaskToNotify->notification = ulValue;
+    break;
+  default:
+    break;
+  }
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry,
+                           uint32_t ulBitsToClearOnExit,
+                           uint32_t *pulNotificationValue, TickType_t) {
+  auto task = xTaskGetCurrentTaskHandle();
+  task->notification &= ~ulBitsToClearOnEntry;
+  if (pulNotificationValue)
+    *pulNotificationValue = task->notification;
+  bool pending = task->notification != 0;
+  task->notification &= ~ulBitsToClearOnExit;
+  return pending ? pdTRUE : pdFALSE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t) {
+  auto task = xTaskGetCurrentTaskHandle();
+  auto value = task->notification;
+  if (xClearCountOnExit)
+    task->notification = 0;
+  else if (value > 0)
+    task->notification--;
+  return value;
+}
+
+// Everything runs on one thread, so queues never block and mutexes always
+// succeed
+struct QueueDefinition {
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize) {
+  return new QueueDefinition{uxQueueLength, uxItemSize, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue,
+                      TickType_t) {
+  HostStubScope scope;
+  if (xQueue->items.size() >= xQueue->length)
+    return pdFALSE;
+  auto item = (const uint8_t *)pvItemToQueue;
+  xQueue->items.emplace_back(item, item + xQueue->itemSize);
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t) {
+  if (xQueue->items.empty())
+    return pdFALSE;
+  memcpy(pvBuffer, xQueue->items.front().data(), xQueue->itemSize);
+  xQueue->items.pop_front();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue) {
+  return xQueue->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return xQueueCreate(1, 0); }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
@@ -0,0 +1,19 @@
+#include "driver/gpio.h"
+#include "host_stubs.h"
+
+static int levels[GPIO_NUM_MAX] = {};
+
+esp_err_t gpio_config(const gpio_config_t *) { return ESP_OK; }
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+  if (gpio_num >= GPIO_NUM_MAX)
+    return ESP_ERR_INVALID_ARG;
+  if (levels[gpio_num] != (int)level)
+    hostCounters.gpioToggles++;
+  levels[gpio_num] = level;
+  return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) { return levels[gpio_num]; }
+
+int hostGpioLevel(int gpio) { return levels[gpio]; }
@@ -0,0 +1,74 @@
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "host_stubs.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int logLevel() {
+  static int level = -1;
+  if (level < 0) {
+    auto env = getenv("HOST_LOG_LEVEL");
+    level = env ? atoi(env) : HOST_LOG_LEVEL;
+  }
+  return level;
+}
+
+void esp_log_host(int level, const char *tag, const char *format, ...) {
+  if (level > logLevel())
+    return;
+  static const char levels[] = "NEWIDV";
+  fprintf(stderr, "%c (%s) ", levels[level], tag);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+void esp_log_buffer_hex_host(const char *tag, const void *buffer,
+                             uint16_t length) {
+  if (logLevel() < 3)
+    return;
+  fprintf(stderr, "I (%s) ", tag);
+  for (uint16_t i = 0; i < length; i++)
+    fprintf(stderr, "%02x ", ((const uint8_t *)buffer)[i]);
+  fputc('\n', stderr);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_INVALID_RESPONSE:
+    return "ESP_ERR_INVALID_RESPONSE";
+  case ESP_ERR_INVALID_VERSION:
+    return "ESP_ERR_INVALID_VERSION";
+  case ESP_ERR_NVS_NOT_FOUND:
+    return "ESP_ERR_NVS_NOT_FOUND";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+void (*hostRestartHook)() = nullptr;
+
+void esp_restart(void) {
+  fprintf(stderr, "esp_restart() called\n");
+  if (hostRestartHook != nullptr)
+    hostRestartHook();
+  exit(0);
+}
@@ -0,0 +1,210 @@
+#include "host_stubs.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Type tags follow the NVS item types
+enum : uint8_t {
+  NVS_TYPE_U8 = 0x01,
+  NVS_TYPE_I8 = 0x11,
+  NVS_TYPE_U16 = 0x02,
+  NVS_TYPE_I16 = 0x12,
+  NVS_TYPE_U32 = 0x04,
+  NVS_TYPE_I32 = 0x14,
+  NVS_TYPE_U64 = 0x08,
+  NVS_TYPE_I64 = 0x18,
+  NVS_TYPE_STR = 0x21,
+  NVS_TYPE_BLOB = 0x42,
+};
+
+struct NvsItem {
+  uint8_t type;
+  std::vector<uint8_t> data;
+};
+
+using Namespace = std::map<std::string, NvsItem>;
+
+static std::map<std::string, Namespace> namespaces;
+static std::map<nvs_handle_t, std::pair<std::string, nvs_open_mode_t>> handles;
+static nvs_handle_t nextHandle = 1;
+
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+esp_err_t nvs_flash_erase(void) {
+  namespaces.clear();
+  return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode,
+                   nvs_handle_t *out_handle) {
+  HostStubScope scope;
+  hostCounters.nvsOpens++;
+  if (open_mode == NVS_READONLY && namespaces.count(namespace_name) == 0)
+    return ESP_ERR_NVS_NOT_FOUND;
+  *out_handle = nextHandle++;
+  handles[*out_handle] = {namespace_name, open_mode};
+  return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) { handles.erase(handle); }
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+  if (handles.count(handle) == 0)
+    return ESP_ERR_INVALID_ARG;
+  hostCounters.nvsCommits++;
+  return ESP_OK;
+}
+
+static esp_err_t setItem(nvs_handle_t handle, const char *key, uint8_t type,
+                         const void *value, size_t length) {
+  HostStubScope scope;
+  auto it = handles.find(handle);
+  if (it == handles.end() || it->second.second != NVS_READWRITE)
+    return ESP_ERR_INVALID_ARG;
+  if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+    return ESP_ERR_INVALID_ARG;
+
+  auto &item = namespaces[it->second.first][key];
+  std::vector<uint8_t> data((const uint8_t *)value,
+                            (const uint8_t *)value + length);
+  // NVS skips writing identical items, so does the counter
+  if (item.type == type && item.data == data)
+    return ESP_OK;
+  item = {type, std::move(data)};
+  hostCounters.nvsSets++;
+  return ESP_OK;
+}
+
+static esp_err_t getItem(nvs_handle_t handle, const char *key, uint8_t type,
+                         void *out_value, size_t *length, bool variable) {
+  auto it = handles.find(handle);
+  if (it == handles.end())
+    return ESP_ERR_INVALID_ARG;
+  auto &ns = namespaces[it->second.first];
+  auto item = ns.find(key);
+  if (item == ns.end() || item->second.type != type)
+    return ESP_ERR_NVS_NOT_FOUND;
+
+  auto &data = item->second.data;
+  if (variable) {
+    if (out_value == NULL) {
+      *length = data.size();
+      return ESP_OK;
+    }
+    if (*length < data.size())
+      return ESP_ERR_NVS_INVALID_LENGTH;
+    *length = data.size();
+  }
+  memcpy(out_value, data.data(), data.size());
+  return ESP_OK;
+}
+
+#define NVS_SCALAR(suffix, ctype, tag)                                         \
+  esp_err_t nvs_set_##suffix(nvs_handle_t handle, const char *key,             \
+                             ctype value) {                                    \
+    return setItem(handle, key, tag, &value, sizeof(value));                   \
+  }                                                                            \
+  esp_err_t nvs_get_##suffix(nvs_handle_t handle, const char *key,             \
+                             ctype *out_value) {                               \
+    return getItem(handle, key, tag, out_value, NULL, false);                  \
+  }
+
+NVS_SCALAR(i8, int8_t, NVS_TYPE_I8)
+NVS_SCALAR(u8, uint8_t, NVS_TYPE_U8)
+NVS_SCALAR(i16, int16_t, NVS_TYPE_I16)
+NVS_SCALAR(u16, uint16_t, NVS_TYPE_U16)
+NVS_SCALAR(i32, int32_t, NVS_TYPE_I32)
+NVS_SCALAR(u32, uint32_t, NVS_TYPE_U32)
+NVS_SCALAR(i64, int64_t, NVS_TYPE_I64)
+NVS_SCALAR(u64, uint64_t, NVS_TYPE_U64)
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value) {
+  return setItem(handle, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length) {
+  return setItem(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value,
+                      size_t *length) {
+  return getItem(handle, key, NVS_TYPE_STR, out_value, length, true);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value,
+                       size_t *length) {
+  return getItem(handle, key, NVS_TYPE_BLOB, out_value, length, true);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+  auto it = handles.find(handle);
+  if (it == handles.end() || it->second.second != NVS_READWRITE)
+    return ESP_ERR_INVALID_ARG;
+  if (namespaces[it->second.first].erase(key) == 0)
+    return ESP_ERR_NVS_NOT_FOUND;
+  return ESP_OK;
+}
+
+// File format: repeated [namespace\0][key\0][type][u32 length][data]
+bool hostNvsSave(const char *path) {
+  auto file = fopen(path, "wb");
+  if (!file)
+    return false;
+  for (auto &&ns : namespaces) {
+    for (auto &&item : ns.second) {
+      uint32_t length = item.second.data.size();
+      fwrite(ns.first.c_str(), 1, ns.first.size() + 1, file);
+      fwrite(item.first.c_str(), 1, item.first.size() + 1, file);
+      fwrite(&item.second.type, 1, 1, file);
+      fwrite(&length, sizeof(length), 1, file);
+      fwrite(item.second.data.data(), 1, length, file);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static bool readString(FILE *file, std::string &out) {
+  out.clear();
+  int c;
+  while ((c = fgetc(file)) != EOF) {
+    if (c == 0)
+      return true;
+    out.push_back((char)c);
+  }
+  return false;
+}
+
+bool hostNvsLoad(const char *path) {
+  auto file = fopen(path, "rb");
+  if (!file)
+    return false;
+  std::string ns, key;
+  while (readString(file, ns) && readString(file, key)) {
+    NvsItem item;
+    uint32_t length;
+    if (fread(&item.type, 1, 1, file) != 1 ||
+        fread(&length, sizeof(length), 1, file) != 1)
+      break;
+    item.data.resize(length);
+    if (fread(item.data.data(), 1, length, file) != length)
+      break;
+    namespaces[ns][key] = std::move(item);
+  }
+  fclose(file);
+  return true;
+}
+
+void hostNvsClear() { namespaces.clear(); }
+
+size_t hostNvsBytes() {
+  size_t bytes = 0;
+  for (auto &&ns : namespaces)
+    for (auto &&item : ns.second)
+      bytes += item.first.size() + item.second.data.size();
+  return bytes;
+}
@@ -0,0 +1,222 @@
+#include "ds18b20.h"
+#include "host_stubs.h"
+#include "onewire_bus.h"
+#include "onewire_cmd.h"
+#include "onewire_crc.h"
+#include <string.h>
+#include <vector>
+
+/* Byte level emulation of DS18B20 sensors behind a 1-Wire bus, good enough
+ * for the ROM and function commands the firmware issues. */
+
+struct SimulatedSensor {
+  onewire_device_address_t address;
+  int16_t centiDegrees;
+  uint8_t scratchpad[9];
+  bool selected;
+};
+
+struct onewire_bus_t {
+  std::vector<SimulatedSensor> sensors;
+  // Bytes written since the last reset, drives the command decoding
+  std::vector<uint8_t> command;
+  std::vector<uint8_t> pendingRead;
+};
+
+struct onewire_device_iter_t {
+  onewire_bus_handle_t bus;
+  size_t next;
+};
+
+struct ds18b20_device_t {
+  onewire_device_t device;
+  ds18b20_resolution_t resolution;
+};
+
+static onewire_bus_t simulatedBus;
+
+static void updateScratchpad(SimulatedSensor &sensor) {
+  int16_t raw = (int16_t)((int32_t)sensor.centiDegrees * 16 / 100);
+  // Lower resolutions leave the lowest bits undefined, the sensor reads 0
+  uint8_t resolution = (sensor.scratchpad[4] >> 5) & 0x03;
+  raw &= ~((1 << (3 - resolution)) - 1);
+  sensor.scratchpad[0] = raw & 0xff;
+  sensor.scratchpad[1] = (raw >> 8) & 0xff;
+  sensor.scratchpad[8] = onewire_crc8(0, sensor.scratchpad, 8);
+}
+
+void hostOnewireAddSensor(uint64_t address, int16_t centiDegrees) {
+  SimulatedSensor sensor = {(address & ~0xffULL) | 0x28, centiDegrees, {}, false};
+  // Power-on scratchpad: 85 °C, 12 bit resolution
+  uint8_t scratchpad[9] = {0x50, 0x05, 0x4b, 0x46, 0x7f, 0xff, 0x0c, 0x10, 0};
+  memcpy(sensor.scratchpad, scratchpad, sizeof(scratchpad));
+  sensor.scratchpad[8] = onewire_crc8(0, sensor.scratchpad, 8);
+  simulatedBus.sensors.push_back(sensor);
+}
+
+void hostOnewireSetTemperature(uint64_t address, int16_t centiDegrees) {
+  for (auto &&sensor : simulatedBus.sensors)
+    if ((sensor.address >> 8) == (address >> 8))
+      sensor.centiDegrees = centiDegrees;
+}
+
+void hostOnewireRemoveAll() { simulatedBus.sensors.clear(); }
+
+esp_err_t onewire_new_bus_rmt(const onewire_bus_config_t *,
+                              const onewire_bus_rmt_config_t *,
+                              onewire_bus_handle_t *ret_bus) {
+  *ret_bus = &simulatedBus;
+  return ESP_OK;
+}
+
+esp_err_t onewire_bus_reset(onewire_bus_handle_t bus) {
+  bus->command.clear();
+  bus->pendingRead.clear();
+  for (auto &&sensor : bus->sensors)
+    sensor.selected = false;
+  return bus->sensors.empty() ? ESP_ERR_NOT_FOUND : ESP_OK;
+}
+
+static void handleCommand(onewire_bus_handle_t bus) {
+  auto &cmd = bus->command;
+  size_t functionAt;
+  if (cmd[0] == ONEWIRE_CMD_SKIP_ROM) {
+    for (auto &&sensor : bus->sensors)
+      sensor.selected = true;
+    functionAt = 1;
+  } else if (cmd[0] == ONEWIRE_CMD_MATCH_ROM) {
+    if (cmd.size() < 9)
+      return;
+    uint64_t address;
+    memcpy(&address, &cmd[1], sizeof(address));
+    for (auto &&sensor : bus->sensors)
+      sensor.selected = sensor.address == address;
+    functionAt = 9;
+  } else {
+    return;
+  }
+  if (cmd.size() <= functionAt)
+    return;
+
+  switch (cmd[functionAt]) {
+  case 0x44: // Convert T
+    for (auto &&sensor : bus->sensors)
+      if (sensor.selected)
+        updateScratchpad(sensor);
+    break;
+  case 0x4e: // Write scratchpad, TH, TL and configuration
+    if (cmd.size() < functionAt + 4)
+      return;
+    for (auto &&sensor : bus->sensors) {
+      if (!sensor.selected)
+        continue;
+      memcpy(&sensor.scratchpad[2], &cmd[functionAt + 1], 3);
+      sensor.scratchpad[8] = onewire_crc8(0, sensor.scratchpad, 8);
+    }
+    break;
+  case 0xbe: // Read scratchpad
+    for (auto &&sensor : bus->sensors)
+      if (sensor.selected)
+        bus->pendingRead.assign(sensor.scratchpad, sensor.scratchpad + 9);
+    break;
+  default:
+    break;
+  }
+}
+
+esp_err_t onewire_bus_write_bytes(onewire_bus_handle_t bus,
+                                  const uint8_t *tx_data,
+                                  uint8_t tx_data_size) {
+  HostStubScope scope;
+  bus->command.insert(bus->command.end(), tx_data, tx_data + tx_data_size);
+  handleCommand(bus);
+  return ESP_OK;
+}
+
+esp_err_t onewire_bus_read_bytes(onewire_bus_handle_t bus, uint8_t *rx_buf,
+                                 size_t rx_buf_size) {
+  for (size_t i = 0; i < rx_buf_size; i++) {
+    if (bus->pendingRead.empty()) {
+      rx_buf[i] = 0xff;
+      continue;
+    }
+    rx_buf[i] = bus->pendingRead.front();
+    bus->pendingRead.erase(bus->pendingRead.begin());
+  }
+  return ESP_OK;
+}
+
+esp_err_t onewire_new_device_iter(onewire_bus_handle_t bus,
+                                  onewire_device_iter_handle_t *ret_iter) {
+  *ret_iter = new onewire_device_iter_t{bus, 0};
+  return ESP_OK;
+}
+
+esp_err_t onewire_del_device_iter(onewire_device_iter_handle_t iter) {
+  delete iter;
+  return ESP_OK;
+}
+
+esp_err_t onewire_device_iter_get_next(onewire_device_iter_handle_t iter,
+                                       onewire_device_t *dev) {
+  if (iter->next >= iter->bus->sensors.size())
+    return ESP_ERR_NOT_FOUND;
+  dev->bus = iter->bus;
+  dev->address = iter->bus->sensors[iter->next++].address;
+  return ESP_OK;
+}
+
+static esp_err_t selectDevice(const onewire_device_t &device, uint8_t cmd) {
+  uint8_t buf[10] = {ONEWIRE_CMD_MATCH_ROM};
+  memcpy(&buf[1], &device.address, sizeof(device.address));
+  buf[9] = cmd;
+  auto res = onewire_bus_reset(device.bus);
+  if (res != ESP_OK)
+    return res;
+  return onewire_bus_write_bytes(device.bus, buf, sizeof(buf));
+}
+
+esp_err_t ds18b20_new_device(onewire_device_t *device, const ds18b20_config_t *,
+                             ds18b20_device_handle_t *ret_ds18b20) {
+  if ((device->address & 0xff) != 0x28)
+    return ESP_ERR_NOT_SUPPORTED;
+  *ret_ds18b20 = new ds18b20_device_t{*device, DS18B20_RESOLUTION_12B};
+  return ESP_OK;
+}
+
+esp_err_t ds18b20_del_device(ds18b20_device_handle_t ds18b20) {
+  delete ds18b20;
+  return ESP_OK;
+}
+
+esp_err_t ds18b20_set_resolution(ds18b20_device_handle_t ds18b20,
+                                 ds18b20_resolution_t resolution) {
+  ds18b20->resolution = resolution;
+  auto res = selectDevice(ds18b20->device, 0x4e);
+  if (res != ESP_OK)
+    return res;
+  uint8_t config[3] = {0x4b, 0x46, (uint8_t)(resolution << 5 | 0x1f)};
+  return onewire_bus_write_bytes(ds18b20->device.bus, config, sizeof(config));
+}
+
+esp_err_t
+ds18b20_trigger_temperature_conversion(ds18b20_device_handle_t ds18b20) {
+  const uint32_t delays_ms[] = {100, 200, 400, 800};
+  auto res = selectDevice(ds18b20->device, 0x44);
+  if (res == ESP_OK)
+    hostAdvanceTime(delays_ms[ds18b20->resolution] * 1000);
+  return res;
+}
+
+esp_err_t ds18b20_get_temperature(ds18b20_device_handle_t ds18b20,
+                                  float *temperature) {
+  auto res = selectDevice(ds18b20->device, 0xbe);
+  if (res != ESP_OK)
+    return res;
+  uint8_t scratchpad[9];
+  onewire_bus_read_bytes(ds18b20->device.bus, scratchpad, sizeof(scratchpad));
+  if (onewire_crc8(0, scratchpad, 8) != scratchpad[8])
+    return ESP_ERR_INVALID_CRC;
+  *temperature = (int16_t)(scratchpad[1] << 8 | scratchpad[0]) / 16.0f;
+  return ESP_OK;
+}
@@ -0,0 +1,112 @@
+#include "esp_ota_ops.h"
+#include "host_stubs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static esp_partition_t partitions[] = {
+    {nullptr, ESP_PARTITION_TYPE_APP, 0x00, 0x20000, 900 * 1024, 4096,
+     "factory", false, false},
+    {nullptr, ESP_PARTITION_TYPE_APP, 0x10, 0x110000, 900 * 1024, 4096, "ota_0",
+     false, false},
+    {nullptr, ESP_PARTITION_TYPE_APP, 0x11, 0x200000, 900 * 1024, 4096, "ota_1",
+     false, false},
+};
+
+static const esp_partition_t *running = &partitions[0];
+static const esp_partition_t *boot = &partitions[0];
+
+// Rough SPI flash timings, erasing a sector and programming a 256 byte page,
+// the cache is disabled for the whole call
+#define HOST_FLASH_SECTOR_SIZE 4096
+#define HOST_FLASH_PAGE_SIZE 256
+#define HOST_FLASH_ERASE_US 30000
+#define HOST_FLASH_PAGE_US 600
+#define HOST_FLASH_CALL_US 100
+
+static std::string partitionPath(const esp_partition_t *partition) {
+  auto dir = getenv("HOST_OTA_DIR");
+  return std::string(dir ? dir : ".") + "/" + partition->label + ".bin";
+}
+
+// Flash keeps its content between downloads, like the partition file
+static FILE *openPartition(const esp_partition_t *partition) {
+  auto path = partitionPath(partition);
+  auto file = fopen(path.c_str(), "r+b");
+  return file != nullptr ? file : fopen(path.c_str(), "w+b");
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void) { return running; }
+
+const esp_partition_t *esp_ota_get_boot_partition(void) { return boot; }
+
+const esp_partition_t *
+esp_ota_get_next_update_partition(const esp_partition_t *start_from) {
+  if (start_from == nullptr)
+    start_from = running;
+  return start_from == &partitions[1] ? &partitions[2] : &partitions[1];
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+  boot = partition;
+  fprintf(stderr, "Boot partition set to %s\n", partition->label);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size) {
+  if (offset % HOST_FLASH_SECTOR_SIZE != 0 ||
+      size % HOST_FLASH_SECTOR_SIZE != 0 || offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  auto file = openPartition(partition);
+  if (file == nullptr)
+    return ESP_FAIL;
+  auto sectors = size / HOST_FLASH_SECTOR_SIZE;
+  hostCounters.otaErases += sectors;
+  hostAdvanceTime(HOST_FLASH_CALL_US + sectors * HOST_FLASH_ERASE_US);
+  uint8_t erased[HOST_FLASH_SECTOR_SIZE];
+  memset(erased, 0xff, sizeof(erased));
+  fseek(file, offset, SEEK_SET);
+  bool ok = true;
+  for (size_t i = 0; i < sectors; i++)
+    ok &= fwrite(erased, 1, sizeof(erased), file) == sizeof(erased);
+  fclose(file);
+  return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition,
+                              size_t dst_offset, const void *src,
+                              size_t size) {
+  if (dst_offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  auto file = openPartition(partition);
+  if (file == nullptr)
+    return ESP_FAIL;
+  hostCounters.otaWrites++;
+  hostCounters.otaBytes += size;
+  // Unaligned writes program the partial pages on both ends
+  auto firstPage = dst_offset / HOST_FLASH_PAGE_SIZE;
+  auto lastPage = (dst_offset + size - 1) / HOST_FLASH_PAGE_SIZE;
+  auto pages = size == 0 ? 0 : lastPage - firstPage + 1;
+  hostAdvanceTime(HOST_FLASH_CALL_US + pages * HOST_FLASH_PAGE_US);
+  fseek(file, dst_offset, SEEK_SET);
+  bool ok = fwrite(src, 1, size, file) == size;
+  fclose(file);
+  return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size) {
+  if (src_offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  auto file = fopen(partitionPath(partition).c_str(), "rb");
+  // Erased flash reads as 0xff
+  memset(dst, 0xff, size);
+  if (file == nullptr)
+    return ESP_OK;
+  fseek(file, src_offset, SEEK_SET);
+  fread(dst, 1, size, file);
+  fclose(file);
+  return ESP_OK;
+}
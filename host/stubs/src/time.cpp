@@ -0,0 +1,100 @@
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "host_stubs.h"
+#include <sys/time.h>
+#include <time.h>
+#include <vector>
+
+HostCounters hostCounters = {};
+int hostStubDepth = 0;
+
+static int64_t monotonicMicros = 0;
+static int64_t wallOffsetMicros = 0;
+
+void hostSetTime(int64_t unixMicros) {
+  wallOffsetMicros = unixMicros - monotonicMicros;
+}
+int64_t hostGetTime() { return monotonicMicros + wallOffsetMicros; }
+void hostAdvanceTime(int64_t micros) {
+  monotonicMicros += micros;
+  hostRunTimers();
+}
+
+// The virtual clock replaces the libc one, so the firmware code sees the
+// simulated time without any changes
+extern "C" time_t time(time_t *out) {
+  time_t now = hostGetTime() / 1000000;
+  if (out)
+    *out = now;
+  return now;
+}
+
+extern "C" int gettimeofday(struct timeval *tv, void *) {
+  auto now = hostGetTime();
+  tv->tv_sec = now / 1000000;
+  tv->tv_usec = now % 1000000;
+  return 0;
+}
+
+extern "C" int settimeofday(const struct timeval *tv, const struct timezone *) {
+  hostSetTime((int64_t)tv->tv_sec * 1000000 + tv->tv_usec);
+  return 0;
+}
+
+struct esp_timer {
+  esp_timer_create_args_t args;
+  int64_t due;
+  uint64_t period;
+  bool armed;
+};
+
+static std::vector<esp_timer *> timers;
+
+int64_t esp_timer_get_time(void) { return monotonicMicros; }
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args,
+                           esp_timer_handle_t *out_handle) {
+  auto timer = new esp_timer{*create_args, 0, 0, false};
+  timers.push_back(timer);
+  *out_handle = timer;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  timer->due = monotonicMicros + timeout_us;
+  timer->period = 0;
+  timer->armed = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+  timer->due = monotonicMicros + period;
+  timer->period = period;
+  timer->armed = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  if (!timer->armed)
+    return ESP_ERR_INVALID_STATE;
+  timer->armed = false;
+  return ESP_OK;
+}
+
+void hostRunTimers() {
+  bool fired;
+  do {
+    fired = false;
+    for (size_t i = 0; i < timers.size(); i++) {
+      auto timer = timers[i];
+      if (!timer->armed || timer->due > monotonicMicros)
+        continue;
+      if (timer->period > 0)
+        timer->due += timer->period;
+      else
+        timer->armed = false;
+      timer->args.callback(timer->args.arg);
+      fired = true;
+    }
+  } while (fired);
+}
@@ -0,0 +1,86 @@
+#include "custom_cluster.hpp"
+#include "esp_zigbee_core.h"
+#include "host_stubs.h"
+#include <map>
+#include <string.h>
+#include <tuple>
+
+// The real stack knows the size from the attribute type, the stubs only
+// track the attributes the firmware publishes
+static uint8_t attributeSize(uint16_t cluster_id, uint16_t attr_id) {
+  switch (cluster_id) {
+  case ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT:
+    return attr_id == ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID ? 2 : 0;
+  case ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT:
+    switch (attr_id) {
+    case ESP_ZB_ZCL_ATTR_THERMOSTAT_RUNNING_MODE_ID:
+    case ESP_ZB_ZCL_ATTR_THERMOSTAT_SYSTEM_MODE_ID:
+    case ESP_ZB_ZCL_ATTR_THERMOSTAT_SETPOINT_CHANGE_SOURCE_ID:
+      return 1;
+    case ESP_ZB_ZCL_ATTR_THERMOSTAT_UNOCCUPIED_HEATING_SETPOINT_ID:
+      return 2;
+    default:
+      return 0;
+    }
+  case ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE:
+    return attr_id == ESP_ZB_ZCL_ATTR_OTA_UPGRADE_FILE_OFFSET_ID ? 4 : 0;
+  case ESP_ZB_ZCL_CLUSTER_ID_CUSTOM:
+    return attr_id == ESP_ZB_ZCL_ATTR_CUSTOM_TEMPERATURE_SOURCE_ID ? 1 : 4;
+  default:
+    return 0;
+  }
+}
+
+struct StoredAttribute {
+  esp_zb_zcl_attr_t attr;
+  uint8_t value[8];
+};
+
+static std::map<std::tuple<uint8_t, uint16_t, uint8_t, uint16_t>,
+                StoredAttribute>
+    attributes;
+
+esp_zb_zcl_status_t esp_zb_zcl_set_attribute_val(uint8_t endpoint,
+                                                 uint16_t cluster_id,
+                                                 uint8_t cluster_role,
+                                                 uint16_t attr_id,
+                                                 void *value_p, bool) {
+  HostStubScope scope;
+  hostCounters.attributeSets++;
+  auto size = attributeSize(cluster_id, attr_id);
+  if (size == 0)
+    return ESP_ZB_ZCL_STATUS_SUCCESS;
+  auto &stored = attributes[{endpoint, cluster_id, cluster_role, attr_id}];
+  memcpy(stored.value, value_p, size);
+  stored.attr = {.id = attr_id,
+                 .type = 0,
+                 .access = 0,
+                 .manuf_code = 0,
+                 .data_p = stored.value};
+  return ESP_ZB_ZCL_STATUS_SUCCESS;
+}
+
+esp_zb_zcl_attr_t *esp_zb_zcl_get_attribute(uint8_t endpoint,
+                                            uint16_t cluster_id,
+                                            uint8_t cluster_role,
+                                            uint16_t attr_id) {
+  auto found = attributes.find({endpoint, cluster_id, cluster_role, attr_id});
+  if (found == attributes.end())
+    return NULL;
+  return &found->second.attr;
+}
+
+esp_err_t esp_zb_zcl_update_reporting_info(esp_zb_zcl_reporting_info_t *) {
+  return ESP_OK;
+}
+
+uint8_t esp_zb_zcl_read_attr_cmd_req(esp_zb_zcl_read_attr_cmd_t *) {
+  return 0;
+}
+
+bool esp_zb_lock_acquire(TickType_t) {
+  hostCounters.lockAcquires++;
+  return true;
+}
+
+void esp_zb_lock_release(void) {}
@@ -0,0 +1,98 @@
+#include "attribute_transaction.hpp"
+#include "esp_log.h"
+
+static const char *TAG = "ATTR_TXN";
+
+std::atomic<uint32_t> AttributeTransaction::externalWrites{0};
+
+AttributeTransaction::Update *
+AttributeTransaction::find(Update *list, uint8_t length, const Update &update) {
+  for (uint8_t i = 0; i < length; i++) {
+    if (list[i].endpoint == update.endpoint &&
+        list[i].clusterId == update.clusterId &&
+        list[i].attrId == update.attrId)
+      return &list[i];
+  }
+  return nullptr;
+}
+
+void AttributeTransaction::remember(const Update &update) {
+  auto entry = find(published, publishedCount, update);
+  if (entry == nullptr) {
+    // Attributes beyond the limit are always compared under the lock
+    if (publishedCount == ATTRIBUTE_TRANSACTION_MAX_UPDATES)
+      return;
+    entry = &published[publishedCount++];
+  }
+  *entry = update;
+}
+
+void AttributeTransaction::stageValue(uint8_t endpoint, uint16_t clusterId,
+                                      uint16_t attrId, const void *value,
+                                      uint8_t size, bool check) {
+  Update key = {.endpoint = endpoint, .clusterId = clusterId, .attrId = attrId};
+  auto update = find(updates, count, key);
+  if (update == nullptr) {
+    if (count == ATTRIBUTE_TRANSACTION_MAX_UPDATES)
+      commit();
+    update = &updates[count++];
+  }
+  *update = {.endpoint = endpoint,
+             .clusterId = clusterId,
+             .attrId = attrId,
+             .size = size,
+             .check = check,
+             .value = {}};
+  memcpy(update->value, value, size);
+}
+
+esp_zb_zcl_status_t AttributeTransaction::commit() {
+  auto writes = externalWrites.load();
+  if (writes != publishedWrites) {
+    publishedCount = 0;
+    publishedWrites = writes;
+  }
+  uint8_t pending = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    auto last = find(published, publishedCount, updates[i]);
+    if (last == nullptr || last->size != updates[i].size ||
+        memcmp(last->value, updates[i].value, updates[i].size) != 0)
+      updates[pending++] = updates[i];
+  }
+  count = pending;
+  if (count == 0)
+    return ESP_ZB_ZCL_STATUS_SUCCESS;
+
+  auto result = ESP_ZB_ZCL_STATUS_SUCCESS;
+  uint8_t written = 0;
+  esp_zb_lock_acquire(portMAX_DELAY);
+  for (uint8_t i = 0; i < count; i++) {
+    auto &update = updates[i];
+    auto current = esp_zb_zcl_get_attribute(update.endpoint, update.clusterId,
+                                            ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                            update.attrId);
+    if (current != NULL && current->data_p != NULL &&
+        memcmp(current->data_p, update.value, update.size) == 0) {
+      remember(update);
+      continue;
+    }
+
+    auto res = esp_zb_zcl_set_attribute_val(
+        update.endpoint, update.clusterId, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+        update.attrId, update.value, update.check);
+    if (res != ESP_ZB_ZCL_STATUS_SUCCESS) {
+      ESP_LOGI(TAG, "Setting attribute %x of cluster %x failed: %x",
+               update.attrId, update.clusterId, res);
+      if (result == ESP_ZB_ZCL_STATUS_SUCCESS)
+        result = res;
+    } else {
+      remember(update);
+      written++;
+    }
+  }
+  esp_zb_lock_release();
+
+  ESP_LOGD(TAG, "Published %d of %d staged attributes", written, count);
+  count = 0;
+  return result;
+}
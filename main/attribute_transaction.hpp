@@ -0,0 +1,65 @@
+#pragma once
+
+#include "esp_zigbee_core.h"
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+// Updates beyond this are committed early, so staging never fails
+#define ATTRIBUTE_TRANSACTION_MAX_UPDATES 8
+#define ATTRIBUTE_TRANSACTION_MAX_VALUE_SIZE 8
+
+/// @brief Collects attribute updates and publishes them with a single
+/// acquisition of the Zigbee lock. Values equal to the last one the
+/// transaction published are dropped before taking the lock, values equal to
+/// the one held by the stack under it, so neither causes a report.
+class AttributeTransaction {
+
+public:
+  AttributeTransaction() {}
+  AttributeTransaction(AttributeTransaction &other) = delete;
+  void operator=(const AttributeTransaction &) = delete;
+
+  /// @brief Stages a server attribute update, a later update of the same
+  /// attribute replaces the earlier one
+  /// @param check passed to esp_zb_zcl_set_attribute_val
+  template <typename T>
+  void stage(uint8_t endpoint, uint16_t clusterId, uint16_t attrId, T value,
+             bool check = false) {
+    static_assert(sizeof(T) <= ATTRIBUTE_TRANSACTION_MAX_VALUE_SIZE);
+    stageValue(endpoint, clusterId, attrId, &value, sizeof(T), check);
+  }
+
+  /// @brief Publishes all staged values that differ from the current ones
+  /// @return the first failed status, ESP_ZB_ZCL_STATUS_SUCCESS otherwise
+  esp_zb_zcl_status_t commit();
+
+  /// @brief Forgets the values published by all transactions, since the
+  /// stack's value of an attribute was written by someone else
+  static void invalidate() { externalWrites++; }
+
+private:
+  struct Update {
+    uint8_t endpoint;
+    uint16_t clusterId;
+    uint16_t attrId;
+    uint8_t size;
+    bool check;
+    uint8_t value[ATTRIBUTE_TRANSACTION_MAX_VALUE_SIZE];
+  };
+
+  void stageValue(uint8_t endpoint, uint16_t clusterId, uint16_t attrId,
+                  const void *value, uint8_t size, bool check);
+  Update *find(Update *list, uint8_t length, const Update &update);
+  void remember(const Update &update);
+
+  Update updates[ATTRIBUTE_TRANSACTION_MAX_UPDATES];
+  uint8_t count = 0;
+
+  // Last value published per attribute, valid while externalWrites is still
+  // at publishedWrites
+  Update published[ATTRIBUTE_TRANSACTION_MAX_UPDATES];
+  uint8_t publishedCount = 0;
+  uint32_t publishedWrites = 0;
+  static std::atomic<uint32_t> externalWrites;
+};
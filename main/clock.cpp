@@ -1,11 +1,11 @@
 #include "clock.hpp"
 #include "esp_log.h"
 #include "esp_zb_thermostat.hpp"
-#include "storage.hpp"
+#include "executor.hpp"
+#include "state_store.hpp"
 #include "zcl/esp_zigbee_zcl_command.h"
 #include <sys/_timeval.h>
 #include <sys/time.h>
-#include "freertos/task.h"
 
 
 static const char *TAG = "CLOCK";
@@ -13,22 +13,20 @@ static const char *TAG = "CLOCK";
 void Clock::init() {
   if (initialized)
     return;
-  storage = Storage::GetInstance();
-  int32_t timeZone = 0;
-  if (storage->readValue("timeZone", &timeZone) == ESP_OK)
-    this->timeZoneOffsetInSeconds = timeZone;
+  stateStore = StateStore::GetInstance();
+  stateStore->init();
+  this->timeZoneOffsetInSeconds = stateStore->state.timeZoneOffset;
   initialized = true;
 
-  xTaskCreate(regularTimeSync, "TimeSync_main", 4096, this, 6, NULL);
+  auto executor = Executor::GetInstance();
+  executor->init();
+  executor->add("time_sync", regularTimeSync, this, CLOCK_SYNC_INTERVAL_MS);
 }
 
 void Clock::updateTime(uint32_t utcTime) {
   this->zb_time = utcTime;
-  uint32_t len;
-  auto res = storage->readValue("clock", &len);
-  ESP_LOGI(TAG,
-           "Last sync time %lx, new value should be %lx. Result from save: %x",
-           len, utcTime, res);
+  ESP_LOGI(TAG, "Last sync time %lx, new value should be %lx",
+           stateStore->state.lastTimeSync, utcTime);
 
   int64_t sinceZero = utcTime;
   //   sinceZero += 59926608000;
@@ -43,7 +41,8 @@ void Clock::updateTime(uint32_t utcTime) {
   time(&now);
   localtime_r(&now, &tm);
 
-  res = storage->writeValue("clock", utcTime);
+  stateStore->state.lastTimeSync = utcTime;
+  auto res = stateStore->save();
 
   ESP_LOGI(TAG, "New Time is: %2d.%2d.%4d %2d:%2d:%d. Saving was: %x",
            tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900, tm.tm_hour, tm.tm_min,
@@ -59,7 +58,8 @@ void Clock::updateTimeZone(uint32_t localTime) {
   }
   ESP_LOGI(TAG, "Setting the offset to %ld", offset);
   timeZoneOffsetInSeconds = offset;
-  storage->writeValue("timeZone", timeZoneOffsetInSeconds);
+  stateStore->state.timeZoneOffset = offset;
+  stateStore->save();
 }
 
 void Clock::getCurrentTime(tm &tm) {
@@ -89,13 +89,10 @@ void Clock::syncTimeRequest() {
   esp_zb_lock_release();
 }
 
-void Clock::regularTimeSync(void *parameter) {
+uint32_t Clock::regularTimeSync(void *parameter) {
   auto _this = (Clock *)parameter;
-
-  for (;;) {
-    vTaskDelay((10000 * 1000) / portTICK_PERIOD_MS); //Sync every ~3h
-    _this->syncTimeRequest();
-  }
+  _this->syncTimeRequest();
+  return CLOCK_SYNC_INTERVAL_MS;
 }
 
 Clock *Clock::_instance = nullptr;
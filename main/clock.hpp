@@ -1,9 +1,12 @@
 #pragma once
 
-#include "storage.hpp"
+#include "state_store.hpp"
 #include <stdint.h>
 #include <time.h>
 
+// Sync every ~3h
+#define CLOCK_SYNC_INTERVAL_MS (10000 * 1000)
+
 class Clock {
 
 public:
@@ -26,11 +29,11 @@ public:
   void operator=(const Clock &) = delete;
 
 protected:
-  static void regularTimeSync(void *parameter);
+  static uint32_t regularTimeSync(void *parameter);
   static Clock *_instance;
   Clock() {}
 
-  Storage *storage;
+  StateStore *stateStore;
 
 private:
   
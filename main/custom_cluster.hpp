@@ -4,7 +4,8 @@
 typedef enum {
   ESP_ZB_ZCL_ATTR_CUSTOM_RUNTIME_SECONDS_ID = 0x0000,
   ESP_ZB_ZCL_ATTR_CUSTOM_TEMPERATURE_SOURCE_ID = 0x0001,
-  ESP_ZB_ZCL_ATTR_CUSTOM_CURRENT_SCHEDULE_ID = 0x0002
+  ESP_ZB_ZCL_ATTR_CUSTOM_CURRENT_SCHEDULE_ID = 0x0002,
+  ESP_ZB_ZCL_ATTR_CUSTOM_NEXT_TRANSITION_ID = 0x0003 // UTC seconds since 1970
   
 
 } esp_zb_zcl_custom_attr_t;
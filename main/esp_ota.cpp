@@ -3,147 +3,481 @@
 #include "esp_check.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
+#include "esp_partition.h"
 #include "esp_timer.h"
+#include "executor.hpp"
+#include "storage.hpp"
 #include <algorithm>
 #include <esp_err.h>
-#include <zlib.h>
+#include <string.h>
 
 static const char *TAG = "OTA";
 
-CompressedOTA::~CompressedOTA() {
-  if (part_) {
-    esp_ota_abort(handle_);
-  }
+static_assert((OTA_RING_SIZE & (OTA_RING_SIZE - 1)) == 0,
+              "Ring indices wrap with a mask");
+
+size_t OtaRing::push(const uint8_t *data, size_t size) {
+  auto start = head.load(std::memory_order_relaxed);
+  auto free = OTA_RING_SIZE - (start - tail.load(std::memory_order_acquire));
+  size = std::min(size, (size_t)free);
+  auto index = start & (OTA_RING_SIZE - 1);
+  auto first = std::min(size, (size_t)(OTA_RING_SIZE - index));
+  memcpy(buffer + index, data, first);
+  memcpy(buffer, data + first, size - first);
+  head.store(start + size, std::memory_order_release);
+  return size;
+}
 
-  if (zlib_init_) {
-    inflateEnd(&zlib_stream_);
-  }
+size_t OtaRing::peek(const uint8_t **data) const {
+  auto start = tail.load(std::memory_order_relaxed);
+  auto available = head.load(std::memory_order_acquire) - start;
+  auto index = start & (OTA_RING_SIZE - 1);
+  *data = buffer + index;
+  return std::min((size_t)available, (size_t)(OTA_RING_SIZE - index));
 }
 
-esp_err_t CompressedOTA::start() {
-  if (zlib_init_) {
-    inflateEnd(&zlib_stream_);
-    zlib_init_ = false;
-  }
+void OtaRing::consume(size_t size) {
+  tail.store(tail.load(std::memory_order_relaxed) + size,
+             std::memory_order_release);
+}
 
-  zlib_stream_ = {};
-  zlib_stream_.zalloc = Z_NULL;
-  zlib_stream_.zfree = Z_NULL;
-  zlib_stream_.opaque = Z_NULL;
-  zlib_stream_.next_in = nullptr;
-  zlib_stream_.avail_in = 0;
+void OtaRing::clear() {
+  head.store(0);
+  tail.store(0);
+}
 
-  int ret = inflateInit(&zlib_stream_);
+void CompressedOTA::init() {
+  if (initialized)
+    return;
+  initialized = true;
+  writerLock = xSemaphoreCreateMutex();
+  writerJobId = Executor::GetInstance()->add("ota_writer", writerJob, this,
+                                             EXECUTOR_IDLE);
+}
 
-  if (ret == Z_OK) {
-    zlib_init_ = true;
-  } else {
-    ESP_LOGE(TAG, "zlib init failed: %d", ret);
-    return ESP_FAIL;
-  }
+esp_err_t
+CompressedOTA::start(const esp_zb_zcl_ota_upgrade_file_header_t &header) {
+  xSemaphoreTake(writerLock, portMAX_DELAY);
+  // The codec is only known once the sub-element header arrived
+  decoder.end();
+  ring.clear();
+  sectorUsed = 0;
+  layout = OtaLayout::Stream;
+  stagedLength = 0;
+  stats = {};
+  chunkHeaderLength = 0;
+  inChunk = false;
+  commitPending = false;
+  subelementHeaderLength = 0;
+  subelement = Subelement::Header;
+  ota_upgrade_subelement = false;
+  ota_data_len = 0;
+  digestReceived = false;
+  resumeFrom = 0;
+  writeOffset = 0;
 
   if (part_) {
-    ESP_LOGE(TAG, "OTA already started");
-    part_ = nullptr;
-    esp_ota_abort(handle_);
-    return ESP_FAIL;
+    // The stack gave up on the last download without telling
+    ESP_LOGW(TAG, "OTA restarted before it finished");
+    fail();
   }
 
+  esp_err_t err = ESP_OK;
   part_ = esp_ota_get_next_update_partition(nullptr);
   if (!part_) {
     ESP_LOGE(TAG, "No next OTA partition");
-    return ESP_ERR_INVALID_SIZE;
+    err = ESP_ERR_INVALID_SIZE;
   }
 
-  esp_err_t err = esp_ota_begin(part_, OTA_WITH_SEQUENTIAL_WRITES, &handle_);
-  if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Error starting OTA: %d", err);
-    part_ = nullptr;
-    return ESP_FAIL;
+  if (err == ESP_OK) {
+    auto storage = Storage::GetInstance();
+    ota_resume_t stored;
+    size_t length = sizeof(stored);
+    bool found = storage->readValue<void>(OTA_RESUME_KEY, &stored,
+                                          &length) == ESP_OK &&
+                 length == sizeof(stored);
+    if (found && stored.fileVersion == header.file_version &&
+        stored.imageSize == header.image_size &&
+        stored.manufacturer == header.manufacturer_code &&
+        stored.imageType == header.image_type &&
+        stored.partition == part_->address &&
+        stored.written % OTA_SECTOR_SIZE == 0) {
+      // The sectors up to the last chunk are still in the partition
+      resume = stored;
+      resumeFrom = resume.received;
+      writeOffset = resume.written;
+      ESP_LOGI(TAG, "Resuming OTA after chunk %u, %lu of %lu bytes",
+               resume.chunks, resume.received, resume.dataLength);
+    } else {
+      if (found)
+        forgetProgress();
+      resume = {.fileVersion = header.file_version,
+                  .imageSize = header.image_size,
+                  .manufacturer = header.manufacturer_code,
+                  .imageType = header.image_type,
+                  .partition = part_->address};
+      mbedtls_sha256_init(&resume.digest);
+      mbedtls_sha256_starts(&resume.digest, 0);
+    }
   }
 
-  return ESP_OK;
+  active.store(err == ESP_OK);
+  xSemaphoreGive(writerLock);
+  return err;
 }
 
-esp_err_t CompressedOTA::write(uint8_t *data, size_t size) {
-  return write(data, size, false);
+esp_err_t CompressedOTA::write(const uint8_t *data, size_t size) {
+  while (active.load()) {
+    auto taken = ring.push(data, size);
+    data += taken;
+    size -= taken;
+    if (stats.maxRingBytes < ring.used())
+      stats.maxRingBytes = ring.used();
+    if (size == 0) {
+      Executor::GetInstance()->wake(writerJobId);
+      return ESP_OK;
+    }
+
+    // The ring is full, only now the stack waits for the flash
+    stats.stackDrains++;
+    bool wroteSector;
+    xSemaphoreTake(writerLock, portMAX_DELAY);
+    auto err = drainSector(&wroteSector);
+    xSemaphoreGive(writerLock);
+    if (err != ESP_OK)
+      return err;
+  }
+  return ESP_FAIL;
 }
 
-esp_err_t CompressedOTA::write(uint8_t *data, size_t size, bool flush) {
-  uint8_t buf[256];
+uint32_t CompressedOTA::writerJob(void *context) {
+  auto _this = (CompressedOTA *)context;
+  bool wroteSector;
+  xSemaphoreTake(_this->writerLock, portMAX_DELAY);
+  auto err = _this->drainSector(&wroteSector);
+  xSemaphoreGive(_this->writerLock);
+  // One sector per run, so the other jobs are not held up for a whole ring
+  return err == ESP_OK && wroteSector ? 0 : EXECUTOR_IDLE;
+}
 
-  if (!part_) {
-    return ESP_FAIL;
+void CompressedOTA::consumeRing(const uint8_t *data, size_t size) {
+  // Each byte passes here once, so the digest needs no pass over flash
+  mbedtls_sha256_update(&resume.digest, data, size);
+  ring.consume(size);
+}
+
+esp_err_t CompressedOTA::decodeInto(uint8_t **out, size_t *outSize,
+                                     bool *progress) {
+  const uint8_t *data;
+  auto available = ring.peek(&data);
+  auto start = data;
+  auto remaining = available;
+  auto outBefore = *outSize;
+  // Without input this still flushes what the decoder holds back
+  auto err = decoder.decode(&data, &remaining, out, outSize);
+  consumeRing(start, available - remaining);
+  *progress = remaining != available || *outSize != outBefore;
+  return err;
+}
+
+esp_err_t CompressedOTA::decodeChunk(uint8_t **out, size_t *outSize,
+                                      bool *progress) {
+  const uint8_t *data;
+  *progress = false;
+  if (!inChunk) {
+    // The header may wrap around the ring
+    auto length = std::min(ring.peek(&data),
+                           sizeof(chunkHeader) - chunkHeaderLength);
+    memcpy(chunkHeader + chunkHeaderLength, data, length);
+    consumeRing(data, length);
+    chunkHeaderLength += length;
+    *progress = length > 0;
+    if (chunkHeaderLength < sizeof(chunkHeader))
+      return ESP_OK;
+    chunkHeaderLength = 0;
+
+    ota_chunk_header_t header;
+    memcpy(&header, chunkHeader, sizeof(header));
+    if (header.magic != OTA_CHUNK_MAGIC || header.index != chunkIndex) {
+      ESP_LOGE(TAG, "Expected chunk %lu, got %08lx with index %lu",
+               chunkIndex, header.magic, header.index);
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    auto err = decoder.begin(codec);
+    if (err != ESP_OK)
+      return err;
+    inChunk = true;
+    chunkRemaining = header.length;
+    chunkEnd += sizeof(header) + header.length;
   }
 
-  zlib_stream_.avail_in = size;
-  zlib_stream_.next_in = data;
+  auto available = std::min(ring.peek(&data), (size_t)chunkRemaining);
+  auto start = data;
+  auto remaining = available;
+  auto outBefore = *outSize;
+  auto err = decoder.decode(&data, &remaining, out, outSize);
+  consumeRing(start, available - remaining);
+  chunkRemaining -= available - remaining;
+  *progress |= remaining != available || *outSize != outBefore;
+  if (err != ESP_OK || chunkRemaining > 0)
+    return err;
+
+  if (decoder.complete()) {
+    inChunk = false;
+    chunkIndex++;
+    decoder.end();
+    // Chunks fill whole sectors, the last one is committed by finish()
+    commitPending = *outSize == 0;
+  } else if (!*progress) {
+    ESP_LOGE(TAG, "Chunk %lu is truncated", chunkIndex);
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  return ESP_OK;
+}
 
-  do {
-    zlib_stream_.avail_out = sizeof(buf);
-    zlib_stream_.next_out = buf;
+esp_err_t CompressedOTA::fillSector(bool *progress) {
+  auto out = sector + sectorUsed;
+  size_t outSize = OTA_SECTOR_SIZE - sectorUsed;
+  esp_err_t err;
+  if (layout == OtaLayout::Chunks) {
+    err = decodeChunk(&out, &outSize, progress);
+  } else if (layout == OtaLayout::Stream) {
+    err = decodeInto(&out, &outSize, progress);
+  } else {
+    // Patch bytes go through a small stage, the image bytes into the sector
+    *progress = false;
+    err = ESP_OK;
+    if (stagedLength == 0) {
+      auto stageOut = staged;
+      size_t stageSize = sizeof(staged);
+      err = decodeInto(&stageOut, &stageSize, progress);
+      stagedData = staged;
+      stagedLength = sizeof(staged) - stageSize;
+    }
+    if (err == ESP_OK) {
+      auto stagedBefore = stagedLength;
+      auto outBefore = outSize;
+      err = patch.apply(&stagedData, &stagedLength, &out, &outSize);
+      *progress |= stagedLength != stagedBefore || outSize != outBefore;
+    }
+  }
+  sectorUsed = OTA_SECTOR_SIZE - outSize;
+  if (err != ESP_OK) {
+    fail();
+    forgetProgress();
+  }
+  return err;
+}
 
-    int ret = inflate(&zlib_stream_, flush ? Z_FINISH : Z_NO_FLUSH);
-    if (ret == Z_STREAM_ERROR || ret == Z_NEED_DICT || ret == Z_DATA_ERROR ||
-        ret == Z_MEM_ERROR) {
-      ESP_LOGE(TAG, "zlib error: %d", ret);
-      esp_ota_abort(handle_);
-      part_ = nullptr;
+esp_err_t CompressedOTA::drainSector(bool *wroteSector) {
+  *wroteSector = false;
+  if (!part_)
+    return ESP_FAIL;
+
+  bool progress = true;
+  while (progress && (ring.used() > 0 || stagedLength > 0)) {
+    auto err = fillSector(&progress);
+    if (err != ESP_OK)
       return ESP_FAIL;
+    if (sectorUsed == OTA_SECTOR_SIZE) {
+      *wroteSector = true;
+      return writeSector();
     }
+  }
+  return ESP_OK;
+}
 
-    size_t available = sizeof(buf) - zlib_stream_.avail_out;
+esp_err_t CompressedOTA::writeSector() {
+  if (sectorUsed == 0)
+    return ESP_OK;
+  stats.sectors++;
+  // Written in place rather than through esp_ota_write, so a resumed
+  // download continues behind the sectors it kept
+  esp_err_t err = esp_partition_erase_range(part_, writeOffset,
+                                            OTA_SECTOR_SIZE);
+  if (err == ESP_OK)
+    err = esp_partition_write(part_, writeOffset, sector, sectorUsed);
+  writeOffset += sectorUsed;
+  sectorUsed = 0;
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Error writing OTA: %d", err);
+    fail();
+    return ESP_FAIL;
+  }
+  if (commitPending)
+    commitChunk();
+  return ESP_OK;
+}
 
-    if (available > 0) {
-      esp_err_t err = esp_ota_write(handle_, buf, available);
-      if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error writing OTA: %d", err);
-        esp_ota_abort(handle_);
-        part_ = nullptr;
-        return ESP_FAIL;
-      }
+void CompressedOTA::commitChunk() {
+  commitPending = false;
+  resume.chunks = chunkIndex;
+  resume.received = chunkEnd;
+  resume.written = writeOffset;
+  auto storage = Storage::GetInstance();
+  // A chunk is worth one NVS commit, the progress has to survive a reset
+  if (storage->writeValue<void>(OTA_RESUME_KEY, &resume,
+                                sizeof(resume)) == ESP_OK)
+    storage->flush();
+}
+
+esp_err_t CompressedOTA::beginImage(uint16_t tag, uint32_t dataLength) {
+  if (!OtaDecoder::codecFor(tag, &codec, &layout)) {
+    ESP_LOGE(TAG, "OTA sub-element type %04x not supported", tag);
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  if (resumeFrom > 0 &&
+      (tag != resume.tag || dataLength != resume.dataLength)) {
+    ESP_LOGE(TAG, "Image differs from the interrupted download");
+    forgetProgress();
+    return ESP_ERR_INVALID_VERSION;
+  }
+  resume.tag = tag;
+  resume.dataLength = dataLength;
+  chunkIndex = resume.chunks;
+  chunkEnd = resumeFrom;
+  // Chunks start the decoder again at each header
+  auto err = decoder.begin(codec);
+  if (layout == OtaLayout::Patch)
+    patch.begin(esp_ota_get_running_partition());
+  return err;
+}
+
+esp_err_t CompressedOTA::beginSubelement() {
+  uint16_t tag = subelementHeader[1] << 8 | subelementHeader[0];
+  uint32_t dataLength = (uint32_t)subelementHeader[5] << 24 |
+                        (uint32_t)subelementHeader[4] << 16 |
+                        (uint32_t)subelementHeader[3] << 8 |
+                        subelementHeader[2];
+  ota_data_len = dataLength;
+  if (ota_upgrade_subelement) {
+    if (tag == OTA_TAG_IMAGE_DIGEST && dataLength == OTA_DIGEST_SIZE) {
+      subelement = Subelement::Digest;
+    } else {
+      ESP_LOGI(TAG, "Skipping OTA sub-element type %04x", tag);
+      subelement = Subelement::Skipped;
     }
-  } while (zlib_stream_.avail_in > 0 || zlib_stream_.avail_out == 0);
+    return ESP_OK;
+  }
+
+  // The image is the first sub-element
+  xSemaphoreTake(writerLock, portMAX_DELAY);
+  auto err = beginImage(tag, dataLength);
+  if (err != ESP_OK)
+    fail();
+  xSemaphoreGive(writerLock);
+  if (err != ESP_OK)
+    return err;
+  ota_upgrade_subelement = true;
+  subelement = Subelement::Image;
+  ota_data_len = dataLength - offset;
+  total_size = dataLength;
+  ESP_LOGI(TAG, "OTA sub-element size %lu, %s%s", dataLength, decoder.name(),
+           layout == OtaLayout::Patch    ? " delta patch"
+           : layout == OtaLayout::Chunks ? " in chunks"
+                                         : "");
+  return ESP_OK;
+}
 
+esp_err_t CompressedOTA::verifyDigest() {
+  uint8_t digest[OTA_DIGEST_SIZE];
+  mbedtls_sha256_finish(&resume.digest, digest);
+  if (!digestReceived) {
+    ESP_LOGE(TAG, "OTA image has no digest");
+    return ESP_ERR_INVALID_CRC;
+  }
+  if (memcmp(digest, expectedDigest, sizeof(digest)) != 0) {
+    ESP_LOGE(TAG, "OTA image does not match its digest");
+    return ESP_ERR_INVALID_CRC;
+  }
   return ESP_OK;
 }
 
+void CompressedOTA::requestResumeOffset(uint8_t endpoint) {
+  // The offset counts from the start of the OTA file. Stacks that take the
+  // next Image Block Request from it continue there, the others start over
+  // and the data up to it is skipped on arrival.
+  uint32_t fileOffset =
+      OTA_FILE_HEADER_SIZE + OTA_SUBELEMENT_HEADER_SIZE + resumeFrom;
+  esp_zb_zcl_set_attribute_val(endpoint, ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE,
+                               ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE,
+                               ESP_ZB_ZCL_ATTR_OTA_UPGRADE_FILE_OFFSET_ID,
+                               &fileOffset, false);
+}
+
+void CompressedOTA::fail() {
+  active.store(false);
+  part_ = nullptr;
+}
+
+void CompressedOTA::forgetProgress() {
+  resumeFrom = 0;
+  Storage::GetInstance()->eraseValue(OTA_RESUME_KEY);
+}
+
 esp_err_t CompressedOTA::finish() {
+  xSemaphoreTake(writerLock, portMAX_DELAY);
   if (!part_) {
     ESP_LOGE(TAG, "OTA not running");
+    xSemaphoreGive(writerLock);
     return ESP_FAIL;
   }
 
-  if (!write(nullptr, 0, true)) {
-    return ESP_FAIL;
+  // The rest of the ring, whatever the decoder still holds back, then the
+  // partial last sector
+  bool progress = true;
+  esp_err_t err = ESP_OK;
+  while (err == ESP_OK && progress) {
+    err = fillSector(&progress);
+    if (err == ESP_OK && sectorUsed == OTA_SECTOR_SIZE)
+      err = writeSector();
   }
-
-  esp_err_t err = esp_ota_end(handle_);
+  bool complete = layout == OtaLayout::Chunks
+                      ? chunkIndex > 0 && !inChunk && chunkHeaderLength == 0
+                      : decoder.complete() && (layout != OtaLayout::Patch ||
+                                               patch.complete());
+  if (err == ESP_OK && !complete) {
+    ESP_LOGE(TAG, "Compressed image is truncated");
+    fail();
+    err = ESP_FAIL;
+  }
+  if (err == ESP_OK)
+    err = writeSector();
+  if (err == ESP_OK) {
+    // Before the boot partition is touched
+    err = verifyDigest();
+    if (err != ESP_OK)
+      fail();
+  }
+  // Whether the image is good or not, the next download starts over
+  forgetProgress();
   if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Error ending OTA: %d", err);
-    part_ = nullptr;
-    return ESP_FAIL;
+    xSemaphoreGive(writerLock);
+    return err;
   }
+  active.store(false);
 
-  inflateEnd(&zlib_stream_);
-  zlib_init_ = ESP_FAIL;
+  stats.decoderHeap = decoder.peakHeap();
+  ESP_LOGI(TAG,
+           "Wrote %lu sectors, ring peaked at %lu bytes, %lu full, %s used "
+           "%zu bytes of heap",
+           stats.sectors, stats.maxRingBytes, stats.stackDrains,
+           decoder.name(), stats.decoderHeap);
+  decoder.end();
 
+  // Validates the image, as esp_ota_end would
   err = esp_ota_set_boot_partition(part_);
+  part_ = nullptr;
+  xSemaphoreGive(writerLock);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "Error setting boot partition: %d", err);
-    part_ = nullptr;
     return ESP_FAIL;
   }
-
-  part_ = nullptr;
   return ESP_OK;
 }
 
 esp_err_t CompressedOTA::zbOTAUpgradeStatusHandler(
     esp_zb_zcl_ota_upgrade_value_message_t *message) {
-  static uint32_t total_size = 0;
-  static uint32_t offset = 0;
-  static int64_t start_time = 0;
   esp_err_t ret = ESP_OK;
   uint8_t *payload = message->payload;
   size_t payload_size = message->payload_size;
@@ -153,47 +487,75 @@ esp_err_t CompressedOTA::zbOTAUpgradeStatusHandler(
     case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_START:
       ESP_LOGI(TAG, "-- OTA upgrade start");
       start_time = esp_timer_get_time();
+      offset = 0;
+      total_size = message->ota_header.image_size - OTA_SUBELEMENT_HEADER_SIZE;
+      ret = this->start(message->ota_header);
       ESP_RETURN_ON_ERROR(ret, TAG, "Failed to begin OTA partition, status: %s",
                           esp_err_to_name(ret));
-      ret = this->start();
+      if (resumeFrom > 0)
+        requestResumeOffset(message->info.dst_endpoint);
       break;
     case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_RECEIVE:
-      /* Read and process the first sub-element, ignoring everything else */
-      while (ota_header.size() < 6 && payload_size > 0) {
-        ota_header.push_back(payload[0]);
-        payload++;
-        payload_size--;
-        ESP_LOGI(TAG, "Reduced payload size to %d", payload_size);
-        total_size = message->ota_header.image_size - 6;
-      }
-
-      if (!ota_upgrade_subelement && ota_header.size() == 6) {
-        if (ota_header[0] == 0 && ota_header[1] == 0) {
-          ota_upgrade_subelement = true;
-          ota_data_len = (((int)ota_header[5] & 0xFF) << 24) |
-                         (((int)ota_header[4] & 0xFF) << 16) |
-                         (((int)ota_header[3] & 0xFF) << 8) |
-                         ((int)ota_header[2] & 0xFF);
-          ESP_LOGD(TAG, "OTA sub-element size %zu", ota_data_len);
-        } else {
-          ESP_LOGE(TAG, "OTA sub-element type %02x%02x not supported",
-                   ota_header[0], ota_header[1]);
-          // this->reset();
-          return ESP_FAIL;
+      if (resumeFrom > 0 && offset == 0 && subelementHeaderLength == 0 &&
+          payload_size >= sizeof(uint32_t)) {
+        uint32_t magic;
+        memcpy(&magic, payload, sizeof(magic));
+        if (magic == OTA_CHUNK_MAGIC) {
+          // The stack continued at the requested offset, the sub-element
+          // header is known from the interrupted download
+          memcpy(subelementHeader, &resume.tag, sizeof(resume.tag));
+          memcpy(subelementHeader + sizeof(resume.tag), &resume.dataLength,
+                 sizeof(resume.dataLength));
+          subelementHeaderLength = OTA_SUBELEMENT_HEADER_SIZE;
+          offset = resumeFrom;
         }
       }
 
-      if (ota_data_len) {
-        payload_size = std::min(ota_data_len, payload_size);
-        ota_data_len -= payload_size;
-
-        offset += payload_size;
+      /* The image is the first sub-element, its digest may follow */
+      while (payload_size > 0) {
+        if (subelementHeaderLength < OTA_SUBELEMENT_HEADER_SIZE) {
+          // The header may be split over blocks
+          auto length = std::min(
+              payload_size,
+              (size_t)(OTA_SUBELEMENT_HEADER_SIZE - subelementHeaderLength));
+          memcpy(subelementHeader + subelementHeaderLength, payload, length);
+          subelementHeaderLength += length;
+          payload += length;
+          payload_size -= length;
+          if (subelementHeaderLength < OTA_SUBELEMENT_HEADER_SIZE)
+            break;
+        }
+        if (subelement == Subelement::Header) {
+          ret = beginSubelement();
+          ESP_RETURN_ON_ERROR(ret, TAG, "Unusable OTA sub-element");
+        }
 
-        ESP_LOGI(TAG, "-- OTA Client receives data: progress [%ld/%ld]", offset,
-                 total_size);
-        if (write(payload, payload_size) != ESP_OK) {
-          // this->reset();
-          return ESP_FAIL;
+        auto length = std::min(ota_data_len, payload_size);
+        if (subelement == Subelement::Image) {
+          // The partition already holds the data up to the last chunk
+          size_t skip = offset < resumeFrom
+                            ? std::min((size_t)(resumeFrom - offset), length)
+                            : 0;
+
+          offset += length;
+
+          ESP_LOGD(TAG, "-- OTA Client receives data: progress [%ld/%ld]",
+                   offset, total_size);
+          if (write(payload + skip, length - skip) != ESP_OK) {
+            // this->reset();
+            return ESP_FAIL;
+          }
+        } else if (subelement == Subelement::Digest) {
+          memcpy(expectedDigest + OTA_DIGEST_SIZE - ota_data_len, payload,
+                 length);
+          digestReceived = ota_data_len == length;
+        }
+        payload += length;
+        payload_size -= length;
+        ota_data_len -= length;
+        if (ota_data_len == 0) {
+          subelementHeaderLength = 0;
+          subelement = Subelement::Header;
         }
       }
 
@@ -209,11 +571,21 @@ esp_err_t CompressedOTA::zbOTAUpgradeStatusHandler(
       //                       %s", esp_err_to_name(ret));
       // }
       break;
+    case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_ABORT:
+      ESP_LOGW(TAG, "-- OTA upgrade aborted at %lu of %lu bytes", offset,
+               total_size);
+      // Chunked images keep their progress for the next attempt
+      xSemaphoreTake(writerLock, portMAX_DELAY);
+      fail();
+      xSemaphoreGive(writerLock);
+      break;
     case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_APPLY:
       ESP_LOGI(TAG, "-- OTA upgrade apply");
       break;
     case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_CHECK:
-      ret = offset == total_size ? ESP_OK : ESP_FAIL;
+      ret = ota_upgrade_subelement && offset == total_size && digestReceived
+                ? ESP_OK
+                : ESP_FAIL;
       ESP_LOGI(TAG, "-- OTA upgrade check status: %s", esp_err_to_name(ret));
       break;
     case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_FINISH:
@@ -226,6 +598,10 @@ esp_err_t CompressedOTA::zbOTAUpgradeStatusHandler(
                message->ota_header.image_type, message->ota_header.image_size,
                (esp_timer_get_time() - start_time) / 1000);
       ret = this->finish();
+      Storage::GetInstance()->flush();
+      // A rejected image leaves the running firmware in place
+      ESP_RETURN_ON_ERROR(ret, TAG, "OTA image rejected, status: %s",
+                          esp_err_to_name(ret));
       ESP_LOGW(TAG, "Prepare to restart system");
       esp_restart();
       break;
@@ -1,12 +1,14 @@
 #pragma once
 
 #include "esp_zigbee_core.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
+#include <atomic>
+#include "mbedtls/sha256.h"
+#include "ota_decoder.hpp"
+#include "ota_patch.hpp"
 #include <esp_ota_ops.h>
-#include <vector>
-#include <zlib.h>
-
-#include <memory>
 
 /* Zigbee configuration */
 #define OTA_UPGRADE_MANUFACTURER                                               \
@@ -27,26 +29,178 @@
   223 /* The recommended OTA image block size                                  \
        */
 
+// Received image data waiting for the writer, a power of two
+#define OTA_RING_SIZE (8 * 1024)
+// Flash sector, the unit the writer erases and writes into the partition
+#define OTA_SECTOR_SIZE 4096
+// Tag and length in front of the image sub-element
+#define OTA_SUBELEMENT_HEADER_SIZE 6
+// Decoded delta patch bytes waiting for OtaPatch
+#define OTA_PATCH_STAGE_SIZE 256
+// OTA file header as create-ota.py writes it, without optional fields
+#define OTA_FILE_HEADER_SIZE 56
+// "ZBCK" in front of each chunk of a chunked image
+#define OTA_CHUNK_MAGIC 0x4b43425a
+// Storage key of the progress of an interrupted chunked download
+#define OTA_RESUME_KEY "otaResume"
+// Sub-element after the image with the SHA-256 of its data, manufacturer
+// specific range
+#define OTA_TAG_IMAGE_DIGEST 0xf100
+#define OTA_DIGEST_SIZE 32
+
+// Each chunk is a complete stream of the codec, it decodes to a whole
+// number of sectors except for the last one
+struct ota_chunk_header_t {
+  uint32_t magic;
+  uint32_t index;
+  uint32_t length; // Compressed bytes after the header
+};
+
+// Persisted after every chunk that reached the partition
+struct ota_resume_t {
+  // The image as announced by the server
+  uint32_t fileVersion;
+  uint32_t imageSize;
+  uint16_t manufacturer;
+  uint16_t imageType;
+  uint16_t tag;
+  uint16_t chunks;     // Written completely
+  uint32_t dataLength; // Of the image sub-element
+  uint32_t received;   // Sub-element data up to the next chunk
+  uint32_t written;    // Image bytes in the partition, whole sectors
+  uint32_t partition;  // Address of the partition written to
+  // Of the sub-element data up to received, plain state on all targets
+  mbedtls_sha256_context digest;
+};
+
+/// @brief Byte ring for one producer and one consumer task, without locks
+class OtaRing {
+public:
+  /// @return bytes taken, less than size when the ring is full
+  size_t push(const uint8_t *data, size_t size);
+  /// @brief Oldest readable bytes that are contiguous in memory
+  /// @return their count, 0 if the ring is empty
+  size_t peek(const uint8_t **data) const;
+  void consume(size_t size);
+  size_t used() const { return head.load() - tail.load(); }
+  /// @brief Only while neither side is active
+  void clear();
+
+private:
+  uint8_t buffer[OTA_RING_SIZE];
+  std::atomic<uint32_t> head{0}; // Written by the producer only
+  std::atomic<uint32_t> tail{0}; // Written by the consumer only
+};
+
+struct ota_writer_stats_t {
+  uint32_t sectors;      // Partition sector writes of the writer
+  uint32_t stackDrains;  // Blocks that found the ring full
+  uint32_t maxRingBytes; // Highest fill of the ring
+  size_t decoderHeap;    // Peak heap of the decoder
+};
+
+/// @brief Receives a compressed image from the Zigbee OTA cluster, the
+/// sub-element tag selects the codec and whether it is a delta patch
+/// against the running image or a chunked image.
+/// The stack callback only copies the blocks into a ring, an executor job
+/// decodes them into a sector buffer and writes whole sectors, so flash
+/// erases do not delay the next block request. The stack only waits for
+/// the flash when the ring is full.
+/// Chunked downloads persist their progress after every chunk. When the
+/// same image starts again, the sectors already in the partition are kept
+/// and only the data after the last complete chunk is decoded.
+/// The writer hashes the compressed data as it takes it from the ring. The
+/// boot partition only changes if the hash matches the digest sub-element.
 class CompressedOTA {
 public:
   CompressedOTA() = default;
-  ~CompressedOTA();
 
-  esp_err_t start();
-  esp_err_t write(uint8_t *data, size_t size);
+  void init();
+  /// @brief Resumes the interrupted download of the same image
+  esp_err_t start(const esp_zb_zcl_ota_upgrade_file_header_t &header);
+  /// @brief Queues compressed data for the writer
+  esp_err_t write(const uint8_t *data, size_t size);
+  /// @brief Writes the rest of the image and selects it for the next boot,
+  /// if it matches its digest
   esp_err_t finish();
   esp_err_t
   zbOTAUpgradeStatusHandler(esp_zb_zcl_ota_upgrade_value_message_t *message);
 
+  ota_writer_stats_t getStats() const { return stats; }
+  /// @brief Sub-element data offset the current download continues from
+  uint32_t getResumeOffset() const { return resumeFrom; }
+
 private:
-  esp_err_t write(uint8_t *data, size_t size, bool flush);
+  static uint32_t writerJob(void *context);
+  /// @brief Decodes ring data until one sector was written or the ring is
+  /// empty, with writerLock held
+  esp_err_t drainSector(bool *wroteSector);
+  /// @brief One decode step into the sector, through the patch for deltas
+  esp_err_t fillSector(bool *progress);
+  esp_err_t decodeInto(uint8_t **out, size_t *outSize, bool *progress);
+  /// @brief Hashes data taken from the ring
+  void consumeRing(const uint8_t *data, size_t size);
+  /// @brief Limits the decoder to the current chunk, starting a new one at
+  /// its header
+  esp_err_t decodeChunk(uint8_t **out, size_t *outSize, bool *progress);
+  esp_err_t writeSector();
+  void commitChunk();
+  /// @brief Sets up the decoding of the image sub-element
+  esp_err_t beginImage(uint16_t tag, uint32_t dataLength);
+  /// @brief Handles the sub-element header that just arrived
+  esp_err_t beginSubelement();
+  esp_err_t verifyDigest();
+  /// @brief Asks the stack to request the next block after the last chunk
+  void requestResumeOffset(uint8_t endpoint);
+  void fail();
+  /// @brief The next download starts over, for corrupt or finished images
+  void forgetProgress();
 
-  bool zlib_init_{false};
-  z_stream zlib_stream_;
+  bool initialized = false;
   const esp_partition_t *part_{nullptr};
-  esp_ota_handle_t handle_{0};
+  // Where writeSector puts the next sector
+  uint32_t writeOffset = 0;
+  // Cleared by the writer on errors, checked by the stack callback
+  std::atomic<bool> active{false};
+
+  OtaRing ring;
+  OtaDecoder decoder;
+  OtaCodec codec = OtaCodec::Zlib;
+  OtaLayout layout = OtaLayout::Stream;
+  OtaPatch patch;
+  uint8_t staged[OTA_PATCH_STAGE_SIZE];
+  const uint8_t *stagedData = staged;
+  size_t stagedLength = 0;
+  uint8_t sector[OTA_SECTOR_SIZE];
+  size_t sectorUsed = 0;
+  // Chunked images, under writerLock
+  ota_resume_t resume = {};
+  uint8_t chunkHeader[sizeof(ota_chunk_header_t)];
+  uint8_t chunkHeaderLength = 0;
+  uint32_t chunkIndex = 0;
+  uint32_t chunkRemaining = 0; // Compressed bytes left of the chunk
+  uint32_t chunkEnd = 0;       // Sub-element data offset after the chunk
+  bool inChunk = false;
+  // The chunk ended with the sector, commit once it is written
+  bool commitPending = false;
+  SemaphoreHandle_t writerLock = NULL;
+  int8_t writerJobId = -1;
+  ota_writer_stats_t stats = {};
+
+  enum class Subelement : uint8_t { Header, Image, Digest, Skipped };
 
-  std::vector<uint8_t> ota_header;
-  bool ota_upgrade_subelement;
-  size_t ota_data_len{0};
+  uint8_t subelementHeader[OTA_SUBELEMENT_HEADER_SIZE];
+  uint8_t subelementHeaderLength = 0;
+  // Where the data of the current sub-element goes
+  Subelement subelement = Subelement::Header;
+  bool ota_upgrade_subelement = false;
+  size_t ota_data_len{0}; // Left of the current sub-element
+  uint8_t expectedDigest[OTA_DIGEST_SIZE];
+  bool digestReceived = false;
+  // Sub-element data received in this download, skipped bytes included
+  uint32_t offset = 0;
+  uint32_t total_size = 0;
+  int64_t start_time = 0;
+  // Sub-element data offset up to which the partition is already written
+  uint32_t resumeFrom = 0;
 };
\ No newline at end of file
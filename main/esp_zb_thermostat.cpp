@@ -15,7 +15,14 @@
 #include "esp_zb_thermostat.hpp"
 #include "clock.hpp"
 #include "custom_cluster.hpp"
+#include "executor.hpp"
+#include "heater.hpp"
+#include "report_policy.hpp"
+#include "state_store.hpp"
+#include "storage.hpp"
+#include "temperature_sensor.hpp"
 #include "zigbee_device.hpp"
+#include "zigbee_worker.hpp"
 
 #include "esp_ota.h"
 #include "esp_pm.h"
@@ -39,6 +46,14 @@
 static const char *TAG = "THERMOSTAT";
 #define ARRAY_LENTH(arr) (sizeof(arr) / sizeof(arr[0]))
 
+// Allocated once by GetInstance(), nothing grows after init
+static_assert(sizeof(Heater) + sizeof(StateStore) + sizeof(Storage) +
+                      sizeof(TemperatureSensor) + sizeof(ZigbeeWorker) +
+                      sizeof(Executor) + sizeof(ReportPolicy) +
+                      sizeof(Clock) <=
+                  APP_STATIC_MEMORY_BUDGET_BYTES,
+              "Application state exceeds the static memory budget");
+
 #if defined ZB_ED_ROLE
 #error Define ZB_COORDINATOR_ROLE in idf.py menuconfig to compile thermostat source code.
 #endif
@@ -69,6 +84,7 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct) {
         auto clock = Clock::GetInstance();
         clock->syncTimeRequest();
         Heater::loadLatestZigbeeAttributeValues();
+        ReportPolicy::GetInstance()->apply();
       }
     } else {
       ESP_LOGE(TAG, "Failed to initialize Zigbee stack (status: %s)",
@@ -90,6 +106,7 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct) {
       auto clock = Clock::GetInstance();
       clock->syncTimeRequest();
       Heater::loadLatestZigbeeAttributeValues();
+      ReportPolicy::GetInstance()->apply();
     }
     break;
   case ESP_ZB_COMMON_SIGNAL_CAN_SLEEP:
@@ -167,13 +184,15 @@ custom_thermostat_clusters_create(esp_zb_cluster_list_t *cluster_list,
                               ESP_ZB_ZCL_ATTR_ACCESS_REPORTING,
                           &(heater->setpointChangeSource));
 
+  // The stack keeps its own copy of the initial value
+  int16_t manualTemp = heater->inputs.read().manualTemp;
   esp_zb_cluster_add_attr(
       thermostart_cluster, ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
       ESP_ZB_ZCL_ATTR_THERMOSTAT_UNOCCUPIED_HEATING_SETPOINT_ID,
       ESP_ZB_ZCL_ATTR_TYPE_S16,
       ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE | ESP_ZB_ZCL_ATTR_ACCESS_SCENE |
           ESP_ZB_ZCL_ATTR_ACCESS_REPORTING,
-      &(heater->manualTemp));
+      &manualTemp);
 
   ESP_ERROR_CHECK(esp_zb_cluster_list_add_thermostat_cluster(
       cluster_list, thermostart_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
@@ -211,6 +230,13 @@ custom_thermostat_clusters_create(esp_zb_cluster_list_t *cluster_list,
       ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING,
       &(heater->currentTarget));
 
+  esp_zb_custom_cluster_add_custom_attr(
+      custom_cluster, ESP_ZB_ZCL_ATTR_CUSTOM_NEXT_TRANSITION_ID,
+      // Unix seconds, ZCL UTCTime would count from 2000
+      ESP_ZB_ZCL_ATTR_TYPE_U32,
+      ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING,
+      &(heater->nextTransition));
+
   esp_zb_cluster_list_add_custom_cluster(cluster_list, custom_cluster,
                                          ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
 }
@@ -248,36 +274,6 @@ static void zb_ota_upgrade_ep_create(esp_zb_cluster_list_t *cluster_list
       cluster_list, ota_cluster, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE));
 }
 
-static void esp_zb_configure_reporting() {
-  return;
-  device->addReportingToCoordinator(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT,
-                                    ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID,
-                                    ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
-
-  device->addReportingToCoordinator(ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
-                                    ESP_ZB_ZCL_ATTR_THERMOSTAT_SYSTEM_MODE_ID,
-                                    ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
-
-  device->addReportingToCoordinator(
-      ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
-      ESP_ZB_ZCL_ATTR_THERMOSTAT_UNOCCUPIED_HEATING_SETPOINT_ID,
-      ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE);
-
-  device->addReportingToCoordinator(
-      ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
-      ESP_ZB_ZCL_ATTR_THERMOSTAT_SETPOINT_CHANGE_SOURCE_ID,
-      ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
-
-  device->addReportingToCoordinator(ESP_ZB_ZCL_CLUSTER_ID_CUSTOM,
-                                    ESP_ZB_ZCL_ATTR_CUSTOM_RUNTIME_SECONDS_ID,
-                                    ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
-
-  device->addReportingToCoordinator(
-      ESP_ZB_ZCL_CLUSTER_ID_CUSTOM,
-      ESP_ZB_ZCL_ATTR_CUSTOM_TEMPERATURE_SOURCE_ID,
-      ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
-}
-
 static esp_err_t
 esp_zb_action_handler(esp_zb_core_action_callback_id_t callback_id,
                       const void *message) {
@@ -375,6 +371,7 @@ extern "C" void app_main() {
         restartCounter = 0;
         storage->writeValue("restartCounter", restartCounter);
         ESP_ERROR_CHECK(nvs_flash_erase());
+        storage->discard();
         esp_zb_factory_reset();
       }
     }
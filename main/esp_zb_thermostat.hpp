@@ -35,6 +35,10 @@ extern "C" {
   "susch19"
 #define MODEL_IDENTIFIER "\x06""heater"
 
+/* Upper bound for the application singletons, which hold all runtime state
+ * in fixed size containers instead of the heap */
+#define APP_STATIC_MEMORY_BUDGET_BYTES (12 * 1024)
+
 #define ESP_ZB_ZC_CONFIG()                                                     \
   {                                                                            \
     .esp_zb_role = ESP_ZB_DEVICE_TYPE_ROUTER,                                  \
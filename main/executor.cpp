@@ -0,0 +1,113 @@
+#include "executor.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <algorithm>
+
+static const char *TAG = "EXECUTOR";
+
+Executor *Executor::_instance = nullptr;
+
+Executor *Executor::GetInstance() {
+  if (_instance == nullptr) {
+    _instance = new Executor();
+  }
+  return _instance;
+}
+
+void Executor::init() {
+  if (initialized)
+    return;
+  initialized = true;
+  // Below Zigbee_main, so the stack always wins against application work
+  xTaskCreate(executorTask, "Executor_main", 4096, this, 4, &task);
+}
+
+int8_t Executor::add(const char *name, executor_job_t job, void *context,
+                     uint32_t delayMs) {
+  auto index = count.load();
+  if (index >= EXECUTOR_MAX_JOBS) {
+    ESP_LOGE(TAG, "No room for job %s", name);
+    return -1;
+  }
+  jobs[index] = {.run = job,
+                 .context = context,
+                 .deadline = delayMs == EXECUTOR_IDLE
+                                 ? INT64_MAX
+                                 : esp_timer_get_time() + delayMs * 1000LL,
+                 .stats = {.name = name, .runs = 0, .totalMicros = 0,
+                           .maxMicros = 0}};
+  // The executor task only looks at jobs below count
+  count.store(index + 1);
+  if (task != NULL)
+    xTaskNotifyGive(task);
+  return index;
+}
+
+void Executor::wake(int8_t job) {
+  if (job < 0)
+    return;
+  woken.fetch_or(1 << job);
+  if (task != NULL)
+    xTaskNotifyGive(task);
+}
+
+uint32_t Executor::runDue() {
+  auto pending = woken.exchange(0);
+  auto jobCount = count.load();
+  for (uint8_t i = 0; i < jobCount; i++) {
+    auto &job = jobs[i];
+    auto start = esp_timer_get_time();
+    if ((pending & 1 << i) == 0 && job.deadline > start)
+      continue;
+
+    auto next = job.run(job.context);
+    auto end = esp_timer_get_time();
+    job.deadline =
+        next == EXECUTOR_IDLE ? INT64_MAX : end + (int64_t)next * 1000;
+
+    auto micros = (uint32_t)(end - start);
+    job.stats.runs++;
+    job.stats.totalMicros += micros;
+    if (micros > job.stats.maxMicros)
+      job.stats.maxMicros = micros;
+  }
+
+  int64_t earliest = INT64_MAX;
+  for (uint8_t i = 0; i < jobCount; i++) {
+    if (jobs[i].deadline < earliest)
+      earliest = jobs[i].deadline;
+  }
+  // Woken by one of the jobs that just ran, e.g. a new sample for the heat
+  // check, which then runs without waiting for another deadline
+  if (woken.load() != 0)
+    return 0;
+  if (earliest == INT64_MAX)
+    return EXECUTOR_IDLE;
+  auto now = esp_timer_get_time();
+  if (earliest <= now)
+    return 0;
+  // Rounded up, so the job is due when the task wakes
+  return (uint32_t)((earliest - now + 999) / 1000);
+}
+
+executor_job_stats_t Executor::getStats(uint8_t job) {
+  if (job >= count.load())
+    return {};
+  return jobs[job].stats;
+}
+
+void Executor::executorTask(void *pvParameters) {
+  auto _this = (Executor *)pvParameters;
+  for (;;) {
+    auto waitMs = _this->runDue();
+    if (waitMs == 0)
+      continue;
+    // A wake() while the jobs ran left a notification, so this returns
+    // right away. Long waits are split to keep the tick conversion in range.
+    ulTaskNotifyTake(pdTRUE,
+                     waitMs == EXECUTOR_IDLE
+                         ? portMAX_DELAY
+                         : pdMS_TO_TICKS(std::min<uint32_t>(
+                               waitMs, EXECUTOR_MAX_WAIT_MS)));
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <atomic>
+#include <stdint.h>
+
+#define EXECUTOR_MAX_JOBS 8
+// Returned by a job that only runs again once it is woken
+#define EXECUTOR_IDLE UINT32_MAX
+// Longest single sleep of the executor task
+#define EXECUTOR_MAX_WAIT_MS (600 * 1000)
+
+/// @brief Runs once and returns the milliseconds until it wants to run
+/// again, 0 to continue right after the other due jobs, or EXECUTOR_IDLE
+typedef uint32_t (*executor_job_t)(void *context);
+
+struct executor_job_stats_t {
+  const char *name;
+  uint32_t runs;
+  uint64_t totalMicros; // Time spent in the job
+  uint32_t maxMicros;   // Longest single run
+};
+
+/// @brief Runs the periodic application work as jobs on a single task.
+/// Each job is a function that returns when it next wants to run, so waits
+/// between steps cost a deadline instead of a task stack. Jobs never run
+/// concurrently with each other.
+class Executor {
+
+public:
+  static Executor *GetInstance();
+
+  Executor(Executor &other) = delete;
+  void operator=(const Executor &) = delete;
+
+  void init();
+  /// @brief Registers a job, only during initialization
+  /// @param delayMs until the first run, EXECUTOR_IDLE to wait for wake()
+  /// @return id for wake() and getStats(), -1 if the table is full
+  int8_t add(const char *name, executor_job_t job, void *context,
+             uint32_t delayMs);
+  /// @brief Runs the job as soon as possible, safe to call from any task
+  void wake(int8_t job);
+  /// @brief Runs every job that is due or woken
+  /// @return milliseconds until the next deadline, EXECUTOR_IDLE if none
+  uint32_t runDue();
+
+  executor_job_stats_t getStats(uint8_t job);
+  uint8_t getJobCount() { return count.load(); }
+
+protected:
+  static Executor *_instance;
+  Executor() {}
+
+private:
+  struct Job {
+    executor_job_t run;
+    void *context;
+    int64_t deadline; // esp_timer time in µs, INT64_MAX while idle
+    executor_job_stats_t stats;
+  };
+
+  static void executorTask(void *pvParameters);
+
+  bool initialized = false;
+  Job jobs[EXECUTOR_MAX_JOBS];
+  std::atomic<uint8_t> count{0};
+  std::atomic<uint32_t> woken{0}; // One bit per job
+  TaskHandle_t task = NULL;
+};
@@ -1,8 +1,10 @@
 #include "heater.hpp"
 #include "clock.hpp"
 #include "custom_cluster.hpp"
+#include "esp_timer.h"
 #include "esp_zb_thermostat.hpp"
-#include "storage.hpp"
+#include "executor.hpp"
+#include "state_store.hpp"
 #include "sys/time.h"
 #include "temperature_sensor.hpp"
 #include "time.h"
@@ -12,65 +14,35 @@
 #include "zigbee_device.hpp"
 #include <algorithm>
 #include <cstdlib>
-#include <map>
 #include <string>
 #include <sys/select.h>
 #include <time.h>
-#include <vector>
 
 static const char *TAG = "HEATER";
 
 void Heater::loadStoredState() {
-  uint32_t runtimeInSeconds = 0;
-  if (storage->readValue("heat_runtime", &runtimeInSeconds) == ESP_OK)
-    this->runtime_in_seconds = runtimeInSeconds;
-
-  uint8_t mode;
-  if (storage->readValue("heat_mode", &mode) == ESP_OK)
-    this->thermostat_cluster.system_mode = mode;
-
-  int16_t temp = 0;
-  uint32_t tempReceived = 0;
-  if (storage->readValue("heater_mnlTemp", &temp) == ESP_OK) {
-    this->manualTemp = temp;
-    if (storage->readValue("heater_mnlTime", &tempReceived) == ESP_OK)
-      this->manualModeRecv = {.tv_sec = tempReceived, .tv_usec = 0};
-  }
-
-  if (storage->readValue("heater_rmtTemp", &temp) == ESP_OK) {
-    this->remoteTemp = temp;
-    if (storage->readValue("heater_rmtTime", &tempReceived) == ESP_OK)
-      this->remoteRecv = {.tv_sec = tempReceived, .tv_usec = 0};
-  }
+  auto &state = stateStore->state;
+  this->runtime_in_seconds = state.runtimeSeconds;
+  // Initial value of the thermostat cluster
+  this->thermostat_cluster.system_mode = state.systemMode;
+  inputs.update([&](heater_inputs_t &inputs) {
+    inputs.systemMode = state.systemMode;
+    inputs.manualTemp = state.manualTemp;
+    inputs.manualTime = state.manualTime;
+    inputs.remoteTemp = state.remoteTemp;
+    inputs.remoteTime = state.remoteTime;
+  });
 }
 
 void Heater::init() {
-  storage = Storage::GetInstance();
+  stateStore = StateStore::GetInstance();
+  stateStore->init();
   clock = Clock::GetInstance();
   tempSensor = TemperatureSensor::GetInstance();
+  inputs.init();
   this->loadStoredState();
 
-  for (size_t i = 0; i < 8; i++) {
-    char msg[12];
-    sprintf(msg, "schedule_%x", (uint8_t)i);
-    size_t len;
-    auto res = storage->readValue<void>(msg, NULL, &len);
-    if (res != ESP_OK)
-      continue;
-    void *data = malloc(len);
-
-    res = storage->readValue<void>(msg, data, &len);
-    size_t listSize = len / sizeof(esp_zb_weekly_schedule_single_s);
-
-    esp_zb_weekly_schedule_single_s *des =
-        (esp_zb_weekly_schedule_single_s *)data;
-    DayOfWeekW dow = (DayOfWeekW)i;
-    for (size_t o = 0; o < listSize; o++) {
-      this->config[dow].push_back(des[o]);
-    }
-
-    free(data);
-  }
+  compileSchedule();
   // printSchedule();
   initialized = true;
 
@@ -86,12 +58,19 @@ void Heater::init() {
 
   ESP_ERROR_CHECK_WITHOUT_ABORT(gpio_set_level(HEATER_GPIO_PIN, 0));
 
-  xTaskCreate(checkScheduleTask, "Heater_main", 4096, NULL, 6, NULL);
+  auto executor = Executor::GetInstance();
+  executor->init();
+  heatCheckJobId = executor->add("heat_check", heatCheckJob, this, 10 * 1000);
 }
 
-void Heater::measuredTemperature(float *temp, const void *parameters) {
+void Heater::measuredTemperature(int16_t *temp, const void *parameters) {
   Heater *_this = (Heater *)parameters;
-  _this->localSensorTemp = ZigbeeDevice::temperatureTos16(*temp);
+  _this->updateLocalTemp(*temp,
+                         _this->tempSensor->getLatestSample().measuredAt);
+}
+
+void Heater::requestHeatCheck() {
+  Executor::GetInstance()->wake(heatCheckJobId);
 }
 
 void Heater::updateCustomSchedule(esp_zb_custom_weekly_schedule_header_t header,
@@ -100,36 +79,22 @@ void Heater::updateCustomSchedule(esp_zb_custom_weekly_schedule_header_t header,
            header.numberOfTransitions, header.mode, sizeof(header),
            sizeof(esp_zb_custom_weekly_schedule_t));
 
-  std::map<DayOfWeekW, std::vector<esp_zb_weekly_schedule_single_s>> newConfig;
+  // An update replaces all transitions of the days it names
+  uint8_t updatedDays = 0;
+  for (size_t i = 0; i < header.numberOfTransitions; i++)
+    updatedDays |= data[i].dayOfWeekForSequence;
+  stateStore->clearScheduleDays(updatedDays);
 
   for (size_t i = 0; i < header.numberOfTransitions; i++) {
     auto conf = data[i];
     ESP_LOGI(TAG, "Custom Data %d: %x, %d, %d", i, conf.dayOfWeekForSequence,
              conf.transition_time, conf.tempSetPoint);
-    for (size_t o = 0; o < 8; o++) {
-      if ((conf.dayOfWeekForSequence & 1 << o) < 1)
-        continue;
-      auto dayOfWeek = (DayOfWeekW)o;
-      esp_zb_weekly_schedule_single_s single = {
-          .transition_time = conf.transition_time,
-          .tempSetPoint = conf.tempSetPoint};
-      newConfig[dayOfWeek].push_back(single);
-    }
-  }
-
-  for (auto &&i : newConfig) {
-    this->config[i.first] = newConfig[i.first];
-  }
-  auto storage = Storage::GetInstance();
-  for (auto &&i : newConfig) {
-    auto size =
-        (size_t)(i.second.size() * sizeof(esp_zb_weekly_schedule_single_s));
-    auto asd = i.second.data();
-    char msg[12];
-    sprintf(msg, "schedule_%x", (uint8_t)i.first);
-
-    storage->writeValue<void>(msg, (const void *)asd, size);
+    stateStore->addScheduleTransition(conf.dayOfWeekForSequence,
+                                      conf.transition_time, conf.tempSetPoint);
   }
+  stateStore->save();
+  compileSchedule();
+  requestHeatCheck();
 }
 
 void Heater::updateSchedule(esp_zb_weekly_schedule_header_t header,
@@ -211,9 +176,16 @@ void Heater::printSchedule() {
   ESP_LOGI("HEATER", "Time is: %2d.%2d.%4d %2d:%2d:%d", tm.tm_mday, tm.tm_mon,
            tm.tm_year, tm.tm_hour, tm.tm_min, tm.tm_sec);
 
-  for (auto &&c : this->config) {
-    ESP_LOGI("HEATER", "%s", getEnumString(c.first));
-    for (auto &&i : c.second) {
+  // Per day view of the deduplicated entries
+  for (uint8_t day = 0; day < 8; day++) {
+    bool printedDay = false;
+    for (auto &&i : stateStore->schedule) {
+      if ((i.dayMask & 1 << day) == 0)
+        continue;
+      if (!printedDay) {
+        ESP_LOGI("HEATER", "%s", getEnumString((DayOfWeekW)day));
+        printedDay = true;
+      }
       auto hour = i.transition_time / 60;
       auto minute = i.transition_time % 60;
       ESP_LOGI("HEATER", "%2d:%2d, Heat: %d", hour, minute, i.tempSetPoint);
@@ -248,103 +220,177 @@ void Heater::reportHeatingMode(bool heating) {
   static uint8_t off = 0x0;
 
   ESP_LOGI(TAG, "Setting Mode to: %d", (heating ? heat : off));
-  esp_zb_lock_acquire(portMAX_DELAY);
-  auto res = esp_zb_zcl_set_attribute_val(
-      HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
-      ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
-      ESP_ZB_ZCL_ATTR_THERMOSTAT_RUNNING_MODE_ID, &(heating ? heat : off),
-      true);
-  esp_zb_lock_release();
-  if (res != ESP_ZB_ZCL_STATUS_SUCCESS) {
-    ESP_LOGI(TAG, "Attribute Set Result: %x", res);
+  attributes.stage(HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
+                   ESP_ZB_ZCL_ATTR_THERMOSTAT_RUNNING_MODE_ID,
+                   heating ? heat : off, true);
+}
+
+void Heater::compileSchedule() {
+  auto &index = schedules.prepare();
+  size_t dropped = 0;
+  for (auto &&i : stateStore->schedule) {
+    // The vacation bit is not bound to a weekday, so it is not part of the
+    // weekly rotation
+    for (uint8_t day = 0; day < (uint8_t)DayOfWeekW::Vac; day++) {
+      if ((i.dayMask & 1 << day) == 0)
+        continue;
+      if (!index.add({.weekMinute =
+                          ScheduleIndex::toWeekMinute(day, i.transition_time),
+                      .temp = i.tempSetPoint}))
+        dropped++;
+    }
+  }
+  if (dropped > 0)
+    ESP_LOGW(TAG, "Dropped %d transitions beyond %d", dropped,
+             SCHEDULE_INDEX_MAX_TRANSITIONS);
+  auto count = index.size();
+  auto version = schedules.publish();
+  ESP_LOGI(TAG, "Compiled schedule v%ld with %d transitions", version, count);
+}
+
+uint16_t Heater::currentWeekMinute() {
+  auto minutes = (currentTime.tm_hour * 60 + currentTime.tm_min) +
+                 clock->timeZoneOffsetInSeconds / 60;
+  auto wday = currentTime.tm_wday;
+
+  if (minutes < 0) {
+    minutes += MINUTES_PER_DAY;
+    wday = (wday - 1 + 7) % 7;
+  } else if (minutes >= MINUTES_PER_DAY) {
+    minutes -= MINUTES_PER_DAY;
+    wday = (wday + 1) % 7;
   }
+  return ScheduleIndex::toWeekMinute(wday, minutes);
 }
 
-void Heater::insert(std::vector<TimeTempMessage> &cont, TimeTempMessage value) {
-  std::vector<TimeTempMessage>::iterator it = std::lower_bound(
-      cont.begin(), cont.end(), value,
-      [](TimeTempMessage b, TimeTempMessage a) {
-        return (a.DayOfWeek == b.DayOfWeek && a.Time > b.Time) ||
-               a.DayOfWeek > b.DayOfWeek;
-      });                 // find proper position in descending order
-  cont.insert(it, value); // insert before iterator it
+void Heater::updateNextTransition(const ScheduleIndex &schedule,
+                                  uint16_t now) {
+  uint32_t next = 0;
+  auto transition = schedule.nextAfter(now);
+  if (transition != nullptr) {
+    auto minutes = ScheduleIndex::minutesBetween(now, transition->weekMinute);
+    // A single transition is only reached again after a full week
+    if (minutes == 0)
+      minutes = MINUTES_PER_WEEK;
+    next = tv.tv_sec + minutes * 60 - currentTime.tm_sec;
+  }
+  if (next == this->nextTransition)
+    return;
+
+  this->nextTransition = next;
+  attributes.stage(HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_CUSTOM,
+                   ESP_ZB_ZCL_ATTR_CUSTOM_NEXT_TRANSITION_ID, next);
+}
+
+uint32_t Heater::secondsUntilNextCheck() {
+  int64_t deadline = tv.tv_sec + HEATER_MAX_SLEEP_SECONDS;
+  if (this->nextTransition != 0)
+    deadline = std::min<int64_t>(deadline, this->nextTransition);
+
+  // Inputs changed since are announced through requestHeatCheck()
+  auto &inputs = this->evaluatedInputs;
+  int64_t manualExpiry = inputs.manualTime + MANUAL_TARGET_VALIDITY_SECONDS;
+  if (inputs.manualTemp > 0 && manualExpiry > tv.tv_sec)
+    deadline = std::min(deadline, manualExpiry);
+
+  int64_t remoteExpiry = inputs.remoteTime + REMOTE_TEMP_VALIDITY_SECONDS;
+  if (inputs.remoteTemp > 0 && remoteExpiry > tv.tv_sec)
+    deadline = std::min(deadline, remoteExpiry);
+
+  return (uint32_t)std::max<int64_t>(deadline - tv.tv_sec, 1);
 }
 
 void Heater::updateSystemMode(uint8_t newMode) {
-  this->thermostat_cluster.system_mode = newMode;
-  storage->writeValue("heat_mode", this->thermostat_cluster.system_mode);
-  this->runHeatCheck();
+  inputs.update([&](heater_inputs_t &inputs) { inputs.systemMode = newMode; });
+  stateStore->state.systemMode = newMode;
+  stateStore->save();
+  this->requestHeatCheck();
 }
 void Heater::updateManualTemp(int16_t newTarget) {
-  this->manualTemp = newTarget;
-  gettimeofday(&(this->manualModeRecv), NULL);
-
-  storage->writeValue("heater_mnlTemp", this->manualTemp);
-  storage->writeValue<uint32_t>("heater_mnlTime", this->manualModeRecv.tv_sec);
-  this->runHeatCheck();
+  timeval received;
+  gettimeofday(&received, NULL);
+  inputs.update([&](heater_inputs_t &inputs) {
+    inputs.manualTemp = newTarget;
+    inputs.manualTime = received.tv_sec;
+  });
+
+  stateStore->state.manualTemp = newTarget;
+  stateStore->state.manualTime = received.tv_sec;
+  stateStore->save();
+  this->requestHeatCheck();
 }
 void Heater::updateRemoteTemp(int16_t newTemp) {
-  this->remoteTemp = newTemp;
-  gettimeofday(&(this->remoteRecv), NULL);
-  storage->writeValue("heater_rmtTemp", this->remoteTemp);
-  storage->writeValue<uint32_t>("heater_rmtTime", this->remoteRecv.tv_sec);
-  this->runHeatCheck();
+  timeval received;
+  gettimeofday(&received, NULL);
+  auto receivedAt = esp_timer_get_time();
+  inputs.update([&](heater_inputs_t &inputs) {
+    inputs.remoteTemp = newTemp;
+    inputs.remoteTime = received.tv_sec;
+    inputs.remoteSampleTime = receivedAt;
+  });
+  stateStore->state.remoteTemp = newTemp;
+  stateStore->state.remoteTime = received.tv_sec;
+  stateStore->save();
+  this->requestHeatCheck();
+}
+void Heater::updateLocalTemp(int16_t newTemp, int64_t measuredAt) {
+  inputs.update([&](heater_inputs_t &inputs) {
+    inputs.localSensorTemp = newTemp;
+    inputs.localSampleTime = measuredAt;
+  });
+  this->requestHeatCheck();
 }
 void Heater::updateRuntime(uint32_t newRuntime) {
   this->runtime_in_seconds = newRuntime;
 
-  storage->writeValue("heat_runtime", this->runtime_in_seconds);
+  stateStore->state.runtimeSeconds = newRuntime;
+  stateStore->save(true);
 }
 
-static void startHeating(Storage *storage, timeval &tv) {
+static void startHeating(StateStore *stateStore, timeval &tv) {
   gpio_set_level(HEATER_GPIO_PIN, 1);
-  storage->writeValue("heat_start", tv.tv_sec);
+  stateStore->state.heatStart = tv.tv_sec;
+  stateStore->save(true);
 }
 
-static void stopHeating(Storage *storage, Heater *heater, timeval &tv) {
+static void stopHeating(StateStore *stateStore, Heater *heater,
+                        AttributeTransaction &attributes, timeval &tv) {
 
   gpio_set_level(HEATER_GPIO_PIN, 0);
-  int64_t heatStartSeconds;
   auto completeRuntime = heater->runtime_in_seconds;
-  storage->readValue("heat_start", &heatStartSeconds);
-  auto heatPeriod = tv.tv_sec - heatStartSeconds;
+  auto heatPeriod = tv.tv_sec - stateStore->state.heatStart;
   completeRuntime += (uint32_t)heatPeriod;
-  storage->writeValue("heat_runtime", completeRuntime);
+  stateStore->state.runtimeSeconds = completeRuntime;
+  stateStore->save(true);
   ESP_LOGI(TAG, "Heated for %llds, accumulated %lds", heatPeriod,
            completeRuntime);
 
-  esp_zb_lock_acquire(portMAX_DELAY);
-  auto res = esp_zb_zcl_set_attribute_val(
-      HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_CUSTOM,
-      ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_CUSTOM_RUNTIME_SECONDS_ID,
-      &completeRuntime, false);
-  esp_zb_lock_release();
+  attributes.stage(HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_CUSTOM,
+                   ESP_ZB_ZCL_ATTR_CUSTOM_RUNTIME_SECONDS_ID, completeRuntime);
   heater->runtime_in_seconds = completeRuntime;
-
-  if (res != ESP_ZB_ZCL_STATUS_SUCCESS) {
-    ESP_LOGI(TAG, "Attribute HeatStop Result: %x", res);
-  }
 }
 
-static void changeTempSource(uint8_t newSource) {
-
-  esp_zb_lock_acquire(portMAX_DELAY);
-  auto res = esp_zb_zcl_set_attribute_val(
-      HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_CUSTOM,
-      ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
-      ESP_ZB_ZCL_ATTR_CUSTOM_TEMPERATURE_SOURCE_ID, &newSource, false);
-  esp_zb_lock_release();
-  if (res != ESP_ZB_ZCL_STATUS_SUCCESS) {
-    ESP_LOGI(TAG, "Attribute Set Result: %x", res);
-  }
+static void changeTempSource(AttributeTransaction &attributes,
+                             uint8_t newSource) {
+  // Dropped by the transaction if the source did not change
+  attributes.stage(HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_CUSTOM,
+                   ESP_ZB_ZCL_ATTR_CUSTOM_TEMPERATURE_SOURCE_ID, newSource);
 }
 
 void Heater::runHeatCheck() {
   clock->getCurrentTime(currentTime);
   gettimeofday(&tv, NULL);
-  schedules.clear();
-
-  switch (this->thermostat_cluster.system_mode) {
+  auto now = currentWeekMinute();
+  // One consistent copy of everything the other tasks write
+  auto &inputs = this->evaluatedInputs;
+  inputs = this->inputs.read(&evaluatedGeneration);
+  // Stays valid and unchanged until the end of the check, even if a new
+  // schedule arrives meanwhile
+  auto snapshot = schedules.acquire();
+  updateNextTransition(snapshot->index, now);
+  recordLatency(inputs);
+
+  switch (inputs.systemMode) {
   case ESP_ZB_ZCL_THERMOSTAT_SYSTEM_MODE_HEAT:
   case ESP_ZB_ZCL_THERMOSTAT_SYSTEM_MODE_AUTO:
     enableHeatCheck = true;
@@ -354,98 +400,109 @@ void Heater::runHeatCheck() {
     break;
   }
 
-  auto temp = this->localSensorTemp;
-  if (this->remoteTemp > 0 && this->remoteRecv.tv_sec + 3600 > tv.tv_sec) {
-    temp = this->remoteTemp;
-    if (this->temperatureSource !=
-        ESP_ZB_ZCL_CUSTOM_TEMPERATURE_SOURCE_REMOTE) {
-      changeTempSource(ESP_ZB_ZCL_CUSTOM_TEMPERATURE_SOURCE_REMOTE);
-    }
+  auto temp = inputs.localSensorTemp;
+  uint8_t source = tempSensor->tempSensorFound
+                       ? ESP_ZB_ZCL_CUSTOM_TEMPERATURE_SOURCE_LOCAL
+                       : ESP_ZB_ZCL_CUSTOM_TEMPERATURE_SOURCE_NONE;
+  if (inputs.remoteTemp > 0 &&
+      inputs.remoteTime + REMOTE_TEMP_VALIDITY_SECONDS > tv.tv_sec) {
+    temp = inputs.remoteTemp;
+    source = ESP_ZB_ZCL_CUSTOM_TEMPERATURE_SOURCE_REMOTE;
+  }
 
-    ESP_LOGI(TAG, "Using external sensor temp: %d", this->remoteTemp);
-  } else {
-    if (tempSensor->tempSensorFound)
-      changeTempSource(ESP_ZB_ZCL_CUSTOM_TEMPERATURE_SOURCE_LOCAL);
-    else
-      changeTempSource(ESP_ZB_ZCL_CUSTOM_TEMPERATURE_SOURCE_NONE);
+  // Only take manual times from within a week
+  bool manualActive =
+      tv.tv_sec - inputs.manualTime < MANUAL_TARGET_VALIDITY_SECONDS &&
+      inputs.manualTemp > 0;
+  auto scheduled = snapshot->index.activeAt(now);
+
+  // The decision only changes with a new transition, not with every minute
+  heat_check_fingerprint_t fingerprint = {
+      .scheduleVersion = snapshot->version,
+      .manualTime = manualActive ? inputs.manualTime : 0,
+      .temperature = temp,
+      .manualTemp = manualActive ? inputs.manualTemp : (int16_t)0,
+      .activeTransition =
+          scheduled != nullptr ? scheduled->weekMinute : (uint16_t)UINT16_MAX,
+      .systemMode = inputs.systemMode,
+      .temperatureSource = source};
+  if (fingerprintValid && fingerprint == lastFingerprint) {
+    heatCheckStats.hits++;
+    schedules.release();
+    attributes.commit();
+    return;
   }
+  heatCheckStats.misses++;
+  lastFingerprint = fingerprint;
+  fingerprintValid = true;
+
+  changeTempSource(attributes, source);
+  if (source == ESP_ZB_ZCL_CUSTOM_TEMPERATURE_SOURCE_REMOTE)
+    ESP_LOGI(TAG, "Using external sensor temp: %d", inputs.remoteTemp);
 
   if (temp < 5) {
 
     ESP_LOGI(TAG, "Temp is outside of the allowed range %d", temp);
+    schedules.release();
+    attributes.commit();
     return;
   }
 
   ESP_LOGI(TAG, "Heat check is %s", enableHeatCheck ? "enabled" : "disabled");
 
-  for (auto &&c : this->config) {
-    for (auto &&i : c.second) {
-      this->insert(schedules, {.DayOfWeek = c.first,
-                               .Time = i.transition_time,
-                               .Temp = i.tempSetPoint});
-    }
-  }
   // ESP_LOGI(TAG, "Manuel Temp seconds %llds with offest %lds",
   //          this->manualModeRecv.tv_sec, clock->timeZoneOffsetInSeconds);
-  time_t ms = this->manualModeRecv.tv_sec + clock->timeZoneOffsetInSeconds;
+  time_t ms = inputs.manualTime + clock->timeZoneOffsetInSeconds;
   tm manualRec = *localtime(&ms);
   // ESP_LOGI(TAG, "Got manual temp %d for %2d.%2d.%4d %2d:%2d:%d",
   //          this->manualTemp, manualRec.tm_mday, manualRec.tm_mon + 1,
   //          manualRec.tm_year + 1900, manualRec.tm_hour, manualRec.tm_min,
   //          manualRec.tm_sec);
 
-  // Only take manual times from within a week
-  if (tv.tv_sec - this->manualModeRecv.tv_sec < 86400 * 7 &&
-      this->manualTemp > 0) {
+  if (manualActive) {
 
     DayOfWeekW dayOfWeek = (DayOfWeekW)manualRec.tm_wday;
 
     manualMsg = {.DayOfWeek = dayOfWeek,
                  .Time = (uint16_t)(manualRec.tm_hour * 60 + manualRec.tm_min),
-                 .Temp = this->manualTemp};
-    this->insert(schedules, manualMsg);
+                 .Temp = inputs.manualTemp};
   }
-  if (schedules.size() == 0) {
+
+  if (scheduled == nullptr && !manualActive) {
 
     if (isHeating) {
       this->reportHeatingMode(false);
       isHeating = false;
-      stopHeating(storage, this, tv);
+      stopHeating(stateStore, this, attributes, tv);
     }
 
   } else {
-    auto minutes = (currentTime.tm_hour * 60 + currentTime.tm_min) +
-                   clock->timeZoneOffsetInSeconds / 60;
-    auto wday = currentTime.tm_wday;
-
-    if (minutes < 0) {
-      minutes += 1440;
-      wday = (wday - 1 + 7) % 7;
-    } else if (minutes >= 1440) {
-      minutes -= 1440;
-      wday = (wday + 1) % 7;
+    // The manual target overrides the schedule until the next transition
+    // after it was received
+    TimeTempMessage ttm = manualMsg;
+    if (scheduled != nullptr &&
+        (!manualActive ||
+         ScheduleIndex::minutesBetween(scheduled->weekMinute, now) <=
+             ScheduleIndex::minutesBetween(
+                 ScheduleIndex::toWeekMinute((uint8_t)manualMsg.DayOfWeek,
+                                             manualMsg.Time),
+                 now))) {
+      ttm = {.DayOfWeek =
+                 (DayOfWeekW)(scheduled->weekMinute / MINUTES_PER_DAY),
+             .Time = (uint16_t)(scheduled->weekMinute % MINUTES_PER_DAY),
+             .Temp = scheduled->temp};
     }
 
-    auto res = std::find_if(schedules.rbegin(), schedules.rend(),
-                            [minutes, wday](TimeTempMessage ttm) {
-                              return (wday == (int)ttm.DayOfWeek &&
-                                      minutes >= ttm.Time) ||
-                                     wday > (int)ttm.DayOfWeek;
-                            });
-    auto ttm = (res == schedules.rend()) ? schedules.back() : *res;
-
     auto compressed = ttm.Temp << 16 | ttm.Time;
     if (compressed != this->currentTarget) {
 
-      ESP_LOGI(TAG, "Found new schedule: Day:%s, Time: %2d:%2d, Temp:%f",
+      ESP_LOGI(TAG,
+               "Found new schedule: Day:%s, Time: %2d:%2d, Temp:" CENTI_TEMP_FMT,
                getEnumString(ttm.DayOfWeek), ttm.Time / 60, ttm.Time % 60,
-               ZigbeeDevice::s16ToTemperature(ttm.Temp));
-      esp_zb_lock_acquire(portMAX_DELAY);
-      esp_zb_zcl_set_attribute_val(
-          HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_CUSTOM,
-          ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
-          ESP_ZB_ZCL_ATTR_CUSTOM_CURRENT_SCHEDULE_ID, &(compressed), false);
-      esp_zb_lock_release();
+               CENTI_TEMP_ARGS(ttm.Temp));
+      attributes.stage(HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_CUSTOM,
+                       ESP_ZB_ZCL_ATTR_CUSTOM_CURRENT_SCHEDULE_ID,
+                       (uint32_t)compressed);
       this->currentTarget = compressed;
     }
 
@@ -460,13 +517,10 @@ void Heater::runHeatCheck() {
       this->setpointChangeSource = 0x1;
     }
     if (previous != this->setpointChangeSource) {
-      esp_zb_lock_acquire(portMAX_DELAY);
-      esp_zb_zcl_set_attribute_val(
-          HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
-          ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
-          ESP_ZB_ZCL_ATTR_THERMOSTAT_SETPOINT_CHANGE_SOURCE_ID,
-          &(this->setpointChangeSource), false);
-      esp_zb_lock_release();
+      attributes.stage(HA_THERMOSTAT_ENDPOINT,
+                       ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
+                       ESP_ZB_ZCL_ATTR_THERMOSTAT_SETPOINT_CHANGE_SOURCE_ID,
+                       this->setpointChangeSource);
     }
 
     auto shouldHeat = enableHeatCheck && ttm.Temp > temp;
@@ -476,39 +530,69 @@ void Heater::runHeatCheck() {
       isHeating = shouldHeat;
       this->reportHeatingMode(shouldHeat);
       if (shouldHeat) {
-        startHeating(storage, tv);
+        startHeating(stateStore, tv);
       } else {
-        stopHeating(storage, this, tv);
+        stopHeating(stateStore, this, attributes, tv);
       }
     }
   }
+  schedules.release();
+  // Everything changed by this check is published under one lock
+  attributes.commit();
 }
 
-void Heater::checkScheduleTask(void *pvParameters) {
+bool Heater::localSampleStale() {
+  auto inputs = this->inputs.read();
+  timeval now;
+  gettimeofday(&now, NULL);
+  // A valid remote temperature is used instead, it can not be refreshed
+  if (inputs.remoteTemp > 0 &&
+      inputs.remoteTime + REMOTE_TEMP_VALIDITY_SECONDS > now.tv_sec)
+    return false;
+  return tempSensor->tempSensorFound &&
+         esp_timer_get_time() - inputs.localSampleTime >
+             HEATER_MAX_SAMPLE_AGE_MS * 1000LL;
+}
 
-  vTaskDelay((10 * 1000) / portTICK_PERIOD_MS);
-  auto _this = Heater::GetInstance();
+void Heater::recordLatency(const heater_inputs_t &inputs) {
+  auto sampleTime = std::max(inputs.localSampleTime, inputs.remoteSampleTime);
+  // Only the first decision on a sample counts
+  if (sampleTime <= lastSampleTime)
+    return;
+  lastSampleTime = sampleTime;
+
+  auto ms = (uint32_t)((esp_timer_get_time() - sampleTime) / 1000);
+  uint8_t bucket = 0;
+  while (bucket < HEATER_LATENCY_BUCKETS - 1 && ms >= 1u << bucket)
+    bucket++;
+  latency.buckets[bucket]++;
+  latency.maxMs = std::max(latency.maxMs, ms);
+}
+
+uint32_t Heater::heatCheckJob(void *pvParameters) {
+  auto _this = (Heater *)pvParameters;
   tm currentTime;
-  auto clock = Clock::GetInstance();
-  for (;;) {
-    clock->getCurrentTime(currentTime);
-    // Check every 10 seconds, if time was synced from root
-    if (currentTime.tm_year + 1900 < 2000) {
-
-      vTaskDelay((10000 / portTICK_PERIOD_MS));
-      continue;
-    }
-    break;
+  _this->clock->getCurrentTime(currentTime);
+  // Check every 10 seconds, if time was synced from root
+  if (currentTime.tm_year + 1900 < 2000)
+    return 10000;
+
+  // Transitions and expiries fall between two samples, the fresh sample
+  // wakes this job again. Only once, so a failing sensor can not stall it.
+  if (!_this->sampleRequested && _this->localSampleStale()) {
+    _this->sampleRequested = true;
+    _this->tempSensor->requestSample();
+    return HEATER_SAMPLE_TIMEOUT_MS;
   }
+  _this->sampleRequested = false;
 
-  for (;;) {
-    _this->runHeatCheck();
-    clock->getCurrentTime(currentTime);
+  _this->runHeatCheck();
 
-    // vTaskDelay((10000 / portTICK_PERIOD_MS));
-    vTaskDelay(((60 - currentTime.tm_sec) * 1000) /
-               portTICK_PERIOD_MS); // Wait till next minute, one second afeter
-  }
+  // Nothing can change before the next transition, expiry or a new input,
+  // which wakes this job through requestHeatCheck()
+  auto seconds = _this->secondsUntilNextCheck();
+  ESP_LOGD(TAG, "Next heat check in %lds", seconds);
+  return seconds * 1000;
 }
 
 Heater *Heater::_instance = nullptr;
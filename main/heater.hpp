@@ -1,21 +1,59 @@
 #pragma once
+#include "attribute_transaction.hpp"
 #include "clock.hpp"
 #include "custom_cluster.hpp"
 #include "custom_zigbee_types/schedule.hpp"
 #include "esp_zigbee_core.h"
-#include "storage.hpp"
+#include "heater_inputs.hpp"
+#include "schedule_index.hpp"
+#include "state_store.hpp"
 #include "temperature_sensor.hpp"
 #include "zcl/esp_zigbee_zcl_common.h"
 
 #include <cstdlib>
-#include <map>
 #include <sys/time.h>
-#include <unordered_map>
-#include <vector>
 #include "driver/gpio.h"
 
 //D3 on SeedStudio ESP32C6
 #define HEATER_GPIO_PIN GPIO_NUM_21 
+// Manual targets older than this are ignored
+#define MANUAL_TARGET_VALIDITY_SECONDS (86400 * 7)
+// Remote temperatures older than this fall back to the local sensor
+#define REMOTE_TEMP_VALIDITY_SECONDS 3600
+// Upper bound for sleeping between two heat checks, covers clock drift
+#define HEATER_MAX_SLEEP_SECONDS 3600
+// Older local samples are refreshed before a check that no sample triggered
+#define HEATER_MAX_SAMPLE_AGE_MS 2000
+// Fallback if the refreshed sample never arrives
+#define HEATER_SAMPLE_TIMEOUT_MS 2000
+// Power of two buckets from below 1ms, the last one collects the rest
+#define HEATER_LATENCY_BUCKETS 16
+
+/// Everything the heating decision depends on, a check with the same
+/// fingerprint as the previous one is skipped
+struct heat_check_fingerprint_t {
+  uint32_t scheduleVersion;
+  int64_t manualTime; // 0 without an active manual target
+  int16_t temperature; // Of the selected source
+  int16_t manualTemp;
+  uint16_t activeTransition; // Week minute, UINT16_MAX without a schedule
+  uint8_t systemMode;
+  uint8_t temperatureSource;
+
+  bool operator==(const heat_check_fingerprint_t &) const = default;
+};
+
+struct heat_check_stats_t {
+  uint32_t hits;   // Skipped, the fingerprint was unchanged
+  uint32_t misses; // Evaluated
+};
+
+/// Time from measuring a sample until a heat check decided on it, the relay
+/// is switched within the same check
+struct heat_check_latency_t {
+  uint32_t buckets[HEATER_LATENCY_BUCKETS]; // i counts latencies below 2^i ms
+  uint32_t maxMs;
+};
 
 enum class DayOfWeekW : uint8_t { Sun, Mon, Tue, Wed, Thu, Fri, Sat, Vac };
 
@@ -61,9 +99,15 @@ public:
   void updateRemoteTemp(int16_t newTemp); /*
       heater->remoteTemp = value;
       gettimeofday(&heater->remoteRecv, NULL); */
+  /// @param measuredAt esp_timer_get_time() when the sample was measured
+  void updateLocalTemp(int16_t newTemp, int64_t measuredAt);
   void
   updateRuntime(uint32_t newRuntime); //      heater->runtime_in_seconds = ;
   void runHeatCheck();
+  /// @brief Wakes the heat check job to reevaluate with the latest inputs
+  void requestHeatCheck();
+  heat_check_stats_t getHeatCheckStats() const { return heatCheckStats; }
+  heat_check_latency_t getLatency() const { return latency; }
 
   static Heater *GetInstance();
 
@@ -72,7 +116,7 @@ public:
 
 protected:
   static Heater *_instance;
-  static void checkScheduleTask(void *pvParameters);
+  static uint32_t heatCheckJob(void *pvParameters);
   Heater() {}
 
 private:
@@ -81,31 +125,42 @@ private:
   // static const uint8_t HEATERPING = D5;
   // static const uint8_t SENSORPING = D0;
   void loadStoredState();
-  static void measuredTemperature(float *temp, const void *parameters);
+  static void measuredTemperature(int16_t *temp, const void *parameters);
   void reportHeatingMode(bool mode);
-  void insert(std::vector<Heater::TimeTempMessage> &cont,
-              Heater::TimeTempMessage value);
-
-  std::unordered_map<DayOfWeekW, std::vector<esp_zb_weekly_schedule_single_s>>
-      config;
+  void compileSchedule();
+  uint16_t currentWeekMinute();
+  void updateNextTransition(const ScheduleIndex &schedule, uint16_t now);
+  uint32_t secondsUntilNextCheck();
+  bool localSampleStale();
+  void recordLatency(const heater_inputs_t &inputs);
 
 public:
   uint32_t runtime_in_seconds = 0;
   esp_zb_thermostat_cluster_cfg_s thermostat_cluster;
-  int16_t localSensorTemp = 0;
-  int16_t manualTemp = 0;
-  timeval manualModeRecv;
-  int16_t remoteTemp = 0;
-  timeval remoteRecv;
+  // Written through the update methods from other tasks
+  HeaterInputs inputs;
   uint8_t setpointChangeSource = 1;
   uint8_t temperatureSource = 0x1;
   uint32_t currentTarget = 0;
+  uint32_t nextTransition = 0;
 
 private:
-  Storage *storage;
+  StateStore *stateStore;
   Clock *clock;
   TemperatureSensor *tempSensor;
-  std::vector<TimeTempMessage> schedules = {};
+  int8_t heatCheckJobId = -1;
+  // Published by the Zigbee worker, read by the heater task
+  ScheduleSnapshots schedules;
+  // Inputs of the last heat check, read once at its start
+  heater_inputs_t evaluatedInputs = {};
+  uint32_t evaluatedGeneration = 0;
+  heat_check_fingerprint_t lastFingerprint = {};
+  bool fingerprintValid = false;
+  heat_check_stats_t heatCheckStats = {};
+  heat_check_latency_t latency = {};
+  int64_t lastSampleTime = 0; // Newest sample already in the latency
+  bool sampleRequested = false;
+  AttributeTransaction attributes; // Committed at the end of runHeatCheck
   Heater::TimeTempMessage manualMsg = {};
   tm currentTime = {};
   timeval tv = {};
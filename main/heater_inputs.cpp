@@ -0,0 +1,45 @@
+#include "heater_inputs.hpp"
+#include "freertos/task.h"
+
+void HeaterInputs::init() { writeLock = xSemaphoreCreateMutex(); }
+
+heater_inputs_t HeaterInputs::load() const {
+  uint32_t copy[WORDS];
+  for (size_t i = 0; i < WORDS; i++)
+    copy[i] = words[i].load(std::memory_order_relaxed);
+  heater_inputs_t inputs;
+  memcpy(&inputs, copy, sizeof(inputs));
+  return inputs;
+}
+
+void HeaterInputs::store(const heater_inputs_t &inputs) {
+  uint32_t copy[WORDS];
+  memcpy(copy, &inputs, sizeof(inputs));
+
+  auto begin = sequence.load(std::memory_order_relaxed);
+  sequence.store(begin + 1, std::memory_order_relaxed);
+  // Readers that see any of the new words also see the odd sequence
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < WORDS; i++)
+    words[i].store(copy[i], std::memory_order_relaxed);
+  sequence.store(begin + 2, std::memory_order_release);
+}
+
+heater_inputs_t HeaterInputs::read(uint32_t *generation) const {
+  for (uint32_t attempt = 1;; attempt++) {
+    auto begin = sequence.load(std::memory_order_acquire);
+    if ((begin & 1) == 0) {
+      auto inputs = load();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == begin) {
+        if (generation != nullptr)
+          *generation = begin / 2;
+        return inputs;
+      }
+    }
+    // The executor task may outrank a writer, spinning would starve a writer
+    // it preempted in the middle of an update
+    if (attempt >= HEATER_INPUTS_READ_SPINS)
+      vTaskDelay(1);
+  }
+}
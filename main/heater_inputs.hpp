@@ -0,0 +1,63 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+// Optimistic read attempts before the reader sleeps to let a preempted
+// writer finish
+#define HEATER_INPUTS_READ_SPINS 4
+
+/// Everything runHeatCheck decides on that other tasks write
+struct heater_inputs_t {
+  int64_t manualTime; // Seconds since 1970 the manual target was received
+  int64_t remoteTime; // Seconds since 1970 the remote temperature was received
+  int64_t localSampleTime;  // esp_timer µs the local sample was measured
+  int64_t remoteSampleTime; // esp_timer µs the remote sample was received
+  int16_t localSensorTemp;
+  int16_t manualTemp;
+  int16_t remoteTemp;
+  uint8_t systemMode;
+  uint8_t reserved;
+};
+
+/// @brief Heater inputs behind a seqlock. Writers from the sensor and Zigbee
+/// tasks are serialized by a mutex, the heat check reads a consistent copy
+/// of all fields without taking it. Every write bumps the generation.
+class HeaterInputs {
+
+public:
+  HeaterInputs() {}
+  HeaterInputs(HeaterInputs &other) = delete;
+  void operator=(const HeaterInputs &) = delete;
+
+  void init();
+  /// @brief Applies change to the current inputs and publishes the result
+  template <typename F> void update(F change) {
+    xSemaphoreTake(writeLock, portMAX_DELAY);
+    auto inputs = load();
+    change(inputs);
+    store(inputs);
+    xSemaphoreGive(writeLock);
+  }
+  /// @param generation receives the number of writes so far
+  heater_inputs_t read(uint32_t *generation = nullptr) const;
+  uint32_t generation() const {
+    return sequence.load(std::memory_order_acquire) / 2;
+  }
+
+private:
+  static constexpr size_t WORDS = sizeof(heater_inputs_t) / sizeof(uint32_t);
+  static_assert(sizeof(heater_inputs_t) % sizeof(uint32_t) == 0);
+
+  heater_inputs_t load() const;
+  void store(const heater_inputs_t &inputs);
+
+  SemaphoreHandle_t writeLock;
+  // Odd while a write is in progress
+  std::atomic<uint32_t> sequence{0};
+  // Word-wise atomics, so the racing copy of a reader is well defined
+  std::atomic<uint32_t> words[WORDS] = {};
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+/// @brief Vector with a capacity fixed at compile time, stored inline.
+/// Never touches the heap, a push_back() beyond the capacity fails instead.
+/// Only for trivially copyable elements, so moving them is a memmove.
+template <typename T, size_t N> class InplaceVector {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Elements are moved with memmove");
+
+public:
+  typedef T *iterator;
+  typedef const T *const_iterator;
+
+  InplaceVector() = default;
+
+  static constexpr size_t capacity() { return N; }
+  size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+  bool full() const { return length == N; }
+
+  T *data() { return items; }
+  const T *data() const { return items; }
+  iterator begin() { return items; }
+  iterator end() { return items + length; }
+  const_iterator begin() const { return items; }
+  const_iterator end() const { return items + length; }
+  T &operator[](size_t i) { return items[i]; }
+  const T &operator[](size_t i) const { return items[i]; }
+  T &front() { return items[0]; }
+  const T &front() const { return items[0]; }
+  T &back() { return items[length - 1]; }
+  const T &back() const { return items[length - 1]; }
+
+  /// @return false if the vector is full
+  bool push_back(const T &item) {
+    if (length == N)
+      return false;
+    items[length++] = item;
+    return true;
+  }
+  /// @brief Inserts before position, shifting the following elements
+  /// @return false if the vector is full
+  bool insert(iterator position, const T &item) {
+    if (length == N)
+      return false;
+    memmove(position + 1, position, (end() - position) * sizeof(T));
+    *position = item;
+    length++;
+    return true;
+  }
+  /// @brief Replaces the content with up to N elements of the range
+  /// @return false if the range had to be truncated
+  bool assign(const T *first, const T *last) {
+    size_t count = last - first;
+    length = count < N ? count : N;
+    memmove(items, first, length * sizeof(T));
+    return count <= N;
+  }
+  iterator erase(iterator first, iterator last) {
+    memmove(first, last, (end() - last) * sizeof(T));
+    length -= last - first;
+    return first;
+  }
+  iterator erase(iterator position) { return erase(position, position + 1); }
+  /// @brief Only shrinks, growing needs push_back()
+  void truncate(size_t count) {
+    if (count < length)
+      length = count;
+  }
+  void clear() { length = 0; }
+
+private:
+  T items[N];
+  size_t length = 0;
+};
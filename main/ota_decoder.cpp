@@ -0,0 +1,214 @@
+#include "ota_decoder.hpp"
+#include "esp_log.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "OTA_DECODER";
+
+// Each block starts with its size, zfree does not pass it
+#define HEAP_BLOCK_HEADER sizeof(max_align_t)
+
+bool OtaDecoder::codecFor(uint16_t tag, OtaCodec *codec, OtaLayout *layout) {
+  switch (tag) {
+  case OTA_TAG_ZLIB_PATCH:
+  case OTA_TAG_HEATSHRINK_PATCH:
+    *layout = OtaLayout::Patch;
+    break;
+  case OTA_TAG_ZLIB_CHUNKS:
+  case OTA_TAG_HEATSHRINK_CHUNKS:
+    *layout = OtaLayout::Chunks;
+    break;
+  default:
+    *layout = OtaLayout::Stream;
+    break;
+  }
+  switch (tag) {
+  case OTA_TAG_UPGRADE_IMAGE:
+  case OTA_TAG_ZLIB_PATCH:
+  case OTA_TAG_ZLIB_CHUNKS:
+    *codec = OtaCodec::Zlib;
+    return true;
+  case OTA_TAG_HEATSHRINK_IMAGE:
+  case OTA_TAG_HEATSHRINK_PATCH:
+  case OTA_TAG_HEATSHRINK_CHUNKS:
+    *codec = OtaCodec::Heatshrink;
+    return true;
+  default:
+    return false;
+  }
+}
+
+const char *OtaDecoder::name() const {
+  return codec == OtaCodec::Zlib ? "zlib" : "heatshrink";
+}
+
+void *OtaDecoder::allocate(void *context, unsigned items, unsigned size) {
+  auto _this = (OtaDecoder *)context;
+  auto bytes = (size_t)items * size;
+  auto block = (uint8_t *)calloc(1, HEAP_BLOCK_HEADER + bytes);
+  if (block == nullptr)
+    return nullptr;
+  *(size_t *)block = bytes;
+  _this->heapUsed += bytes;
+  if (_this->heapPeak < _this->heapUsed)
+    _this->heapPeak = _this->heapUsed;
+  return block + HEAP_BLOCK_HEADER;
+}
+
+void OtaDecoder::release(void *context, void *pointer) {
+  if (pointer == nullptr)
+    return;
+  auto block = (uint8_t *)pointer - HEAP_BLOCK_HEADER;
+  ((OtaDecoder *)context)->heapUsed -= *(size_t *)block;
+  free(block);
+}
+
+esp_err_t OtaDecoder::begin(OtaCodec codec) {
+  end();
+  this->codec = codec;
+  heapUsed = 0;
+  heapPeak = 0;
+
+  if (codec == OtaCodec::Zlib) {
+    zlib = {};
+    zlib.zalloc = allocate;
+    zlib.zfree = release;
+    zlib.opaque = this;
+    zlibEnd = false;
+    // Window bits 0 take the window size from the stream header, so an
+    // image compressed with a small window only allocates that much
+    int ret = inflateInit2(&zlib, 0);
+    if (ret != Z_OK) {
+      ESP_LOGE(TAG, "zlib init failed: %d", ret);
+      return ESP_FAIL;
+    }
+  } else {
+    windowBits = 0;
+    lookaheadBits = 0;
+    head = 0;
+    bits = 0;
+    bitCount = 0;
+    copyCount = 0;
+  }
+  active = true;
+  return ESP_OK;
+}
+
+void OtaDecoder::end() {
+  if (!active)
+    return;
+  active = false;
+  if (codec == OtaCodec::Zlib) {
+    inflateEnd(&zlib);
+  } else {
+    release(this, window);
+    window = nullptr;
+  }
+}
+
+esp_err_t OtaDecoder::decode(const uint8_t **in, size_t *inSize, uint8_t **out,
+                             size_t *outSize) {
+  if (!active)
+    return ESP_ERR_INVALID_STATE;
+  return codec == OtaCodec::Zlib ? decodeZlib(in, inSize, out, outSize)
+                                 : decodeHeatshrink(in, inSize, out, outSize);
+}
+
+bool OtaDecoder::complete() const {
+  if (codec == OtaCodec::Zlib)
+    return zlibEnd;
+  // The last byte is padded with less than a token
+  return windowBits != 0 && copyCount == 0 && bitCount < 8;
+}
+
+esp_err_t OtaDecoder::decodeZlib(const uint8_t **in, size_t *inSize,
+                                 uint8_t **out, size_t *outSize) {
+  zlib.next_in = (Bytef *)*in;
+  zlib.avail_in = *inSize;
+  zlib.next_out = *out;
+  zlib.avail_out = *outSize;
+
+  int ret = inflate(&zlib, Z_NO_FLUSH);
+  *in = zlib.next_in;
+  *inSize = zlib.avail_in;
+  *out = zlib.next_out;
+  *outSize = zlib.avail_out;
+  if (ret == Z_STREAM_END) {
+    zlibEnd = true;
+    // Anything after the end of the stream is not part of the image
+    *in += *inSize;
+    *inSize = 0;
+  } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+    ESP_LOGE(TAG, "zlib error: %d", ret);
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  return ESP_OK;
+}
+
+bool OtaDecoder::fillBits(const uint8_t **in, size_t *inSize, uint8_t count) {
+  while (bitCount < count && *inSize > 0) {
+    bits = bits << 8 | **in;
+    bitCount += 8;
+    (*in)++;
+    (*inSize)--;
+  }
+  return bitCount >= count;
+}
+
+uint32_t OtaDecoder::takeBits(uint8_t count) {
+  bitCount -= count;
+  return (bits >> bitCount) & ((1u << count) - 1);
+}
+
+esp_err_t OtaDecoder::decodeHeatshrink(const uint8_t **in, size_t *inSize,
+                                       uint8_t **out, size_t *outSize) {
+  if (windowBits == 0) {
+    if (*inSize == 0)
+      return ESP_OK;
+    auto window = **in >> 4;
+    auto lookahead = **in & 0x0f;
+    (*in)++;
+    (*inSize)--;
+    if (window < 4 || lookahead < 3 || lookahead >= window) {
+      ESP_LOGE(TAG, "Bad heatshrink parameters %d/%d", window, lookahead);
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    this->window = (uint8_t *)allocate(this, 1, 1u << window);
+    if (this->window == nullptr)
+      return ESP_ERR_NO_MEM;
+    windowBits = window;
+    lookaheadBits = lookahead;
+  }
+
+  uint16_t mask = (1u << windowBits) - 1;
+  for (;;) {
+    // A back reference may span calls when the output fills up
+    while (copyCount > 0 && *outSize > 0) {
+      auto c = window[(uint16_t)(head - copyOffset) & mask];
+      window[head++ & mask] = c;
+      *(*out)++ = c;
+      (*outSize)--;
+      copyCount--;
+    }
+    if (copyCount > 0 || *outSize == 0)
+      return ESP_OK;
+
+    // Tokens are only taken once complete, the rest waits for more input
+    if (!fillBits(in, inSize, 1))
+      return ESP_OK;
+    bool literal = (bits >> (bitCount - 1)) & 1;
+    if (!fillBits(in, inSize, literal ? 9 : 1 + windowBits + lookaheadBits))
+      return ESP_OK;
+    takeBits(1);
+    if (literal) {
+      auto c = (uint8_t)takeBits(8);
+      window[head++ & mask] = c;
+      *(*out)++ = c;
+      (*outSize)--;
+    } else {
+      copyOffset = takeBits(windowBits) + 1;
+      copyCount = takeBits(lookaheadBits) + 1;
+    }
+  }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+// Sub-element tags of the image data, one per codec and kind
+#define OTA_TAG_UPGRADE_IMAGE 0x0000
+// Manufacturer specific range
+#define OTA_TAG_HEATSHRINK_IMAGE 0xf000
+// Delta patches against the running image, see OtaPatch
+#define OTA_TAG_ZLIB_PATCH 0xf001
+#define OTA_TAG_HEATSHRINK_PATCH 0xf002
+// Independently compressed chunks of an image, see ota_chunk_header_t
+#define OTA_TAG_ZLIB_CHUNKS 0xf003
+#define OTA_TAG_HEATSHRINK_CHUNKS 0xf004
+
+enum class OtaCodec : uint8_t {
+  // zlib stream, the window size comes from its header
+  Zlib,
+  // heatshrink LZSS, one byte of window and lookahead bits first
+  Heatshrink,
+};
+
+enum class OtaLayout : uint8_t {
+  // One compressed stream of the image
+  Stream,
+  // One compressed stream of a delta patch against the running image
+  Patch,
+  // A compressed stream per chunk, downloads resume at a chunk
+  Chunks,
+};
+
+/// @brief Streaming decompressor of OTA image data. The codec is picked per
+/// image by the sub-element tag, its state only lives on the heap between
+/// begin() and end().
+class OtaDecoder {
+public:
+  OtaDecoder() = default;
+  ~OtaDecoder() { end(); }
+
+  /// @param layout how the compressed data is arranged
+  /// @return false if no codec is known for the tag
+  static bool codecFor(uint16_t tag, OtaCodec *codec, OtaLayout *layout);
+
+  esp_err_t begin(OtaCodec codec);
+  /// @brief Decodes until the input is consumed or the output is full
+  /// @param in advanced past the consumed input
+  /// @param out advanced past the produced output
+  /// @return ESP_ERR_INVALID_RESPONSE for corrupt data
+  esp_err_t decode(const uint8_t **in, size_t *inSize, uint8_t **out,
+                   size_t *outSize);
+  /// @brief Whether everything fed so far forms a complete image
+  bool complete() const;
+  void end();
+
+  const char *name() const;
+  /// @brief Most heap held at once since begin()
+  size_t peakHeap() const { return heapPeak; }
+
+private:
+  static void *allocate(void *context, unsigned items, unsigned size);
+  static void release(void *context, void *pointer);
+
+  esp_err_t decodeZlib(const uint8_t **in, size_t *inSize, uint8_t **out,
+                       size_t *outSize);
+  esp_err_t decodeHeatshrink(const uint8_t **in, size_t *inSize,
+                             uint8_t **out, size_t *outSize);
+  // Loads input bytes until count bits are buffered
+  bool fillBits(const uint8_t **in, size_t *inSize, uint8_t count);
+  uint32_t takeBits(uint8_t count);
+
+  OtaCodec codec = OtaCodec::Zlib;
+  bool active = false;
+  size_t heapUsed = 0;
+  size_t heapPeak = 0;
+
+  z_stream zlib = {};
+  bool zlibEnd = false;
+
+  uint8_t *window = nullptr;
+  uint8_t windowBits = 0; // 0 until the parameter byte was read
+  uint8_t lookaheadBits = 0;
+  uint16_t head = 0;
+  uint64_t bits = 0;
+  uint8_t bitCount = 0;
+  uint16_t copyOffset = 0;
+  uint16_t copyCount = 0;
+};
@@ -0,0 +1,161 @@
+#include "ota_patch.hpp"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include <algorithm>
+#include <string.h>
+
+static const char *TAG = "OTA_PATCH";
+
+void OtaPatch::begin(const esp_partition_t *base) {
+  this->base = base;
+  stage = Stage::Header;
+  fieldLength = 0;
+  header = {};
+  control = {};
+  basePosition = 0;
+  written = 0;
+  cacheLength = 0;
+}
+
+bool OtaPatch::complete() const { return stage == Stage::Done; }
+
+bool OtaPatch::collect(const uint8_t **in, size_t *inSize, size_t size) {
+  auto length = std::min(*inSize, size - fieldLength);
+  memcpy(field + fieldLength, *in, length);
+  fieldLength += length;
+  *in += length;
+  *inSize -= length;
+  if (fieldLength < size)
+    return false;
+  fieldLength = 0;
+  return true;
+}
+
+esp_err_t OtaPatch::readBase(uint32_t offset, uint8_t *value) {
+  if (offset >= header.baseSize)
+    return ESP_ERR_INVALID_RESPONSE;
+  if (offset < cacheOffset || offset >= cacheOffset + cacheLength) {
+    cacheOffset = offset;
+    cacheLength = std::min<uint32_t>(sizeof(cache), header.baseSize - offset);
+    auto err = esp_partition_read(base, cacheOffset, cache, cacheLength);
+    if (err != ESP_OK) {
+      cacheLength = 0;
+      return err;
+    }
+  }
+  *value = cache[offset - cacheOffset];
+  return ESP_OK;
+}
+
+esp_err_t OtaPatch::checkBase() {
+  if (header.magic != OTA_PATCH_MAGIC) {
+    ESP_LOGE(TAG, "Not a delta patch");
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  if (base == nullptr || header.baseSize > base->size) {
+    ESP_LOGE(TAG, "Patch base of %lu bytes does not fit the partition",
+             header.baseSize);
+    return ESP_ERR_INVALID_VERSION;
+  }
+
+  uint32_t crc = 0;
+  for (uint32_t offset = 0; offset < header.baseSize;
+       offset += sizeof(cache)) {
+    auto length = std::min<uint32_t>(sizeof(cache), header.baseSize - offset);
+    auto err = esp_partition_read(base, offset, cache, length);
+    if (err != ESP_OK)
+      return err;
+    crc = esp_rom_crc32_le(crc, cache, length);
+  }
+  if (crc != header.baseCrc) {
+    ESP_LOGE(TAG, "Patch is for another image, CRC %08lx instead of %08lx",
+             crc, header.baseCrc);
+    return ESP_ERR_INVALID_VERSION;
+  }
+  ESP_LOGI(TAG, "Patching %lu bytes of %s into %lu bytes", header.baseSize,
+           base->label, header.targetSize);
+  return ESP_OK;
+}
+
+void OtaPatch::nextRecord() {
+  if (written == header.targetSize)
+    stage = Stage::Done;
+  else if (control.diffLength > 0)
+    stage = Stage::Diff;
+  else if (control.extraLength > 0)
+    stage = Stage::Extra;
+  else {
+    basePosition += control.seek;
+    stage = Stage::Control;
+  }
+}
+
+esp_err_t OtaPatch::apply(const uint8_t **in, size_t *inSize, uint8_t **out,
+                          size_t *outSize) {
+  for (;;) {
+    switch (stage) {
+    case Stage::Header: {
+      if (!collect(in, inSize, sizeof(header)))
+        return ESP_OK;
+      memcpy(&header, field, sizeof(header));
+      auto err = checkBase();
+      if (err != ESP_OK)
+        return err;
+      stage = header.targetSize == 0 ? Stage::Done : Stage::Control;
+      break;
+    }
+    case Stage::Control:
+      if (!collect(in, inSize, sizeof(control)))
+        return ESP_OK;
+      memcpy(&control, field, sizeof(control));
+      if ((uint64_t)control.diffLength + control.extraLength >
+          header.targetSize - written) {
+        ESP_LOGE(TAG, "Patch record runs past the image");
+        return ESP_ERR_INVALID_RESPONSE;
+      }
+      nextRecord();
+      break;
+    case Stage::Diff: {
+      auto length = std::min({*inSize, *outSize, (size_t)control.diffLength});
+      if (length == 0)
+        return ESP_OK;
+      for (size_t i = 0; i < length; i++) {
+        uint8_t value;
+        if (basePosition < 0 || basePosition >= header.baseSize)
+          return ESP_ERR_INVALID_RESPONSE;
+        auto err = readBase(basePosition++, &value);
+        if (err != ESP_OK)
+          return err;
+        *(*out)++ = value + *(*in)++;
+      }
+      *inSize -= length;
+      *outSize -= length;
+      control.diffLength -= length;
+      written += length;
+      if (control.diffLength == 0)
+        nextRecord();
+      break;
+    }
+    case Stage::Extra: {
+      auto length = std::min({*inSize, *outSize, (size_t)control.extraLength});
+      if (length == 0)
+        return ESP_OK;
+      memcpy(*out, *in, length);
+      *out += length;
+      *in += length;
+      *inSize -= length;
+      *outSize -= length;
+      control.extraLength -= length;
+      written += length;
+      if (control.extraLength == 0)
+        nextRecord();
+      break;
+    }
+    case Stage::Done:
+      // Nothing follows the last record
+      *in += *inSize;
+      *inSize = 0;
+      return ESP_OK;
+    }
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// "ZBDP" in front of a delta patch
+#define OTA_PATCH_MAGIC 0x5044425a
+// Base image bytes read from flash at once
+#define OTA_PATCH_READ_SIZE 512
+
+struct ota_patch_header_t {
+  uint32_t magic;
+  uint32_t baseSize;   // Bytes of the running image the patch is for
+  uint32_t baseCrc;    // CRC-32 of those bytes
+  uint32_t targetSize; // Bytes of the new image
+};
+
+// Starts each record of the patch
+struct ota_patch_control_t {
+  uint32_t diffLength;
+  uint32_t extraLength;
+  int32_t seek;
+};
+
+/// @brief Applies a bsdiff style delta patch against the running image as
+/// a stream. After the header come records of a control block, diffLength
+/// bytes added to the base and extraLength new bytes. The base position
+/// then moves by seek.
+class OtaPatch {
+public:
+  /// @param base partition the patch was made against
+  void begin(const esp_partition_t *base);
+  /// @brief Turns patch bytes into image bytes, until the input is consumed
+  /// or the output is full. Checks the base once the header is complete.
+  /// @return ESP_ERR_INVALID_VERSION if the patch is for another image,
+  /// ESP_ERR_INVALID_RESPONSE if it is corrupt
+  esp_err_t apply(const uint8_t **in, size_t *inSize, uint8_t **out,
+                  size_t *outSize);
+  /// @brief Whether the whole new image was produced
+  bool complete() const;
+
+private:
+  enum class Stage : uint8_t { Header, Control, Diff, Extra, Done };
+
+  /// @return false until size bytes of a header or control block arrived
+  bool collect(const uint8_t **in, size_t *inSize, size_t size);
+  esp_err_t checkBase();
+  esp_err_t readBase(uint32_t offset, uint8_t *value);
+  void nextRecord();
+
+  const esp_partition_t *base = nullptr;
+  Stage stage = Stage::Header;
+  uint8_t field[sizeof(ota_patch_header_t)];
+  uint8_t fieldLength = 0;
+  ota_patch_header_t header = {};
+  ota_patch_control_t control = {};
+  int64_t basePosition = 0;
+  uint32_t written = 0;
+
+  uint8_t cache[OTA_PATCH_READ_SIZE];
+  uint32_t cacheOffset = 0;
+  uint32_t cacheLength = 0;
+};
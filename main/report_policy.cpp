@@ -0,0 +1,127 @@
+#include "report_policy.hpp"
+#include "custom_cluster.hpp"
+#include "esp_log.h"
+#include "esp_zb_thermostat.hpp"
+#include "storage.hpp"
+#include "zcl/esp_zigbee_zcl_common.h"
+#include "zcl/esp_zigbee_zcl_thermostat.h"
+#include <string.h>
+
+static const char *TAG = "REPORT_POLICY";
+
+// State changes are reported right away, the measured temperature and the
+// runtime only once they moved enough
+static const report_policy_entry_t DEFAULT_POLICY[] = {
+    {ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT,
+     ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, 30, 900, 20},
+    {ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
+     ESP_ZB_ZCL_ATTR_THERMOSTAT_RUNNING_MODE_ID, 0, 3600, 0},
+    {ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT, ESP_ZB_ZCL_ATTR_THERMOSTAT_SYSTEM_MODE_ID,
+     0, 3600, 0},
+    {ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT,
+     ESP_ZB_ZCL_ATTR_THERMOSTAT_SETPOINT_CHANGE_SOURCE_ID, 0, 3600, 0},
+    {ESP_ZB_ZCL_CLUSTER_ID_CUSTOM, ESP_ZB_ZCL_ATTR_CUSTOM_RUNTIME_SECONDS_ID, 60,
+     3600, 300},
+    {ESP_ZB_ZCL_CLUSTER_ID_CUSTOM, ESP_ZB_ZCL_ATTR_CUSTOM_TEMPERATURE_SOURCE_ID,
+     0, 3600, 0},
+    {ESP_ZB_ZCL_CLUSTER_ID_CUSTOM, ESP_ZB_ZCL_ATTR_CUSTOM_CURRENT_SCHEDULE_ID, 0,
+     3600, 0},
+    {ESP_ZB_ZCL_CLUSTER_ID_CUSTOM, ESP_ZB_ZCL_ATTR_CUSTOM_NEXT_TRANSITION_ID, 0,
+     3600, 0},
+};
+
+ReportPolicy *ReportPolicy::_instance = nullptr;
+
+ReportPolicy *ReportPolicy::GetInstance() {
+  if (_instance == nullptr) {
+    _instance = new ReportPolicy();
+  }
+  return _instance;
+}
+
+void ReportPolicy::init() {
+  if (initialized)
+    return;
+  static_assert(sizeof(DEFAULT_POLICY) / sizeof(*DEFAULT_POLICY) <=
+                REPORT_POLICY_MAX_ENTRIES);
+  count = sizeof(DEFAULT_POLICY) / sizeof(*DEFAULT_POLICY);
+  memcpy(entries, DEFAULT_POLICY, sizeof(DEFAULT_POLICY));
+
+  // Only attributes of the default table can be overridden
+  report_policy_entry_t stored[REPORT_POLICY_MAX_ENTRIES];
+  size_t length = sizeof(stored);
+  if (Storage::GetInstance()->readValue<void>(REPORT_POLICY_KEY, stored,
+                                              &length) == ESP_OK) {
+    for (size_t i = 0; i < length / sizeof(report_policy_entry_t); i++) {
+      auto entry = findEntry(stored[i].clusterId, stored[i].attrId);
+      if (entry != nullptr)
+        *entry = stored[i];
+    }
+  }
+  initialized = true;
+}
+
+report_policy_entry_t *ReportPolicy::findEntry(uint16_t clusterId,
+                                               uint16_t attrId) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (entries[i].clusterId == clusterId && entries[i].attrId == attrId)
+      return &entries[i];
+  }
+  return nullptr;
+}
+
+void ReportPolicy::apply() {
+  for (uint8_t i = 0; i < count; i++)
+    applyEntry(entries[i]);
+}
+
+void ReportPolicy::applyEntry(const report_policy_entry_t &entry) {
+  esp_zb_zcl_reporting_info_t reporting_info = {
+      .direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV,
+      .ep = HA_THERMOSTAT_ENDPOINT,
+      .cluster_id = entry.clusterId,
+      .cluster_role = ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+      .attr_id = entry.attrId,
+      .flags = 0,
+      .run_time = 0,
+      .u{
+          .send_info = {.min_interval = entry.minInterval,
+                        .max_interval = entry.maxInterval,
+                        .delta = {.u32 = entry.reportableChange},
+                        .reported_value = {},
+                        .def_min_interval = entry.minInterval,
+                        .def_max_interval = entry.maxInterval},
+      },
+      .dst{
+          .short_addr = 0,
+          .endpoint = 0,
+          .profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+      },
+
+      .manuf_code = ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC,
+  };
+  auto res = esp_zb_zcl_update_reporting_info(&reporting_info);
+  if (res != ESP_OK) {
+    ESP_LOGW(TAG, "Reporting of attribute %x in cluster %x not applied: %x",
+             entry.attrId, entry.clusterId, res);
+  }
+}
+
+esp_err_t ReportPolicy::update(const report_policy_entry_t &update) {
+  auto entry = findEntry(update.clusterId, update.attrId);
+  if (entry == nullptr)
+    return ESP_ERR_NOT_FOUND;
+  if (update.minInterval > update.maxInterval)
+    return ESP_ERR_INVALID_ARG;
+
+  *entry = update;
+  ESP_LOGI(TAG, "Reporting attribute %x in cluster %x every %d-%ds, delta %ld",
+           entry->attrId, entry->clusterId, entry->minInterval,
+           entry->maxInterval, entry->reportableChange);
+  // Called from the worker task, outside of the stack
+  esp_zb_lock_acquire(portMAX_DELAY);
+  applyEntry(*entry);
+  esp_zb_lock_release();
+  return Storage::GetInstance()->writeValue<void>(
+      REPORT_POLICY_KEY, entries, count * sizeof(report_policy_entry_t));
+}
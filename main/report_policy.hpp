@@ -0,0 +1,47 @@
+#pragma once
+
+#include "esp_zigbee_core.h"
+#include <stdint.h>
+
+#define REPORT_POLICY_KEY "reportPolicy"
+#define REPORT_POLICY_MAX_ENTRIES 8
+
+/// Payload of SET_REPORT_POLICY_COMMAND_ID and the persisted table entry
+struct ESP_ZB_PACKED_STRUCT report_policy_entry_t {
+  uint16_t clusterId;
+  uint16_t attrId;
+  uint16_t minInterval; // Seconds between two reports at least
+  uint16_t maxInterval; // Seconds after which a report is sent regardless
+  uint32_t reportableChange; // In attribute units, 0 reports every change
+};
+
+/// @brief Reporting configuration of the attributes sent to the coordinator,
+/// starting with built-in defaults that can be adjusted at runtime
+class ReportPolicy {
+
+public:
+  static ReportPolicy *GetInstance();
+
+  ReportPolicy(ReportPolicy &other) = delete;
+  void operator=(const ReportPolicy &) = delete;
+
+  void init();
+  /// @brief Hands the table to the stack, must be called with the Zigbee lock
+  /// held or from the Zigbee task
+  void apply();
+  /// @brief Replaces the entry for the same attribute, persists and applies it.
+  /// Takes the Zigbee lock, so it must not be called from the Zigbee task
+  esp_err_t update(const report_policy_entry_t &entry);
+
+protected:
+  static ReportPolicy *_instance;
+  ReportPolicy() {}
+
+private:
+  report_policy_entry_t *findEntry(uint16_t clusterId, uint16_t attrId);
+  static void applyEntry(const report_policy_entry_t &entry);
+
+  bool initialized = false;
+  report_policy_entry_t entries[REPORT_POLICY_MAX_ENTRIES];
+  uint8_t count = 0;
+};
@@ -0,0 +1,89 @@
+#include "schedule_index.hpp"
+#include <algorithm>
+
+static bool compareWeekMinute(const ScheduleTransition &a,
+                              const ScheduleTransition &b) {
+  return a.weekMinute < b.weekMinute;
+}
+
+bool ScheduleIndex::add(const ScheduleTransition &transition) {
+  auto position = std::upper_bound(transitions.begin(), transitions.end(),
+                                   transition, compareWeekMinute);
+  return transitions.insert(position, transition);
+}
+
+const ScheduleTransition *ScheduleIndex::activeAt(uint16_t weekMinute) const {
+  if (transitions.empty())
+    return nullptr;
+
+  auto it = std::upper_bound(transitions.begin(), transitions.end(),
+                             ScheduleTransition{.weekMinute = weekMinute},
+                             compareWeekMinute);
+  if (it == transitions.begin())
+    return &transitions.back();
+  return &*(it - 1);
+}
+
+const ScheduleTransition *ScheduleIndex::nextAfter(uint16_t weekMinute) const {
+  if (transitions.empty())
+    return nullptr;
+
+  auto it = std::upper_bound(transitions.begin(), transitions.end(),
+                             ScheduleTransition{.weekMinute = weekMinute},
+                             compareWeekMinute);
+  if (it == transitions.end())
+    return &transitions.front();
+  return &*it;
+}
+
+ScheduleIndex &ScheduleSnapshots::prepare() {
+  // At most the current and one retired snapshot are taken between publishes
+  auto latest = current.load();
+  for (auto &&slot : slots) {
+    if (&slot == latest || &slot == retired[0] || &slot == retired[1])
+      continue;
+    prepared = &slot;
+    break;
+  }
+  prepared->index.clear();
+  return prepared->index;
+}
+
+uint32_t ScheduleSnapshots::publish() {
+  auto next = prepared;
+  prepared = nullptr;
+  next->version = ++version;
+  auto previous = current.exchange(next);
+  for (auto &&slot : retired) {
+    if (slot == nullptr) {
+      slot = previous;
+      break;
+    }
+  }
+  reclaim();
+  return next->version;
+}
+
+void ScheduleSnapshots::reclaim() {
+  // Sequentially consistent with the store in acquire(), so a reader that
+  // still announces an old snapshot is always seen here
+  auto inUse = hazard.load();
+  for (auto &&slot : retired) {
+    if (slot != inUse)
+      slot = nullptr;
+  }
+}
+
+const ScheduleSnapshot *ScheduleSnapshots::acquire() {
+  auto snapshot = current.load();
+  for (;;) {
+    hazard.store(snapshot);
+    // The writer may have retired it before the announcement was visible
+    auto latest = current.load();
+    if (latest == snapshot)
+      return snapshot;
+    snapshot = latest;
+  }
+}
+
+void ScheduleSnapshots::release() { hazard.store(nullptr); }
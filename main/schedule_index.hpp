@@ -0,0 +1,94 @@
+#pragma once
+
+#include "inplace_vector.hpp"
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MINUTES_PER_DAY 1440
+#define MINUTES_PER_WEEK (7 * MINUTES_PER_DAY)
+// Transitions over all weekdays that fit into one index
+#define SCHEDULE_INDEX_MAX_TRANSITIONS (7 * 48)
+// Current, held by the reader and the one being prepared
+#define SCHEDULE_SNAPSHOT_SLOTS 3
+
+struct ScheduleTransition {
+  uint16_t weekMinute; // Minutes since Sunday 00:00
+  int16_t temp;
+};
+
+/// @brief Sorted lookup table of all weekly transitions.
+/// Built once whenever the schedule changes, so the control loop only does
+/// binary searches and never touches the heap.
+class ScheduleIndex {
+public:
+  ScheduleIndex() = default;
+
+  /// @brief Inserts in order, after transitions at the same minute, so the
+  /// one added last wins
+  /// @return false if the index is full
+  bool add(const ScheduleTransition &transition);
+  void clear() { transitions.clear(); }
+
+  /// @brief Transition that is active at the given minute of the week,
+  /// wrapping around to the last transition of the previous week
+  /// @return nullptr if the schedule is empty
+  const ScheduleTransition *activeAt(uint16_t weekMinute) const;
+  /// @brief First transition strictly after the given minute of the week,
+  /// wrapping around to the first transition of the next week
+  /// @return nullptr if the schedule is empty
+  const ScheduleTransition *nextAfter(uint16_t weekMinute) const;
+
+  bool empty() const { return transitions.empty(); }
+  size_t size() const { return transitions.size(); }
+
+  static uint16_t toWeekMinute(uint8_t dayOfWeek, uint16_t minuteOfDay) {
+    return (uint16_t)(dayOfWeek * MINUTES_PER_DAY + minuteOfDay);
+  }
+  /// @brief Minutes that passed from `from` until `to`, wrapping at the end
+  /// of the week
+  static uint16_t minutesBetween(uint16_t from, uint16_t to) {
+    return (uint16_t)((to + MINUTES_PER_WEEK - from) % MINUTES_PER_WEEK);
+  }
+
+private:
+  InplaceVector<ScheduleTransition, SCHEDULE_INDEX_MAX_TRANSITIONS> transitions;
+};
+
+struct ScheduleSnapshot {
+  uint32_t version; // Increases with every publish
+  ScheduleIndex index;
+};
+
+/// @brief Hands immutable schedule snapshots from one writer task to one
+/// reader task. The writer builds a snapshot off to the side and swaps it in
+/// with a single atomic exchange, the reader never takes a lock. Replaced
+/// snapshots go back to a fixed pool once the reader no longer holds them.
+class ScheduleSnapshots {
+public:
+  ScheduleSnapshots() = default;
+  ScheduleSnapshots(const ScheduleSnapshots &) = delete;
+  void operator=(const ScheduleSnapshots &) = delete;
+
+  /// @brief Writer side, an empty index that is not visible to the reader
+  /// until publish()
+  ScheduleIndex &prepare();
+  /// @brief Writer side, replaces the current snapshot with the prepared one
+  /// @return version of the new snapshot
+  uint32_t publish();
+  /// @brief Reader side, the snapshot stays valid until release()
+  const ScheduleSnapshot *acquire();
+  void release();
+
+private:
+  void reclaim();
+
+  std::atomic<ScheduleSnapshot *> current{nullptr};
+  // Announced by the reader before it dereferences a snapshot
+  std::atomic<ScheduleSnapshot *> hazard{nullptr};
+  // Only the reader's snapshot can survive a reclaim, so two slots suffice
+  ScheduleSnapshot *retired[2] = {};
+  ScheduleSnapshot *prepared = nullptr;
+  ScheduleSnapshot slots[SCHEDULE_SNAPSHOT_SLOTS];
+  uint32_t version = 0;
+};
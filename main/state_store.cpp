@@ -0,0 +1,204 @@
+#include "state_store.hpp"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "STATE";
+
+// Single value keys written by firmware versions before the snapshot
+static const char *LEGACY_KEYS[] = {
+    "heat_runtime",   "heat_mode",      "heat_start",     "heater_mnlTemp",
+    "heater_mnlTime", "heater_rmtTemp", "heater_rmtTime", "timeZone",
+    "clock",          "schedule_0",     "schedule_1",     "schedule_2",
+    "schedule_3",     "schedule_4",     "schedule_5",     "schedule_6",
+    "schedule_7"};
+
+StateStore *StateStore::_instance = nullptr;
+
+StateStore *StateStore::GetInstance() {
+  if (_instance == nullptr) {
+    _instance = new StateStore();
+  }
+  return _instance;
+}
+
+void StateStore::init() {
+  if (initialized)
+    return;
+  storage = Storage::GetInstance();
+  lock = xSemaphoreCreateMutex();
+
+  if (!loadSnapshot() && !newerSnapshot) {
+    migrateLegacyKeys();
+    // Only drop the old keys once the snapshot is safely on flash
+    if (save(true) == ESP_OK) {
+      for (auto &&key : LEGACY_KEYS)
+        storage->eraseValue(key);
+    }
+  }
+  initialized = true;
+}
+
+bool StateStore::loadSnapshot() {
+  size_t length = sizeof(buffer);
+  auto res = storage->readValue<void>(STATE_STORE_KEY, buffer, &length);
+  if (res == ESP_ERR_NVS_INVALID_LENGTH) {
+    ESP_LOGW(TAG, "State snapshot is too large, from newer firmware?");
+    newerSnapshot = true;
+    return false;
+  }
+  if (res != ESP_OK) {
+    ESP_LOGI(TAG, "No state snapshot found: %x", res);
+    return false;
+  }
+
+  // The version comes first in every header, newer ones may change the rest
+  if (length > 0 && buffer[0] > STATE_STORE_VERSION) {
+    // Running with defaults beats losing the state after a rollback
+    ESP_LOGW(TAG, "State snapshot v%d is from newer firmware, not saving",
+             buffer[0]);
+    newerSnapshot = true;
+    return false;
+  }
+  persistent_state_header_t header = {};
+  size_t headerBytes = sizeof(header);
+  if (length > 0 && buffer[0] < 3)
+    headerBytes = STATE_STORE_V2_HEADER_BYTES;
+  if (length < headerBytes)
+    return false;
+  memcpy(&header, buffer, headerBytes);
+  if (header.version < 3)
+    header.stateLength = STATE_STORE_V2_STATE_BYTES;
+  auto payload = buffer + headerBytes;
+  if (header.length != length - headerBytes ||
+      esp_rom_crc32_le(0, payload, header.length) != header.crc) {
+    ESP_LOGE(TAG, "State snapshot is corrupted");
+    return false;
+  }
+
+  switch (header.version) {
+  case 1:
+  case 2:
+  case 3:
+    break;
+  default:
+    ESP_LOGE(TAG, "Unsupported state snapshot version %d", header.version);
+    return false;
+  }
+  if (header.stateLength > header.length)
+    return false;
+  // Fields appended since the snapshot was written keep their defaults,
+  // ones appended by newer firmware are dropped
+  persistent_state_t stored = {};
+  memcpy(&stored, payload,
+         std::min<size_t>(header.stateLength, sizeof(stored)));
+
+  size_t scheduleBytes =
+      stored.scheduleLength * sizeof(persistent_schedule_entry_t);
+  if (header.stateLength + scheduleBytes != header.length)
+    return false;
+  state = stored;
+  auto entries =
+      (const persistent_schedule_entry_t *)(payload + header.stateLength);
+  if (header.version == 1) {
+    // Version 1 had one entry per day, with the DayOfWeekW in place of the mask
+    for (size_t i = 0; i < state.scheduleLength; i++)
+      addScheduleTransition(1 << entries[i].dayMask, entries[i].transition_time,
+                            entries[i].tempSetPoint);
+  } else {
+    // The snapshot can not hold more entries than fit into the schedule
+    schedule.assign(entries, entries + state.scheduleLength);
+  }
+
+  ESP_LOGI(TAG, "Loaded state snapshot v%d with %d schedule entries",
+           header.version, schedule.size());
+  return true;
+}
+
+void StateStore::migrateLegacyKeys() {
+  ESP_LOGI(TAG, "Migrating the single value keys into a state snapshot");
+
+  storage->readValue("heat_runtime", &state.runtimeSeconds);
+  storage->readValue("heat_mode", &state.systemMode);
+  storage->readValue("heat_start", &state.heatStart);
+  if (storage->readValue("heater_mnlTemp", &state.manualTemp) == ESP_OK)
+    storage->readValue("heater_mnlTime", &state.manualTime);
+  if (storage->readValue("heater_rmtTemp", &state.remoteTemp) == ESP_OK)
+    storage->readValue("heater_rmtTime", &state.remoteTime);
+  storage->readValue("timeZone", &state.timeZoneOffset);
+  storage->readValue("clock", &state.lastTimeSync);
+
+  for (size_t i = 0; i < 8; i++) {
+    char msg[12];
+    sprintf(msg, "schedule_%x", (uint8_t)i);
+    esp_zb_weekly_schedule_single_s transitions[STATE_STORE_MAX_SCHEDULE_ENTRIES];
+    size_t len = sizeof(transitions);
+    if (storage->readValue<void>(msg, transitions, &len) != ESP_OK)
+      continue;
+    for (size_t o = 0; o < len / sizeof(esp_zb_weekly_schedule_single_s);
+         o++) {
+      addScheduleTransition(1 << i, transitions[o].transition_time,
+                            transitions[o].tempSetPoint);
+    }
+  }
+}
+
+esp_err_t StateStore::save(bool durable) {
+  if (newerSnapshot)
+    return ESP_ERR_INVALID_VERSION;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  state.scheduleLength = schedule.size();
+
+  size_t scheduleBytes = schedule.size() * sizeof(persistent_schedule_entry_t);
+  persistent_state_header_t header = {
+      .version = STATE_STORE_VERSION,
+      .length = (uint16_t)(sizeof(state) + scheduleBytes),
+      .crc = 0,
+      .stateLength = sizeof(state)};
+  auto payload = buffer + sizeof(header);
+  memcpy(payload, &state, sizeof(state));
+  memcpy(payload + sizeof(state), schedule.data(), scheduleBytes);
+  header.crc = esp_rom_crc32_le(0, payload, header.length);
+  memcpy(buffer, &header, sizeof(header));
+  // Storage copies the value into its cache
+  auto res = storage->writeValue<void>(STATE_STORE_KEY, (const void *)buffer,
+                                       sizeof(header) + header.length);
+  xSemaphoreGive(lock);
+
+  if (res == ESP_OK && durable)
+    res = storage->flush();
+  return res;
+}
+
+void StateStore::clearScheduleDays(uint8_t dayMask) {
+  // save() may copy the schedule from another task meanwhile
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (auto &&entry : schedule)
+    entry.dayMask &= ~dayMask;
+  schedule.erase(std::remove_if(schedule.begin(), schedule.end(),
+                                [](const persistent_schedule_entry_t &entry) {
+                                  return entry.dayMask == 0;
+                                }),
+                 schedule.end());
+  xSemaphoreGive(lock);
+}
+
+void StateStore::addScheduleTransition(uint8_t dayMask, uint16_t transitionTime,
+                                       int16_t tempSetPoint) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  auto entry = std::find_if(schedule.begin(), schedule.end(),
+                            [&](const persistent_schedule_entry_t &entry) {
+                              return entry.transition_time == transitionTime &&
+                                     entry.tempSetPoint == tempSetPoint;
+                            });
+  if (entry != schedule.end())
+    entry->dayMask |= dayMask;
+  else if (!schedule.push_back({.dayMask = dayMask,
+                                .transition_time = transitionTime,
+                                .tempSetPoint = tempSetPoint}))
+    ESP_LOGW(TAG, "Only keeping %d schedule entries",
+             STATE_STORE_MAX_SCHEDULE_ENTRIES);
+  xSemaphoreGive(lock);
+}
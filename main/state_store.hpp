@@ -0,0 +1,105 @@
+#pragma once
+
+#include "custom_zigbee_types/schedule.hpp"
+#include "esp_zigbee_core.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "inplace_vector.hpp"
+#include "storage.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATE_STORE_KEY "state"
+#define STATE_STORE_VERSION 3
+// Upper bound for the blob, so it can be read with a single nvs_get_blob
+#define STATE_STORE_MAX_SCHEDULE_ENTRIES 160
+
+struct ESP_ZB_PACKED_STRUCT persistent_state_header_t {
+  uint8_t version;
+  uint16_t length; // Bytes following the header
+  uint32_t crc;    // CRC32 of the bytes following the header
+  // Bytes of persistent_state_t in front of the schedule, since version 3
+  uint16_t stateLength;
+};
+// Versions 1 and 2 ended the header before stateLength
+#define STATE_STORE_V2_HEADER_BYTES                                            \
+  offsetof(persistent_state_header_t, stateLength)
+// and always stored the state below with these bytes
+#define STATE_STORE_V2_STATE_BYTES 40
+
+// Stored as-is, new fields may only be appended. Snapshots with fewer
+// bytes keep the defaults for the missing ones.
+struct persistent_state_t {
+  int64_t heatStart;
+  uint32_t runtimeSeconds;
+  uint32_t manualTime;
+  uint32_t remoteTime;
+  uint32_t lastTimeSync;
+  int32_t timeZoneOffset;
+  int16_t manualTemp;
+  int16_t remoteTemp;
+  uint16_t scheduleLength; // Number of persistent_schedule_entry_t following
+  uint8_t systemMode;
+};
+
+// Each transition is kept once for all days it applies to, like on the wire
+struct ESP_ZB_PACKED_STRUCT persistent_schedule_entry_t {
+  uint8_t dayMask; // esp_zb_day_of_week_t bits
+  uint16_t transition_time;
+  int16_t tempSetPoint;
+};
+
+#define STATE_STORE_MAX_BYTES                                                  \
+  (sizeof(persistent_state_header_t) + sizeof(persistent_state_t) +           \
+   STATE_STORE_MAX_SCHEDULE_ENTRIES * sizeof(persistent_schedule_entry_t))
+static_assert(sizeof(persistent_state_t) >= STATE_STORE_V2_STATE_BYTES,
+              "Fields of the state may only be appended");
+static_assert(STATE_STORE_MAX_BYTES <= STORAGE_DATA_BYTES,
+              "The snapshot is written back through the storage cache");
+
+/// @brief All persistent device state in one versioned, CRC protected blob,
+/// so booting needs a single NVS read instead of one per value
+class StateStore {
+
+public:
+  static StateStore *GetInstance();
+
+  StateStore(StateStore &other) = delete;
+  void operator=(const StateStore &) = delete;
+
+  void init();
+  /// @brief Serializes the state into the cache of Storage
+  /// @param durable commit to flash right away instead of with the next flush
+  /// @return ESP_ERR_INVALID_VERSION while a snapshot of newer firmware is
+  /// kept on flash
+  esp_err_t save(bool durable = false);
+  /// @brief Removes the given days from all schedule entries, dropping
+  /// entries that are left without a day
+  void clearScheduleDays(uint8_t dayMask);
+  /// @brief Adds the transition to the schedule, merging it into an entry
+  /// with the same time and temperature if there is one. Transitions beyond
+  /// STATE_STORE_MAX_SCHEDULE_ENTRIES are dropped.
+  void addScheduleTransition(uint8_t dayMask, uint16_t transitionTime,
+                             int16_t tempSetPoint);
+
+  persistent_state_t state = {};
+  /// Only changed through the methods above, from a single task
+  InplaceVector<persistent_schedule_entry_t, STATE_STORE_MAX_SCHEDULE_ENTRIES>
+      schedule;
+
+protected:
+  static StateStore *_instance;
+  StateStore() {}
+
+private:
+  bool loadSnapshot();
+  void migrateLegacyKeys();
+
+  bool initialized = false;
+  // A newer firmware wrote the snapshot, it stays untouched for a roll forward
+  bool newerSnapshot = false;
+  Storage *storage;
+  SemaphoreHandle_t lock;
+  // Serialized snapshot, only used under the lock
+  uint8_t buffer[STATE_STORE_MAX_BYTES];
+};
@@ -1,8 +1,16 @@
 #include "storage.hpp"
+#include "esp_log.h"
+#include "executor.hpp"
+#include <string.h>
 
 Storage *Storage::_instance = nullptr;
 
 static const char *NAMESPACE = "SUSCH";
+static const char *TAG = "STORAGE";
+
+// Keys that must survive a power loss right after they were written, the
+// state snapshot asks for a flush itself when it holds critical changes
+static const char *CRITICAL_KEYS[] = {"restartCounter"};
 
 Storage *Storage::GetInstance() {
   if (_instance == nullptr) {
@@ -11,6 +19,22 @@ Storage *Storage::GetInstance() {
   return _instance;
 }
 
+Storage::Storage() {
+  cacheLock = xSemaphoreCreateMutex();
+  flushLock = xSemaphoreCreateMutex();
+  flushJobId = Executor::GetInstance()->add("storage_flush", flushJob, this,
+                                            EXECUTOR_IDLE);
+
+  const esp_timer_create_args_t timer = {
+      .callback = flushTimerCallback,
+      .arg = this,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "storage_flush",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer, &flushTimer));
+  setFlushInterval(flushIntervalSeconds);
+}
+
 esp_err_t Storage::getReadHandle(nvs_handle_t *out_handle) {
   return nvs_open(NAMESPACE, NVS_READONLY, out_handle);
 }
@@ -19,3 +43,326 @@ esp_err_t Storage::getWriteHandle(nvs_handle_t *out_handle) {
 
 }
 
+bool Storage::isCritical(const char *key) {
+  for (auto &&critical : CRITICAL_KEYS) {
+    if (strcmp(critical, key) == 0)
+      return true;
+  }
+  return false;
+}
+
+Storage::Entry *Storage::findEntry(const char *key) {
+  for (auto &&entry : entries) {
+    if (strncmp(entry.key, key, sizeof(entry.key)) == 0)
+      return &entry;
+  }
+  return nullptr;
+}
+
+bool Storage::storeData(Entry *entry, const void *value, size_t length) {
+  if (entry->length == length) {
+    memcpy(data + entry->offset, value, length);
+    return true;
+  }
+  releaseData(entry);
+  if (length > sizeof(data) - dataUsed)
+    return false;
+  entry->offset = dataUsed;
+  entry->length = length;
+  memcpy(data + entry->offset, value, length);
+  dataUsed += length;
+  return true;
+}
+
+void Storage::releaseData(Entry *entry) {
+  if (entry->length == 0)
+    return;
+  // Keeps the data packed, only happens when a value changes its size
+  size_t end = entry->offset + entry->length;
+  memmove(data + entry->offset, data + end, dataUsed - end);
+  for (auto &&other : entries) {
+    if (other.length > 0 && other.offset > entry->offset)
+      other.offset -= entry->length;
+  }
+  dataUsed -= entry->length;
+  entry->length = 0;
+}
+
+esp_err_t Storage::writeUncached(const Entry &entry, const void *value) {
+  xSemaphoreTake(flushLock, portMAX_DELAY);
+  nvs_handle_t handle;
+  auto res = getWriteHandle(&handle);
+  if (res == ESP_OK) {
+    res = writeToNvs(handle, entry, (const uint8_t *)value);
+    if (res == ESP_OK)
+      res = nvs_commit(handle);
+    nvs_close(handle);
+  }
+  xSemaphoreGive(flushLock);
+  return res;
+}
+
+esp_err_t Storage::readEntry(const char *key, StorageType type,
+                             void *out_value, size_t *length) {
+  if (type == StorageType::Unknown)
+    return ESP_FAIL;
+
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  auto entry = findEntry(key);
+  if (entry != nullptr && entry->type == type) {
+    esp_err_t res = ESP_OK;
+    if (type == StorageType::Str || type == StorageType::Blob) {
+      if (out_value != NULL && *length < entry->length)
+        res = ESP_ERR_NVS_INVALID_LENGTH;
+      else if (out_value != NULL)
+        memcpy(out_value, data + entry->offset, entry->length);
+      *length = entry->length;
+    } else {
+      memcpy(out_value, &entry->value, *length);
+    }
+    xSemaphoreGive(cacheLock);
+    return res;
+  }
+  xSemaphoreGive(cacheLock);
+
+  nvs_handle_t handle;
+  auto res = getReadHandle(&handle);
+  if (res != ESP_OK)
+    return res;
+  res = readFromNvs(handle, key, type, out_value, length);
+  nvs_close(handle);
+
+  // Length queries carry no value that could be cached
+  if (res != ESP_OK || out_value == NULL)
+    return res;
+
+  // Not cached if there is no room, the next read goes to flash again
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  if (findEntry(key) == nullptr && !entries.full()) {
+    Entry cached = {};
+    strncpy(cached.key, key, sizeof(cached.key) - 1);
+    cached.type = type;
+    bool stored = true;
+    if (type == StorageType::Str || type == StorageType::Blob)
+      stored = storeData(&cached, out_value, *length);
+    else
+      memcpy(&cached.value, out_value, *length);
+    if (stored)
+      entries.push_back(cached);
+  }
+  xSemaphoreGive(cacheLock);
+  return res;
+}
+
+esp_err_t Storage::writeEntry(const char *key, StorageType type,
+                              const void *value, size_t length) {
+  if (type == StorageType::Unknown)
+    return ESP_FAIL;
+  if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+    return ESP_ERR_INVALID_ARG;
+  if (type == StorageType::Str)
+    length = strlen((const char *)value) + 1;
+
+  bool isData = type == StorageType::Str || type == StorageType::Blob;
+  uint64_t scalar = 0;
+  if (!isData)
+    memcpy(&scalar, value, length);
+
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  auto entry = findEntry(key);
+  if (entry != nullptr && entry->type == type) {
+    bool unchanged =
+        isData ? entry->length == length &&
+                     memcmp(data + entry->offset, value, length) == 0
+               : entry->value == scalar;
+    if (unchanged) {
+      xSemaphoreGive(cacheLock);
+      return ESP_OK;
+    }
+  }
+  Entry uncached = {};
+  if (entry == nullptr && entries.push_back(uncached)) {
+    entry = &entries.back();
+    strncpy(entry->key, key, sizeof(entry->key) - 1);
+  }
+  if (entry != nullptr) {
+    entry->type = type;
+    entry->dirty = true;
+    entry->value = scalar;
+    if (!isData)
+      releaseData(entry);
+    else if (!storeData(entry, value, length)) {
+      // The stale cached value must not be flushed over the new one
+      entries.erase(entry);
+      entry = nullptr;
+    }
+  }
+  bool writeThrough = flushIntervalSeconds == 0 || isCritical(key);
+  xSemaphoreGive(cacheLock);
+
+  if (entry == nullptr) {
+    ESP_LOGW(TAG, "No room to cache %s, writing through", key);
+    strncpy(uncached.key, key, sizeof(uncached.key) - 1);
+    uncached.type = type;
+    uncached.value = scalar;
+    uncached.length = length;
+    return writeUncached(uncached, value);
+  }
+
+  if (writeThrough)
+    return flush();
+  return ESP_OK;
+}
+
+esp_err_t Storage::flush() {
+  xSemaphoreTake(flushLock, portMAX_DELAY);
+
+  // Copy the dirty values, so writers are not blocked by the flash commit
+  dirty.clear();
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  for (auto &&entry : entries) {
+    if (!entry.dirty)
+      continue;
+    dirty.push_back(entry);
+    entry.dirty = false;
+  }
+  if (!dirty.empty())
+    memcpy(dirtyData, data, dataUsed);
+  xSemaphoreGive(cacheLock);
+
+  if (dirty.empty()) {
+    xSemaphoreGive(flushLock);
+    return ESP_OK;
+  }
+
+  nvs_handle_t handle;
+  auto res = getWriteHandle(&handle);
+  if (res == ESP_OK) {
+    for (auto &&entry : dirty) {
+      res = writeToNvs(handle, entry, dirtyData);
+      if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Writing %s failed: %x", entry.key, res);
+        break;
+      }
+    }
+    if (res == ESP_OK)
+      res = nvs_commit(handle);
+    nvs_close(handle);
+  }
+
+  if (res != ESP_OK) {
+    // Retry with the next flush, unless the value changed in the meantime
+    xSemaphoreTake(cacheLock, portMAX_DELAY);
+    for (auto &&failed : dirty) {
+      auto entry = findEntry(failed.key);
+      if (entry != nullptr)
+        entry->dirty = true;
+    }
+    xSemaphoreGive(cacheLock);
+  } else {
+    ESP_LOGD(TAG, "Committed %d values", dirty.size());
+  }
+
+  xSemaphoreGive(flushLock);
+  return res;
+}
+
+esp_err_t Storage::eraseValue(const char *key) {
+  xSemaphoreTake(flushLock, portMAX_DELAY);
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  auto entry = findEntry(key);
+  if (entry != nullptr) {
+    releaseData(entry);
+    entries.erase(entry);
+  }
+  xSemaphoreGive(cacheLock);
+
+  nvs_handle_t handle;
+  auto res = getWriteHandle(&handle);
+  if (res == ESP_OK) {
+    res = nvs_erase_key(handle, key);
+    if (res == ESP_OK)
+      res = nvs_commit(handle);
+    nvs_close(handle);
+  }
+  xSemaphoreGive(flushLock);
+  return res;
+}
+
+void Storage::discard() {
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  entries.clear();
+  dataUsed = 0;
+  xSemaphoreGive(cacheLock);
+}
+
+void Storage::setFlushInterval(uint32_t seconds) {
+  flushIntervalSeconds = seconds;
+  esp_timer_stop(flushTimer);
+  if (seconds > 0)
+    esp_timer_start_periodic(flushTimer, (uint64_t)seconds * 1000 * 1000);
+  else
+    flush();
+}
+
+void Storage::flushTimerCallback(void *arg) {
+  Executor::GetInstance()->wake(((Storage *)arg)->flushJobId);
+}
+
+uint32_t Storage::flushJob(void *context) {
+  ((Storage *)context)->flush();
+  return EXECUTOR_IDLE;
+}
+
+esp_err_t Storage::readFromNvs(nvs_handle_t handle, const char *key,
+                               StorageType type, void *out_value,
+                               size_t *length) {
+  switch (type) {
+  case StorageType::U8:
+    return nvs_get_u8(handle, key, (uint8_t *)out_value);
+  case StorageType::U16:
+    return nvs_get_u16(handle, key, (uint16_t *)out_value);
+  case StorageType::U32:
+    return nvs_get_u32(handle, key, (uint32_t *)out_value);
+  case StorageType::U64:
+    return nvs_get_u64(handle, key, (uint64_t *)out_value);
+  case StorageType::I16:
+    return nvs_get_i16(handle, key, (int16_t *)out_value);
+  case StorageType::I32:
+    return nvs_get_i32(handle, key, (int32_t *)out_value);
+  case StorageType::I64:
+    return nvs_get_i64(handle, key, (int64_t *)out_value);
+  case StorageType::Str:
+    return nvs_get_str(handle, key, (char *)out_value, length);
+  case StorageType::Blob:
+    return nvs_get_blob(handle, key, out_value, length);
+  default:
+    return ESP_FAIL;
+  }
+}
+
+esp_err_t Storage::writeToNvs(nvs_handle_t handle, const Entry &entry,
+                              const uint8_t *data) {
+  switch (entry.type) {
+  case StorageType::U8:
+    return nvs_set_u8(handle, entry.key, (uint8_t)entry.value);
+  case StorageType::U16:
+    return nvs_set_u16(handle, entry.key, (uint16_t)entry.value);
+  case StorageType::U32:
+    return nvs_set_u32(handle, entry.key, (uint32_t)entry.value);
+  case StorageType::U64:
+    return nvs_set_u64(handle, entry.key, (uint64_t)entry.value);
+  case StorageType::I16:
+    return nvs_set_i16(handle, entry.key, (int16_t)entry.value);
+  case StorageType::I32:
+    return nvs_set_i32(handle, entry.key, (int32_t)entry.value);
+  case StorageType::I64:
+    return nvs_set_i64(handle, entry.key, (int64_t)entry.value);
+  case StorageType::Str:
+    return nvs_set_str(handle, entry.key, (const char *)data + entry.offset);
+  case StorageType::Blob:
+    return nvs_set_blob(handle, entry.key, data + entry.offset, entry.length);
+  default:
+    return ESP_FAIL;
+  }
+}
@@ -1,8 +1,37 @@
 #pragma once
 
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "inplace_vector.hpp"
 #include <nvs.h>
+#include <stdint.h>
 #include <type_traits>
 
+// Dirty values are committed at least this often, critical keys immediately
+#define STORAGE_DEFAULT_FLUSH_INTERVAL_SECONDS 300
+// Values held in the cache, more are written through
+#define STORAGE_MAX_ENTRIES 12
+// Strings and blobs of all cached values together
+#define STORAGE_DATA_BYTES 1024
+
+enum class StorageType : uint8_t {
+  Unknown,
+  U8,
+  U16,
+  U32,
+  U64,
+  I16,
+  I32,
+  I64,
+  Str,
+  Blob
+};
+
+/// @brief Write-back cache in front of the NVS namespace.
+/// Writes only update RAM and are committed together by flush(), which runs
+/// periodically as a job of the Executor. Values equal to the cached one are not written again.
+/// The cache has a fixed size, values that do not fit bypass it.
 class Storage {
 
 public:
@@ -12,110 +41,107 @@ public:
   void operator=(const Storage &) = delete;
 
   template <typename T> esp_err_t readValue(const char *key, T *out_value) {
-    nvs_handle_t handle;
-    auto res = getReadHandle(&handle);
-    if (res != ESP_OK)
-      return res;
-
-    if (std::is_same<T, uint8_t>::value) {
-      res = nvs_get_u8(handle, key, (uint8_t *)out_value);
-    } else if (std::is_same<T, uint16_t>::value) {
-      res = nvs_get_u16(handle, key, (uint16_t *)out_value);
-    } else if (std::is_same<T, uint32_t>::value) {
-      res = nvs_get_u32(handle, key, (uint32_t *)out_value);
-    } else if (std::is_same<T, uint64_t>::value) {
-      res = nvs_get_u64(handle, key, (uint64_t *)out_value);
-    } else if (std::is_same<T, int16_t>::value) {
-      res = nvs_get_i16(handle, key, (int16_t *)out_value);
-    } else if (std::is_same<T, int32_t>::value) {
-      res = nvs_get_i32(handle, key, (int32_t *)out_value);
-    } else if (std::is_same<T, int64_t>::value) {
-      res = nvs_get_i64(handle, key, (int64_t *)out_value);
-    } else {
-      res = ESP_FAIL;
-    }
-    nvs_close(handle);
-
-    return res;
+    size_t length = sizeof(T);
+    return readEntry(key, typeOf<T>(), out_value, &length);
   }
 
   template <typename T>
   esp_err_t readValue(const char *key, T *out_value, size_t *length) {
-    nvs_handle_t handle;
-    auto res = getReadHandle(&handle);
-    if (res != ESP_OK)
-      return res;
-
     if (std::is_same<T, char>::value) {
-      res = nvs_get_str(handle, key, (char *)out_value, length);
+      return readEntry(key, StorageType::Str, out_value, length);
     } else if (std::is_same<T, void>::value) {
-      res = nvs_get_blob(handle, key, (void *)out_value, length);
-    } else {
-      res = ESP_FAIL;
+      return readEntry(key, StorageType::Blob, out_value, length);
     }
-    nvs_close(handle);
-
-    return res;
+    return ESP_FAIL;
   }
 
   template <typename T> esp_err_t writeValue(const char *key, T value) {
-    nvs_handle_t handle;
-    auto res = getWriteHandle(&handle);
-    if (res != ESP_OK)
-      return res;
-
-    if (std::is_same<T, uint8_t>::value) {
-      res = nvs_set_u8(handle, key, (uint8_t)value);
-    } else if (std::is_same<T, uint16_t>::value) {
-      res = nvs_set_u16(handle, key, (uint16_t)value);
-    } else if (std::is_same<T, uint32_t>::value) {
-      res = nvs_set_u32(handle, key, (uint32_t)value);
-    } else if (std::is_same<T, uint64_t>::value) {
-      res = nvs_set_u64(handle, key, (uint64_t)value);
-    } else if (std::is_same<T, int16_t>::value) {
-      res = nvs_set_i16(handle, key, (int16_t)value);
-    } else if (std::is_same<T, int32_t>::value) {
-      res = nvs_set_i32(handle, key, (int32_t)value);
-    } else if (std::is_same<T, int64_t>::value) {
-      res = nvs_set_i64(handle, key, (int64_t)value);
-    } else {
-      res = ESP_FAIL;
-    }
-
-    if (res == ESP_OK)
-      res = nvs_commit(handle);
-    nvs_close(handle);
-
-    return res;
+    return writeEntry(key, typeOf<T>(), &value, sizeof(T));
   }
 
   template <typename T>
   esp_err_t writeValue(const char *key, const T *value, size_t length) {
-    nvs_handle_t handle;
-    auto res = getWriteHandle(&handle);
-    if (res != ESP_OK)
-      return res;
-
     if (std::is_same<T, char>::value) {
-      res = nvs_set_str(handle, key, (const char *)value);
+      return writeEntry(key, StorageType::Str, value, length);
     } else if (std::is_same<T, void>::value) {
-      res = nvs_set_blob(handle, key, (const void *)value, length);
-    } else {
-      res = ESP_FAIL;
+      return writeEntry(key, StorageType::Blob, value, length);
     }
-    if (res == ESP_OK)
-      res = nvs_commit(handle);
-
-    nvs_close(handle);
-
-    return res;
+    return ESP_FAIL;
   }
 
+  /// @brief Removes the value from the cache and from flash
+  esp_err_t eraseValue(const char *key);
+  /// @brief Commits all dirty values with a single nvs_commit
+  esp_err_t flush();
+  /// @brief Drops all cached values, needed after the partition was erased
+  void discard();
+  /// @param seconds 0 writes every value through immediately
+  void setFlushInterval(uint32_t seconds);
+
 protected:
   static Storage *_instance;
-  Storage() {}
+  Storage();
 
 private:
+  struct Entry {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    StorageType type;
+    bool dirty;
+    uint64_t value;
+    uint16_t offset; // Into data, strings and blobs only
+    uint16_t length;
+  };
+
+  template <typename T> static constexpr StorageType typeOf() {
+    if (std::is_same<T, uint8_t>::value)
+      return StorageType::U8;
+    if (std::is_same<T, uint16_t>::value)
+      return StorageType::U16;
+    if (std::is_same<T, uint32_t>::value)
+      return StorageType::U32;
+    if (std::is_same<T, uint64_t>::value)
+      return StorageType::U64;
+    if (std::is_same<T, int16_t>::value)
+      return StorageType::I16;
+    if (std::is_same<T, int32_t>::value)
+      return StorageType::I32;
+    if (std::is_same<T, int64_t>::value)
+      return StorageType::I64;
+    return StorageType::Unknown;
+  }
+
+  esp_err_t readEntry(const char *key, StorageType type, void *out_value,
+                      size_t *length);
+  esp_err_t writeEntry(const char *key, StorageType type, const void *value,
+                       size_t length);
+  Entry *findEntry(const char *key);
+  bool storeData(Entry *entry, const void *value, size_t length);
+  void releaseData(Entry *entry);
+  esp_err_t writeUncached(const Entry &entry, const void *value);
+  static bool isCritical(const char *key);
+  static esp_err_t readFromNvs(nvs_handle_t handle, const char *key,
+                               StorageType type, void *out_value,
+                               size_t *length);
+  /// @param data holds the strings and blobs at the offset of the entry
+  static esp_err_t writeToNvs(nvs_handle_t handle, const Entry &entry,
+                              const uint8_t *data);
+  static void flushTimerCallback(void *arg);
+  static uint32_t flushJob(void *context);
+
   esp_err_t getReadHandle(nvs_handle_t *out_handle);
   esp_err_t getWriteHandle(nvs_handle_t *out_handle);
-};
\ No newline at end of file
+
+  // Under cacheLock
+  InplaceVector<Entry, STORAGE_MAX_ENTRIES> entries;
+  uint8_t data[STORAGE_DATA_BYTES];
+  uint16_t dataUsed = 0; // Packed from the start
+  // Under flushLock, copy of the dirty values being committed
+  InplaceVector<Entry, STORAGE_MAX_ENTRIES> dirty;
+  uint8_t dirtyData[STORAGE_DATA_BYTES];
+  SemaphoreHandle_t cacheLock;
+  SemaphoreHandle_t flushLock;
+  // Only wakes flushJob, esp_timer callbacks must not wait for flash
+  esp_timer_handle_t flushTimer = NULL;
+  int8_t flushJobId = -1;
+  uint32_t flushIntervalSeconds = STORAGE_DEFAULT_FLUSH_INTERVAL_SECONDS;
+};
@@ -3,6 +3,8 @@
 #include "ds18b20.h"
 #include "ds18b20_types.h"
 #include "esp_check.h"
+#include "esp_timer.h"
+#include "executor.hpp"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "heater.hpp"
@@ -19,6 +21,9 @@ static const char *TAG = "DS18B20";
 // D10 on Seedstudio ESP32C6
 #define ADDITIONAL_GROUND_GPIO GPIO_NUM_18
 
+#define DS18B20_CMD_CONVERT_TEMP 0x44
+#define DS18B20_CMD_READ_SCRATCHPAD 0xBE
+
 void TemperatureSensor::findSensors() {
   if (this->bus == NULL) {
 
@@ -42,10 +47,11 @@ void TemperatureSensor::findSensors() {
         onewire_new_bus_rmt(&bus_config, &rmt_config, &(this->bus)));
   }
 
-  int ds18b20_device_num = 0;
   onewire_device_iter_handle_t iter = NULL;
   onewire_device_t next_onewire_device;
   esp_err_t search_result = ESP_OK;
+  sensorCount = 0;
+  conversionReadyAt = 0;
 
   // create 1-wire device iterator, which is used for device search
   ESP_ERROR_CHECK(onewire_new_device_iter(bus, &iter));
@@ -55,24 +61,166 @@ void TemperatureSensor::findSensors() {
     if (search_result == ESP_OK) { // found a new device, let's check if we can
                                    // upgrade it to a DS18B20
       ds18b20_config_t ds_cfg = {};
+      ds18b20_device_handle_t ds18b20;
       // check if the device is a DS18B20, if so, return the ds18b20 handle
-      if (ds18b20_new_device(&next_onewire_device, &ds_cfg, &ds18b20s) ==
+      if (ds18b20_new_device(&next_onewire_device, &ds_cfg, &ds18b20) !=
           ESP_OK) {
-        ESP_LOGI(TAG, "Found a DS18B20[%d], address: %016llX",
-                 ds18b20_device_num, next_onewire_device.address);
-        ds18b20_set_resolution(ds18b20s, DS18B20_RESOLUTION_9B);
-        ds18b20_device_num++;
-        tempSensorFound = true;
-
-      } else {
         ESP_LOGI(TAG, "Found an unknown device, address: %016llX",
                  next_onewire_device.address);
+        continue;
+      }
+      if (sensorCount < TEMPERATURE_SENSOR_MAX_SENSORS) {
+        ESP_LOGI(TAG, "Found a DS18B20[%d], address: %016llX", sensorCount,
+                 next_onewire_device.address);
+        ds18b20_set_resolution(ds18b20, resolution);
+        sensors[sensorCount++] = {.address = next_onewire_device.address,
+                                  .latest = {},
+                                  .valid = false};
+      } else {
+        ESP_LOGW(TAG, "Ignoring DS18B20 %016llX, the table is full",
+                 next_onewire_device.address);
       }
+      // Conversions are addressed by ROM code, the handle is not needed
+      ds18b20_del_device(ds18b20);
     }
   } while (search_result != ESP_ERR_NOT_FOUND);
   ESP_ERROR_CHECK(onewire_del_device_iter(iter));
-  ESP_LOGI(TAG, "Searching done, %d DS18B20 device(s) found",
-           ds18b20_device_num);
+  tempSensorFound = sensorCount > 0;
+  ESP_LOGI(TAG, "Searching done, %d DS18B20 device(s) found", sensorCount);
+}
+
+esp_err_t TemperatureSensor::startConversion() {
+  // Skip ROM addresses every sensor, so all of them convert in parallel
+  uint8_t cmd[2] = {ONEWIRE_CMD_SKIP_ROM, DS18B20_CMD_CONVERT_TEMP};
+  ESP_RETURN_ON_ERROR(onewire_bus_reset(bus), TAG, "Bus reset failed");
+  ESP_RETURN_ON_ERROR(onewire_bus_write_bytes(bus, cmd, sizeof(cmd)), TAG,
+                      "Starting the conversion failed");
+  conversionReadyAt = esp_timer_get_time() + conversionTimeMs() * 1000;
+  return ESP_OK;
+}
+
+esp_err_t TemperatureSensor::readConversion(temperature_sensor_slot_t &sensor,
+                                           int64_t measuredAt) {
+  uint8_t cmd[10] = {ONEWIRE_CMD_MATCH_ROM};
+  memcpy(&cmd[1], &sensor.address, sizeof(sensor.address));
+  cmd[9] = DS18B20_CMD_READ_SCRATCHPAD;
+  ESP_RETURN_ON_ERROR(onewire_bus_reset(bus), TAG, "Bus reset failed");
+  ESP_RETURN_ON_ERROR(onewire_bus_write_bytes(bus, cmd, sizeof(cmd)), TAG,
+                      "Selecting the scratchpad failed");
+  uint8_t scratchpad[9];
+  ESP_RETURN_ON_ERROR(
+      onewire_bus_read_bytes(bus, scratchpad, sizeof(scratchpad)), TAG,
+      "Reading the scratchpad failed");
+  ESP_RETURN_ON_FALSE(onewire_crc8(0, scratchpad, 8) == scratchpad[8],
+                      ESP_ERR_INVALID_CRC, TAG, "Scratchpad CRC mismatch");
+
+  // Bits below the configured resolution are undefined
+  int16_t raw = scratchpad[1] << 8 | scratchpad[0];
+  raw &= ~((1 << (DS18B20_RESOLUTION_12B - resolution)) - 1);
+  // 1/16 °C to 1/100 °C, rounded
+  sensor.latest = {.temperature = (int16_t)(((int32_t)raw * 25 + 2) >> 2),
+                   .timestamp = esp_timer_get_time(),
+                   .measuredAt = measuredAt};
+  return ESP_OK;
+}
+
+bool TemperatureSensor::readAll() {
+  auto measuredAt = conversionReadyAt;
+  conversionReadyAt = 0;
+  bool anyValid = false;
+  for (uint8_t i = 0; i < sensorCount; i++) {
+    auto &sensor = sensors[i];
+    sensor.valid = readConversion(sensor, measuredAt) == ESP_OK;
+    if (!sensor.valid) {
+      ESP_LOGW(TAG, "Reading DS18B20[%d] failed", i);
+      continue;
+    }
+    anyValid = true;
+    for (auto &&callback : sensorCallbacks) {
+      callback.callback(i, &sensor.latest.temperature,
+                        callback.additionalParameters);
+    }
+  }
+  return anyValid;
+}
+
+int16_t TemperatureSensor::aggregateTemperature() {
+  if (aggregate == TemperatureAggregate::Primary && primarySensor < sensorCount &&
+      sensors[primarySensor].valid)
+    return sensors[primarySensor].latest.temperature;
+
+  // A failed primary falls back to the mean of the others
+  int16_t min = 0, max = 0;
+  int32_t sum = 0;
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < sensorCount; i++) {
+    if (!sensors[i].valid)
+      continue;
+    auto temp = sensors[i].latest.temperature;
+    min = count == 0 || temp < min ? temp : min;
+    max = count == 0 || temp > max ? temp : max;
+    sum += temp;
+    count++;
+  }
+  switch (aggregate) {
+  case TemperatureAggregate::Min:
+    return min;
+  case TemperatureAggregate::Max:
+    return max;
+  default:
+    return (int16_t)(sum / count);
+  }
+}
+
+uint32_t TemperatureSensor::conversionTimeMs() {
+  // 93.75ms at 9 bit, doubling with every additional bit
+  return 100 << (resolution - DS18B20_RESOLUTION_9B);
+}
+
+uint32_t TemperatureSensor::msUntilNextSample() {
+  if (sampleIntervalMs == 0) {
+    tm currentTime;
+    Clock::GetInstance()->getCurrentTime(currentTime);
+    return (60 - currentTime.tm_sec) * 1000;
+  }
+  // Measured from the previous read, so processing does not add drift
+  int64_t elapsedMs = (esp_timer_get_time() - latestSample.timestamp) / 1000;
+  if (elapsedMs >= sampleIntervalMs)
+    return 0;
+  return sampleIntervalMs - elapsedMs;
+}
+
+void TemperatureSensor::publish(int16_t temp, int64_t measuredAt) {
+  latestSample = {.temperature = temp,
+                  .timestamp = esp_timer_get_time(),
+                  .measuredAt = measuredAt};
+  for (auto &&i : tempCallbacks) {
+    i.callback(&temp, i.additionalParameters);
+  }
+}
+
+void TemperatureSensor::setSampleInterval(uint32_t milliseconds,
+                                          bool pipelined) {
+  this->sampleIntervalMs = milliseconds;
+  this->pipelined = pipelined;
+}
+
+void TemperatureSensor::requestSample() {
+  if (pipelined)
+    conversionReadyAt = 0;
+  Executor::GetInstance()->wake(sampleJobId);
+}
+
+void TemperatureSensor::setAggregate(TemperatureAggregate aggregate,
+                                     uint8_t primary) {
+  this->aggregate = aggregate;
+  this->primarySensor = primary;
+}
+
+const temperature_sensor_slot_t *TemperatureSensor::getSensor(uint8_t index) {
+  if (index >= sensorCount)
+    return nullptr;
+  return &sensors[index];
 }
 
 void TemperatureSensor::init() {
@@ -80,55 +228,60 @@ void TemperatureSensor::init() {
     return;
   this->findSensors();
   initialized = true;
-  xTaskCreate(requestTemp, "Temperature_main", 4096, this, 6, NULL);
+  auto executor = Executor::GetInstance();
+  executor->init();
+  sampleJobId = executor->add("temperature", sampleJob, this, 10 * 1000);
 }
-void TemperatureSensor::requestTemp(void *pvParameters) {
-
-  vTaskDelay((10 * 1000) / portTICK_PERIOD_MS);
 
+// One step per run, the conversion time is spent as a deadline of the
+// executor instead of a blocked task
+uint32_t TemperatureSensor::sampleJob(void *pvParameters) {
   auto _this = (TemperatureSensor *)pvParameters;
-  auto clock = Clock::GetInstance();
-  // auto _this = TemperatureSensor::GetInstance();
-  tm currentTime;
-
-  float temp = 22;
-  for (;;) {
-
-    if (_this->tempSensorFound) {
-      auto sensor = _this->ds18b20s;
-      if (ds18b20_trigger_temperature_conversion(sensor) != ESP_OK ||
-          ds18b20_get_temperature(sensor, &temp) != ESP_OK) {
-        _this->tempSensorFound = false;
-      } else {
-        for (auto &&i : _this->tempCallbacks) {
-          std::get<0>(i)(&temp, std::get<1>(i));
-        }
-      }
-    } else {
-      _this->findSensors();
 
-      // TODO !!!!!!!!!REMOVE BEFORE DEPLOYMENT!!!!!!!!!!
-      temp += 0.3;
-      temp = temp > 25 ? 22 : temp;
+  if (_this->tempSensorFound) {
+    // A pipelined conversion may already be running or even be done
+    if (_this->conversionReadyAt == 0 && _this->startConversion() != ESP_OK) {
+      _this->tempSensorFound = false;
+      return 0;
+    }
+    int64_t remaining = _this->conversionReadyAt - esp_timer_get_time();
+    if (remaining > 0)
+      return (uint32_t)((remaining + 999) / 1000);
 
-      for (auto &&i : _this->tempCallbacks) {
-        std::get<0>(i)(&temp, std::get<1>(i));
-      }
+    // All sensors converted together, readAll() clears the deadline
+    auto measuredAt = _this->conversionReadyAt;
+    if (!_this->readAll()) {
+      _this->tempSensorFound = false;
+      return 0;
     }
+    auto temp = _this->aggregateTemperature();
+    if (_this->pipelined && _this->startConversion() != ESP_OK)
+      _this->tempSensorFound = false;
+    _this->publish(temp, measuredAt);
+  } else {
+    _this->findSensors();
 
-    clock->getCurrentTime(currentTime);
+    // TODO !!!!!!!!!REMOVE BEFORE DEPLOYMENT!!!!!!!!!!
+    _this->fakeTemp += 30;
+    _this->fakeTemp = _this->fakeTemp > 2500 ? 2200 : _this->fakeTemp;
 
-    vTaskDelay(
-        ((60 - currentTime.tm_sec) * 1000) /
-        portTICK_PERIOD_MS); // Wait till 2 seconds before next minute, so that
-                             // this should finish before heater checks schedule
+    _this->publish(_this->fakeTemp, esp_timer_get_time());
   }
+
+  // The heat check is notified by publish(), so it never waits for a sample
+  return _this->msUntilNextSample();
 }
 
 void TemperatureSensor::addTempCallback(tempCallback callback,
                                         const void *additionalParameters) {
+  if (!tempCallbacks.push_back({callback, additionalParameters}))
+    ESP_LOGE(TAG, "No room for another temperature callback");
+}
 
-  tempCallbacks.push_back({callback, additionalParameters});
+void TemperatureSensor::addSensorCallback(sensorTempCallback callback,
+                                          const void *additionalParameters) {
+  if (!sensorCallbacks.push_back({callback, additionalParameters}))
+    ESP_LOGE(TAG, "No room for another sensor callback");
 }
 
 TemperatureSensor *TemperatureSensor::_instance = nullptr;
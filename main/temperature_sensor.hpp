@@ -1,17 +1,67 @@
 #pragma once
 
 #include "ds18b20.h"
+#include "freertos/FreeRTOS.h"
+#include "inplace_vector.hpp"
 #include <esp_log.h>
-#include <tuple>
-#include <vector>
+#include <stdlib.h>
 
-typedef void (*tempCallback)(float *temp, const void *additionalParameters);
+// Sensors beyond this are ignored when searching the bus
+#define TEMPERATURE_SENSOR_MAX_SENSORS 4
+// Per callback kind, registered once during initialization
+#define TEMPERATURE_SENSOR_MAX_CALLBACKS 4
+
+// Temperatures are passed as 1/100 °C, like the ZCL measured value, so no
+// float math is needed on the FPU-less cores
+typedef void (*tempCallback)(int16_t *temp, const void *additionalParameters);
+typedef void (*sensorTempCallback)(uint8_t sensorIndex, int16_t *temp,
+                                   const void *additionalParameters);
+
+// Logs a 1/100 °C value without float formatting
+#define CENTI_TEMP_FMT "%s%d.%02d"
+#define CENTI_TEMP_ARGS(temp)                                                  \
+  ((temp) < 0 ? "-" : ""), abs((temp) / 100), abs((temp) % 100)
+
+struct temperature_sample_t {
+  int16_t temperature; // 1/100 °C
+  int64_t timestamp; // esp_timer_get_time() when the scratchpad was read
+  int64_t measuredAt; // esp_timer_get_time() when the conversion finished
+};
+
+/// @brief How the readings of all sensors are combined for tempCallback
+enum class TemperatureAggregate : uint8_t { Primary, Min, Mean, Max };
+
+struct temperature_sensor_slot_t {
+  onewire_device_address_t address;
+  temperature_sample_t latest;
+  bool valid; // false if the last read failed
+};
+
+template <typename F> struct temperature_callback_slot_t {
+  F callback;
+  const void *additionalParameters;
+};
 
 class TemperatureSensor {
 
 public:
   void init();
+  /// @brief Called with the aggregate of all sensors
   void addTempCallback(tempCallback, const void *additionalParameters);
+  /// @brief Called once per sensor and sample
+  void addSensorCallback(sensorTempCallback, const void *additionalParameters);
+  /// @param milliseconds 0 samples once per minute, aligned to the clock
+  /// @param pipelined start the next conversion right after a read, so it
+  /// runs while the sample is processed and the task waits
+  void setSampleInterval(uint32_t milliseconds, bool pipelined = false);
+  /// @param primary sensor index used by TemperatureAggregate::Primary
+  void setAggregate(TemperatureAggregate aggregate, uint8_t primary = 0);
+  /// @brief Takes a sample right away instead of at the next interval, a
+  /// pipelined conversion is discarded as it may be old
+  void requestSample();
+  temperature_sample_t getLatestSample() { return latestSample; }
+  uint8_t getSensorCount() { return sensorCount; }
+  const temperature_sensor_slot_t *getSensor(uint8_t index);
 
   static TemperatureSensor *GetInstance();
 
@@ -23,15 +73,38 @@ protected:
   TemperatureSensor() {}
 
 private:
-  static void requestTemp(void *pvParameters);
+  static uint32_t sampleJob(void *pvParameters);
   void findSensors();
+  esp_err_t startConversion();
+  esp_err_t readConversion(temperature_sensor_slot_t &sensor,
+                           int64_t measuredAt);
+  bool readAll();
+  int16_t aggregateTemperature();
+  uint32_t conversionTimeMs();
+  uint32_t msUntilNextSample();
+  void publish(int16_t temp, int64_t measuredAt);
 
 public:
   bool tempSensorFound = false;
 
 private:
   bool initialized = false;
-  ds18b20_device_handle_t ds18b20s;
-  std::vector<std::tuple<tempCallback, const void *>> tempCallbacks;
+  int8_t sampleJobId = -1;
+  temperature_sensor_slot_t sensors[TEMPERATURE_SENSOR_MAX_SENSORS] = {};
+  uint8_t sensorCount = 0;
+  TemperatureAggregate aggregate = TemperatureAggregate::Primary;
+  uint8_t primarySensor = 0;
+  ds18b20_resolution_t resolution = DS18B20_RESOLUTION_9B;
+  int64_t conversionReadyAt = 0; // 0 if no conversion is pending
+  uint32_t sampleIntervalMs = 0;
+  bool pipelined = false;
+  temperature_sample_t latestSample = {};
+  int16_t fakeTemp = 2200; // Published while no sensor is found
+  InplaceVector<temperature_callback_slot_t<tempCallback>,
+                TEMPERATURE_SENSOR_MAX_CALLBACKS>
+      tempCallbacks;
+  InplaceVector<temperature_callback_slot_t<sensorTempCallback>,
+                TEMPERATURE_SENSOR_MAX_CALLBACKS>
+      sensorCallbacks;
   onewire_bus_handle_t bus = NULL;
 };
@@ -1,4 +1,5 @@
 #include "zigbee_device.hpp"
+#include "attribute_transaction.hpp"
 #include "clock.hpp"
 #include "custom_cluster.hpp"
 #include "esp_check.h"
@@ -6,9 +7,12 @@
 #include "esp_zigbee_attribute.h"
 #include "esp_zigbee_core.h"
 #include "heater.hpp"
+#include "report_policy.hpp"
 #include "temperature_sensor.hpp"
 #include "time.h"
+#include "zigbee_worker.hpp"
 #include "zcl/esp_zigbee_zcl_time.h"
+#include <string.h>
 #include <sys/select.h>
 
 static const char *TAG = "ZIGBEE_DEVICE";
@@ -22,26 +26,18 @@ ZigbeeDevice *ZigbeeDevice::GetInstance() {
   return _instance;
 }
 
-float ZigbeeDevice::s16ToTemperature(int16_t value) {
-  return 1.0 * value / 100;
-}
-
-int16_t ZigbeeDevice::temperatureTos16(float temp) {
-  return (int16_t)(temp * 100);
-}
-
-void ZigbeeDevice::temperatureReceived(float *temp,
+void ZigbeeDevice::temperatureReceived(int16_t *temp,
                                        const void *additionalParameters) {
 
-  int16_t measured_value = temperatureTos16(*temp);
-  ESP_LOGI(TAG, "Temp Rec: %f => %d", *temp, measured_value);
+  int16_t measured_value = *temp;
+  ESP_LOGI(TAG, "Temp Rec: " CENTI_TEMP_FMT, CENTI_TEMP_ARGS(measured_value));
   /* Update temperature sensor measured value */
-  esp_zb_lock_acquire(portMAX_DELAY);
-  esp_zb_zcl_set_attribute_val(
-      HA_THERMOSTAT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT,
-      ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID,
-      &measured_value, false);
-  esp_zb_lock_release();
+  // Kept across samples, so an unchanged value does not take the lock
+  static AttributeTransaction attributes;
+  attributes.stage(HA_THERMOSTAT_ENDPOINT,
+                   ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT,
+                   ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, measured_value);
+  attributes.commit();
 }
 
 void ZigbeeDevice::init() {
@@ -53,8 +49,11 @@ void ZigbeeDevice::init() {
   heater->init();
 
   ota = new CompressedOTA();
+  ota->init();
 
   storage = Storage::GetInstance();
+  ReportPolicy::GetInstance()->init();
+  ZigbeeWorker::GetInstance()->init();
 }
 esp_err_t
 ZigbeeDevice::actionHandler(esp_zb_core_action_callback_id_t callback_id,
@@ -117,6 +116,8 @@ void ZigbeeDevice::esp_app_zb_attribute_handler(
 
       clock->updateTimeZone(value);
     }
+    // Deadlines were calculated against the old time
+    heater->requestHeatCheck();
   }
   
   if (cluster_id == ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT) {
@@ -147,7 +148,8 @@ esp_err_t ZigbeeDevice::zb_attribute_reporting_handler(
            "endpoint(%d) cluster(0x%x)",
            message->src_address.u.short_addr, message->src_endpoint,
            message->dst_endpoint, message->cluster);
-  esp_app_zb_attribute_handler(message->cluster, &message->attribute);
+  ZigbeeWorker::GetInstance()->postAttribute(
+      ZigbeeWorkKind::AttributeReport, message->cluster, &message->attribute);
   return ESP_OK;
 }
 
@@ -175,7 +177,9 @@ esp_err_t ZigbeeDevice::zb_read_attr_resp_handler(
                  ? *(uint8_t *)variable->attribute.data.value
                  : 0);
     if (variable->status == ESP_ZB_ZCL_STATUS_SUCCESS) {
-      esp_app_zb_attribute_handler(message->info.cluster, &variable->attribute);
+      ZigbeeWorker::GetInstance()->postAttribute(
+          ZigbeeWorkKind::AttributeReport, message->info.cluster,
+          &variable->attribute);
     }
 
     variable = variable->next;
@@ -217,44 +221,51 @@ esp_err_t ZigbeeDevice::zb_attribute_set_handler(
       TAG, "Receive attribute set: %d from address 0x%04hx to attribute %x",
       message->info.cluster, message->info.dst_endpoint, message->attribute.id);
 
-  if (message->info.cluster == ESP_ZB_ZCL_CLUSTER_ID_TIME) {
+  // The stack already holds the new value
+  AttributeTransaction::invalidate();
+  // Handled by the worker, the stack task must not block on flash writes
+  ZigbeeWorker::GetInstance()->postAttribute(ZigbeeWorkKind::AttributeSet,
+                                             message->info.cluster,
+                                             &message->attribute);
+  return ret;
+}
+
+void ZigbeeDevice::applyAttributeSet(uint16_t clusterId,
+                                     const esp_zb_zcl_attribute_t *attribute) {
+  if (clusterId == ESP_ZB_ZCL_CLUSTER_ID_TIME) {
     auto clock = Clock::GetInstance();
-    if (message->attribute.id == ESP_ZB_ZCL_ATTR_TIME_TIME_ID &&
-        message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME) {
+    if (attribute->id == ESP_ZB_ZCL_ATTR_TIME_TIME_ID &&
+        attribute->data.type == ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME) {
 
-      uint32_t value = message->attribute.data.value
-                           ? *(uint32_t *)message->attribute.data.value
-                           : 0;
+      uint32_t value =
+          attribute->data.value ? *(uint32_t *)attribute->data.value : 0;
 
       clock->updateTime(value);
-    } else if (message->attribute.id == ESP_ZB_ZCL_ATTR_TIME_TIME_ZONE_ID) {
-      int32_t value = message->attribute.data.value
-                          ? *(int32_t *)message->attribute.data.value
-                          : 0;
+    } else if (attribute->id == ESP_ZB_ZCL_ATTR_TIME_TIME_ZONE_ID) {
+      int32_t value =
+          attribute->data.value ? *(int32_t *)attribute->data.value : 0;
 
       clock->updateTimeZone(value);
     }
-  } else if (message->info.cluster == ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT) {
-    if (message->attribute.id ==
+    heater->requestHeatCheck();
+  } else if (clusterId == ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT) {
+    if (attribute->id ==
             ESP_ZB_ZCL_ATTR_THERMOSTAT_OCCUPIED_HEATING_SETPOINT_ID &&
-        message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_S16) {
+        attribute->data.type == ESP_ZB_ZCL_ATTR_TYPE_S16) {
 
-    } else if (message->attribute.id ==
-               ESP_ZB_ZCL_ATTR_THERMOSTAT_SYSTEM_MODE_ID) {
-      heater->updateSystemMode(*(uint8_t *)message->attribute.data.value);
-    } else if (message->attribute.id ==
+    } else if (attribute->id == ESP_ZB_ZCL_ATTR_THERMOSTAT_SYSTEM_MODE_ID) {
+      heater->updateSystemMode(*(uint8_t *)attribute->data.value);
+    } else if (attribute->id ==
                    ESP_ZB_ZCL_ATTR_THERMOSTAT_UNOCCUPIED_HEATING_SETPOINT_ID &&
-               message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_S16) {
-      heater->updateManualTemp(*(int16_t *)message->attribute.data.value);
+               attribute->data.type == ESP_ZB_ZCL_ATTR_TYPE_S16) {
+      heater->updateManualTemp(*(int16_t *)attribute->data.value);
     }
-  } else if (message->info.cluster == ESP_ZB_ZCL_CLUSTER_ID_CUSTOM) {
-    if (message->attribute.id == ESP_ZB_ZCL_ATTR_CUSTOM_RUNTIME_SECONDS_ID &&
-        message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_U32) {
-      heater->updateRuntime(*(uint32_t *)message->attribute.data.value);
+  } else if (clusterId == ESP_ZB_ZCL_CLUSTER_ID_CUSTOM) {
+    if (attribute->id == ESP_ZB_ZCL_ATTR_CUSTOM_RUNTIME_SECONDS_ID &&
+        attribute->data.type == ESP_ZB_ZCL_ATTR_TYPE_U32) {
+      heater->updateRuntime(*(uint32_t *)attribute->data.value);
     }
   }
-
-  return ret;
 }
 
 esp_err_t ZigbeeDevice::zb_custom_request_handler(
@@ -268,46 +279,9 @@ esp_err_t ZigbeeDevice::zb_custom_request_handler(
 
   if (message->info.cluster == ESP_ZB_ZCL_CLUSTER_ID_CUSTOM ||
       message->info.cluster == ESP_ZB_ZCL_CLUSTER_ID_THERMOSTAT) {
-    switch (message->info.command.id) {
-    case SET_WEEKLY_SCHEDULE_COMMAND_ID: {
-      ESP_LOG_BUFFER_HEX(TAG, ((uint8_t *)message->data.value),
-                         message->data.size);
-
-      esp_zb_weekly_schedule_header_t header =
-          ((esp_zb_weekly_schedule_header_t *)message->data.value)[0];
-      ESP_LOGI(TAG, "Length: %d, DayOfWeek: %x, Mode: %x",
-               header.numberOfTransitions, header.dayOfWeekForSequence,
-               header.mode);
-
-      auto trimmedValue = ((uint8_t *)message->data.value) +
-                          sizeof(esp_zb_weekly_schedule_header_t);
-      auto settings = (esp_zb_weekly_schedule_single_s *)trimmedValue;
-      auto heater = Heater::GetInstance();
-      heater->updateSchedule(header, settings);
-      heater->printSchedule();
-      break;
-    }
-    case SET_CUSTOM_WEEKLY_SCHEDULE_COMMAND_ID: {
-      auto header =
-          *((esp_zb_custom_weekly_schedule_header_t *)message->data.value);
-
-      auto trimmedValue = ((uint8_t *)message->data.value) +
-                          sizeof(esp_zb_custom_weekly_schedule_header_t);
-      auto settings = (esp_zb_custom_weekly_schedule_t *)trimmedValue;
-            auto heater = Heater::GetInstance();
-      heater->updateCustomSchedule(header, settings);
-      heater->printSchedule();
-
-      break;
-    }
-    case CLEAR_WEEKLY_SCHEDULE_COMMAND_ID: {
-      auto clock = Clock::GetInstance();
-      clock->syncTimeRequest();
-      break;
-    }
-    default:
-      break;
-    }
+    ZigbeeWorker::GetInstance()->postCommand(
+        message->info.cluster, message->info.command.id, message->data.value,
+        message->data.size);
   } else {
 
     ESP_LOGI(TAG, "Receive custom command: %d from address 0x%04hx",
@@ -320,32 +294,53 @@ esp_err_t ZigbeeDevice::zb_custom_request_handler(
   return ret;
 }
 
-void ZigbeeDevice::addReportingToCoordinator(
-    uint16_t clusterId, uint16_t attrId, esp_zb_zcl_cluster_role_t cluserRole) {
-
-  esp_zb_zcl_reporting_info_t reporting_info = {
-      .direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV,
-      .ep = HA_THERMOSTAT_ENDPOINT,
-      .cluster_id = clusterId,
-      .cluster_role = (uint8_t)cluserRole,
-      .attr_id = attrId,
-      .flags = 0,
-      .run_time = 0,
-      .u{
-          .send_info = {.min_interval = 10,
-                        .max_interval = 3600,
-                        .delta = {},
-                        .reported_value = {},
-                        .def_min_interval = 10,
-                        .def_max_interval = 3600},
-      },
-      .dst{
-          .short_addr = 0,
-          .endpoint = 0,
-          .profile_id = ESP_ZB_AF_HA_PROFILE_ID,
-      },
-
-      .manuf_code = ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC,
-  };
-  esp_zb_zcl_update_reporting_info(&reporting_info);
-}
\ No newline at end of file
+void ZigbeeDevice::applyCustomCommand(uint16_t clusterId, uint8_t commandId,
+                                      const uint8_t *data, uint16_t size) {
+  switch (commandId) {
+  case SET_WEEKLY_SCHEDULE_COMMAND_ID: {
+    ESP_LOG_BUFFER_HEX(TAG, data, size);
+
+    esp_zb_weekly_schedule_header_t header =
+        ((esp_zb_weekly_schedule_header_t *)data)[0];
+    ESP_LOGI(TAG, "Length: %d, DayOfWeek: %x, Mode: %x",
+             header.numberOfTransitions, header.dayOfWeekForSequence,
+             header.mode);
+
+    auto trimmedValue = data + sizeof(esp_zb_weekly_schedule_header_t);
+    auto settings = (esp_zb_weekly_schedule_single_s *)trimmedValue;
+    auto heater = Heater::GetInstance();
+    heater->updateSchedule(header, settings);
+    heater->printSchedule();
+    break;
+  }
+  case SET_CUSTOM_WEEKLY_SCHEDULE_COMMAND_ID: {
+    auto header = *((esp_zb_custom_weekly_schedule_header_t *)data);
+
+    auto trimmedValue = data + sizeof(esp_zb_custom_weekly_schedule_header_t);
+    auto settings = (esp_zb_custom_weekly_schedule_t *)trimmedValue;
+    auto heater = Heater::GetInstance();
+    heater->updateCustomSchedule(header, settings);
+    heater->printSchedule();
+
+    break;
+  }
+  case CLEAR_WEEKLY_SCHEDULE_COMMAND_ID: {
+    auto clock = Clock::GetInstance();
+    clock->syncTimeRequest();
+    break;
+  }
+  case SET_REPORT_POLICY_COMMAND_ID: {
+    if (clusterId != ESP_ZB_ZCL_CLUSTER_ID_CUSTOM ||
+        size < sizeof(report_policy_entry_t))
+      break;
+    report_policy_entry_t entry;
+    memcpy(&entry, data, sizeof(entry));
+    auto res = ReportPolicy::GetInstance()->update(entry);
+    if (res != ESP_OK)
+      ESP_LOGW(TAG, "Report policy rejected: %x", res);
+    break;
+  }
+  default:
+    break;
+  }
+}
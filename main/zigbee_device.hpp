@@ -14,6 +14,7 @@
 #define SET_WEEKLY_SCHEDULE_COMMAND_ID 0x01
 #define GET_WEEKLY_SCHEDULE_COMMAND_ID 0x02
 #define CLEAR_WEEKLY_SCHEDULE_COMMAND_ID 0x03
+#define SET_REPORT_POLICY_COMMAND_ID 0x04 // Custom cluster only
 #define SET_CUSTOM_WEEKLY_SCHEDULE_COMMAND_ID 0xff
 
 class ZigbeeDevice {
@@ -42,15 +43,17 @@ public:
       const esp_zb_zcl_cmd_read_attr_resp_message_t *message);
   esp_err_t zb_attribute_reporting_handler(
       const esp_zb_zcl_report_attr_message_t *message);
-  void addReportingToCoordinator(uint16_t clusterId, uint16_t attrId,
-                                 esp_zb_zcl_cluster_role_t cluserRole);
 
   esp_err_t
   zb_attribute_set_handler(const esp_zb_zcl_set_attr_value_message_t *message);
+  /// @brief Reacts to a write of one of our attributes, runs in the worker
+  void applyAttributeSet(uint16_t clusterId,
+                         const esp_zb_zcl_attribute_t *attribute);
+  /// @brief Executes a schedule or custom cluster command, runs in the worker
+  void applyCustomCommand(uint16_t clusterId, uint8_t commandId,
+                          const uint8_t *data, uint16_t size);
 
-  static float s16ToTemperature(int16_t value);
-  static int16_t temperatureTos16(float temp);
-  static void temperatureReceived(float *temp,
+  static void temperatureReceived(int16_t *temp,
                                   const void *additionalParameters);
 
 public:
@@ -0,0 +1,158 @@
+#include "zigbee_worker.hpp"
+#include "esp_log.h"
+#include "executor.hpp"
+#include "zigbee_device.hpp"
+#include <string.h>
+
+static const char *TAG = "ZIGBEE_WORKER";
+
+ZigbeeWorker *ZigbeeWorker::_instance = nullptr;
+
+ZigbeeWorker *ZigbeeWorker::GetInstance() {
+  if (_instance == nullptr) {
+    _instance = new ZigbeeWorker();
+  }
+  return _instance;
+}
+
+void ZigbeeWorker::init() {
+  if (initialized)
+    return;
+  lock = xSemaphoreCreateMutex();
+  queue = xQueueCreate(ZIGBEE_WORKER_SLOTS, sizeof(uint8_t));
+  initialized = true;
+  auto executor = Executor::GetInstance();
+  executor->init();
+  jobId = executor->add("zigbee_worker", workerJob, this, EXECUTOR_IDLE);
+}
+
+bool ZigbeeWorker::postAttribute(ZigbeeWorkKind kind, uint16_t clusterId,
+                                 const esp_zb_zcl_attribute_t *attribute) {
+  zigbee_work_item_t item = {.kind = kind,
+                             .clusterId = clusterId,
+                             .id = attribute->id,
+                             .type = attribute->data.type,
+                             .size = attribute->data.size,
+                             .data = {}};
+  if (attribute->data.value == NULL)
+    item.size = 0;
+  else if (item.size > sizeof(item.data))
+    item.size = UINT16_MAX; // Rejected by post
+  else
+    memcpy(item.data, attribute->data.value, item.size);
+  // Only the latest value of an attribute matters
+  return post(item, true);
+}
+
+bool ZigbeeWorker::postCommand(uint16_t clusterId, uint8_t commandId,
+                               const void *data, uint16_t size) {
+  zigbee_work_item_t item = {.kind = ZigbeeWorkKind::CustomCommand,
+                             .clusterId = clusterId,
+                             .id = commandId,
+                             .type = ESP_ZB_ZCL_ATTR_TYPE_NULL,
+                             .size = size,
+                             .data = {}};
+  if (size > sizeof(item.data))
+    item.size = UINT16_MAX;
+  else if (data != NULL)
+    memcpy(item.data, data, size);
+  return post(item, false);
+}
+
+bool ZigbeeWorker::post(const zigbee_work_item_t &item, bool coalesce) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  stats.posted++;
+  if (item.size == UINT16_MAX) {
+    stats.dropped++;
+    xSemaphoreGive(lock);
+    ESP_LOGW(TAG, "Dropped %x of cluster %x, payload too large", item.id,
+             item.clusterId);
+    return false;
+  }
+
+  for (uint8_t i = 0; coalesce && i < ZIGBEE_WORKER_SLOTS; i++) {
+    auto &queued = slots[i];
+    if (slotStates[i] == SlotState::Queued && queued.kind == item.kind &&
+        queued.clusterId == item.clusterId && queued.id == item.id) {
+      queued = item;
+      stats.coalesced++;
+      xSemaphoreGive(lock);
+      return true;
+    }
+  }
+
+  for (uint8_t i = 0; i < ZIGBEE_WORKER_SLOTS; i++) {
+    if (slotStates[i] != SlotState::Free)
+      continue;
+    slots[i] = item;
+    slotStates[i] = SlotState::Queued;
+    slotsInUse++;
+    if (slotsInUse > stats.highWatermark)
+      stats.highWatermark = slotsInUse;
+    // The queue holds as many entries as there are slots, so this never fails
+    xQueueSend(queue, &i, 0);
+    xSemaphoreGive(lock);
+    Executor::GetInstance()->wake(jobId);
+    return true;
+  }
+
+  stats.dropped++;
+  xSemaphoreGive(lock);
+  ESP_LOGW(TAG, "Dropped %x of cluster %x, all slots in use", item.id,
+           item.clusterId);
+  return false;
+}
+
+bool ZigbeeWorker::processNext(TickType_t wait) {
+  uint8_t index;
+  if (xQueueReceive(queue, &index, wait) != pdTRUE)
+    return false;
+
+  // Free the slot before the slow part, so the stack can post again
+  zigbee_work_item_t item;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  item = slots[index];
+  slotStates[index] = SlotState::Free;
+  slotsInUse--;
+  xSemaphoreGive(lock);
+
+  dispatch(item);
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  stats.processed++;
+  xSemaphoreGive(lock);
+  return true;
+}
+
+void ZigbeeWorker::dispatch(const zigbee_work_item_t &item) {
+  auto device = ZigbeeDevice::GetInstance();
+  if (item.kind == ZigbeeWorkKind::CustomCommand) {
+    device->applyCustomCommand(item.clusterId, item.id, item.data, item.size);
+    return;
+  }
+
+  esp_zb_zcl_attribute_t attribute = {
+      .id = item.id,
+      .data = {.type = item.type,
+               .size = item.size,
+               .value = item.size > 0 ? (void *)item.data : NULL}};
+  if (item.kind == ZigbeeWorkKind::AttributeSet)
+    device->applyAttributeSet(item.clusterId, &attribute);
+  else
+    device->esp_app_zb_attribute_handler(item.clusterId, &attribute);
+}
+
+zigbee_worker_stats_t ZigbeeWorker::getStats() {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  auto copy = stats;
+  xSemaphoreGive(lock);
+  return copy;
+}
+
+uint32_t ZigbeeWorker::workerJob(void *pvParameters) {
+  auto _this = (ZigbeeWorker *)pvParameters;
+  _this->processNext(0);
+  // One item per run, so a burst of messages does not hold back the other
+  // jobs
+  return uxQueueMessagesWaiting(_this->queue) > 0 ? 0 : EXECUTOR_IDLE;
+}
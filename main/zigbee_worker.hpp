@@ -0,0 +1,76 @@
+#pragma once
+
+#include "esp_zigbee_core.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <stdint.h>
+
+#define ZIGBEE_WORKER_SLOTS 8
+// Fits the largest schedule command the converter sends
+#define ZIGBEE_WORKER_MAX_PAYLOAD 64
+
+enum class ZigbeeWorkKind : uint8_t {
+  AttributeReport, // Reports and read responses from other devices
+  AttributeSet,    // Writes to our own attributes
+  CustomCommand
+};
+
+struct zigbee_work_item_t {
+  ZigbeeWorkKind kind;
+  uint16_t clusterId;
+  uint16_t id; // Attribute or command id
+  esp_zb_zcl_attr_type_t type;
+  uint16_t size;
+  uint8_t data[ZIGBEE_WORKER_MAX_PAYLOAD];
+};
+
+struct zigbee_worker_stats_t {
+  uint32_t posted;
+  uint32_t coalesced; // Replaced a queued value of the same attribute
+  uint32_t dropped;   // No free slot or payload too large
+  uint32_t processed;
+  uint8_t highWatermark; // Most slots in use at once
+};
+
+/// @brief Moves the handling of inbound Zigbee messages out of the stack task.
+/// The callbacks copy the message into one of a few fixed slots and return,
+/// the application work including flash writes runs as an executor job.
+class ZigbeeWorker {
+
+public:
+  static ZigbeeWorker *GetInstance();
+
+  ZigbeeWorker(ZigbeeWorker &other) = delete;
+  void operator=(const ZigbeeWorker &) = delete;
+
+  void init();
+  /// @brief Safe to call from the Zigbee task, never blocks on the worker
+  bool postAttribute(ZigbeeWorkKind kind, uint16_t clusterId,
+                     const esp_zb_zcl_attribute_t *attribute);
+  bool postCommand(uint16_t clusterId, uint8_t commandId, const void *data,
+                   uint16_t size);
+  /// @brief Handles one queued item, waiting up to the given ticks for it
+  bool processNext(TickType_t wait);
+  zigbee_worker_stats_t getStats();
+
+protected:
+  static ZigbeeWorker *_instance;
+  ZigbeeWorker() {}
+
+private:
+  enum class SlotState : uint8_t { Free, Queued };
+
+  bool post(const zigbee_work_item_t &item, bool coalesce);
+  static void dispatch(const zigbee_work_item_t &item);
+  static uint32_t workerJob(void *pvParameters);
+
+  bool initialized = false;
+  zigbee_work_item_t slots[ZIGBEE_WORKER_SLOTS];
+  SlotState slotStates[ZIGBEE_WORKER_SLOTS] = {};
+  uint8_t slotsInUse = 0;
+  zigbee_worker_stats_t stats = {};
+  SemaphoreHandle_t lock;
+  QueueHandle_t queue; // Slot indices in arrival order
+  int8_t jobId = -1;
+};